@@ -1,2 +1,5 @@
 C:\VulkanSDK\1.4.309.0\Bin\glslc.exe shaders/default.vert -o shaders/default.vert.spv
-C:\VulkanSDK\1.4.309.0\Bin\glslc.exe shaders/default.frag -o shaders/default.frag.spv
\ No newline at end of file
+C:\VulkanSDK\1.4.309.0\Bin\glslc.exe shaders/default.frag -o shaders/default.frag.spv
+C:\VulkanSDK\1.4.309.0\Bin\glslc.exe shaders/cull.comp -o shaders/cull.comp.spv
+C:\VulkanSDK\1.4.309.0\Bin\glslc.exe shaders/default_pull.vert -o shaders/default_pull.vert.spv
+C:\VulkanSDK\1.4.309.0\Bin\glslc.exe shaders/cluster_cull.comp -o shaders/cluster_cull.comp.spv
\ No newline at end of file
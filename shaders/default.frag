@@ -1,12 +1,26 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
 
 layout(location = 0) in vec2 f_tex;
 layout(location = 1) in vec3 f_pos;
 layout(location = 2) in vec3 f_norm;
+layout(location = 3) flat in uint f_material;
 
 layout(location = 0) out vec4 out_color;
 
-layout(set = 1, binding = 0) uniform sampler2D tex;
+struct MaterialData
+{
+    uint base_color_texture;
+    uint padding[3];        // Keeps the stride at 16 bytes to match the renderer
+};
+
+// Bindless texture table + every material, indexed by the instance's material
+layout(set = 1, binding = 0) uniform sampler2D textures[];
+
+layout(set = 1, binding = 1) readonly buffer material_buffer
+{
+    MaterialData materials[];
+};
 
 struct Light
 {
@@ -42,5 +56,6 @@ void main() {
     vec3 light_dir = normalize(light_pos - f_pos);
     vec3 diffuse = light_color * max(dot(f_norm, light_dir), 0.0);
 
-    out_color = vec4(texture(tex, f_tex).rgb * (ambient + diffuse), 1.0);
+    uint texture_index = materials[f_material].base_color_texture;
+    out_color = vec4(texture(textures[nonuniformEXT(texture_index)], f_tex).rgb * (ambient + diffuse), 1.0);
 }
\ No newline at end of file
@@ -1,6 +1,10 @@
 #version 450
 
 
+// Set for VertexFormat::PACKED meshes. The position is unorm in the mesh's AABB (dequantized by the model matrix)
+// and the normal is octahedral encoded in v_norm.xy
+layout(constant_id = 0) const bool PACKED_VERTICES = false;
+
 layout(location = 0) in vec3 v_pos;
 layout(location = 1) in vec3 v_norm;
 layout(location = 2) in vec2 v_tex;
@@ -8,6 +12,7 @@ layout(location = 2) in vec2 v_tex;
 layout(location = 0) out vec2 f_tex;
 layout(location = 1) out vec3 f_pos;
 layout(location = 2) out vec3 f_norm;
+layout(location = 3) flat out uint f_material;
 
 layout(set = 0, binding = 0) uniform global_ubo
 {
@@ -15,15 +20,35 @@ layout(set = 0, binding = 0) uniform global_ubo
     mat4 view;
 }ubo;
 
-layout(push_constant) uniform pconstant
+struct InstanceData
 {
     mat4 model;
     mat4 norm_mat;
-}pc;
+    uint material_index;
+    uint vertex_format;
+};
+
+// Written by the renderer each frame. gl_InstanceIndex already includes the draw's firstInstance
+layout(set = 0, binding = 1) readonly buffer instance_buffer
+{
+    InstanceData instances[];
+};
+
+vec3 oct_decode(vec2 e)
+{
+    vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
 
 void main() {
-    gl_Position = ubo.projection * ubo.view * pc.model * vec4(v_pos, 1.0);
+    InstanceData instance = instances[gl_InstanceIndex];
+    vec3 norm = PACKED_VERTICES ? oct_decode(v_norm.xy) : v_norm;
+    gl_Position = ubo.projection * ubo.view * instance.model * vec4(v_pos, 1.0);
     f_tex = v_tex;
-    f_pos = vec3(pc.model * vec4(v_pos, 1.0));      // Multiply times model matrix
-    f_norm = normalize(mat3(pc.norm_mat) * v_norm);    // Multiply times transpose_inverse model matrix
+    f_pos = vec3(instance.model * vec4(v_pos, 1.0));      // Multiply times model matrix
+    f_norm = normalize(mat3(instance.norm_mat) * norm);    // Multiply times transpose_inverse model matrix
+    f_material = instance.material_index;
 }
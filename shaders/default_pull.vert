@@ -0,0 +1,105 @@
+#version 450
+#extension GL_EXT_buffer_reference : require
+
+// Same outputs as default.vert but vertices are fetched from the geometry pool through a device address
+// instead of fixed function vertex input, so any vertex format can be drawn with this pipeline
+
+layout(location = 0) out vec2 f_tex;
+layout(location = 1) out vec3 f_pos;
+layout(location = 2) out vec3 f_norm;
+layout(location = 3) flat out uint f_material;
+
+layout(set = 0, binding = 0) uniform global_ubo
+{
+    mat4 projection;
+    mat4 view;
+}ubo;
+
+struct InstanceData
+{
+    mat4 model;
+    mat4 norm_mat;
+    uint material_index;
+    uint vertex_format;
+};
+
+layout(set = 0, binding = 1) readonly buffer instance_buffer
+{
+    InstanceData instances[];
+};
+
+// The geometry pool's vertex arena read as 32 bit words
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer VertexWords
+{
+    uint words[];
+};
+
+layout(push_constant) uniform vertex_pull_constants
+{
+    VertexWords vertices;
+}pc;
+
+// Matches VertexFormat in twilight_types.h
+const uint VERTEX_FORMAT_STANDARD = 0;
+const uint VERTEX_FORMAT_PACKED = 1;
+
+struct DecodedVertex
+{
+    vec3 pos;
+    vec3 norm;
+    vec2 tex;
+};
+
+DecodedVertex fetch_standard(uint vertex_index)
+{
+    // pos (3 floats) | norm (3 floats) | tex (2 floats)
+    uint base = vertex_index * 8;
+    DecodedVertex vertex;
+    vertex.pos = uintBitsToFloat(uvec3(pc.vertices.words[base + 0], pc.vertices.words[base + 1], pc.vertices.words[base + 2]));
+    vertex.norm = uintBitsToFloat(uvec3(pc.vertices.words[base + 3], pc.vertices.words[base + 4], pc.vertices.words[base + 5]));
+    vertex.tex = uintBitsToFloat(uvec2(pc.vertices.words[base + 6], pc.vertices.words[base + 7]));
+    return vertex;
+}
+
+vec3 oct_decode(vec2 e)
+{
+    vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+DecodedVertex fetch_packed(uint vertex_index)
+{
+    // pos (4 unorm16, w unused) | norm (2 snorm16 octahedral) | tex (2 half). The model matrix does the dequantization
+    uint base = vertex_index * 4;
+    DecodedVertex vertex;
+    vertex.pos = vec3(unpackUnorm2x16(pc.vertices.words[base + 0]), unpackUnorm2x16(pc.vertices.words[base + 1]).x);
+    vertex.norm = oct_decode(unpackSnorm2x16(pc.vertices.words[base + 2]));
+    vertex.tex = unpackHalf2x16(pc.vertices.words[base + 3]);
+    return vertex;
+}
+
+void main() {
+    InstanceData instance = instances[gl_InstanceIndex];
+
+    // gl_VertexIndex already includes the draw's vertexOffset, which is in units of the mesh's stride
+    DecodedVertex vertex;
+    switch(instance.vertex_format)
+    {
+        case VERTEX_FORMAT_PACKED:
+            vertex = fetch_packed(gl_VertexIndex);
+            break;
+        case VERTEX_FORMAT_STANDARD:
+        default:
+            vertex = fetch_standard(gl_VertexIndex);
+            break;
+    }
+
+    gl_Position = ubo.projection * ubo.view * instance.model * vec4(vertex.pos, 1.0);
+    f_tex = vertex.tex;
+    f_pos = vec3(instance.model * vec4(vertex.pos, 1.0));
+    f_norm = normalize(mat3(instance.norm_mat) * vertex.norm);
+    f_material = instance.material_index;
+}
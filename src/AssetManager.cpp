@@ -1,57 +1,417 @@
 #include "AssetManager.h"
+#include "MeshOptimizer.h"
+#include "MipGenerator.h"
+#include "MappedFile.h"
+#include "Hash.h"
 #include <assert.h>
 
 #include <vector>
 #include <iostream>
+#include <cmath>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <thread>
+#include <algorithm>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#define MODEL_IMPORT_FLAGS (aiProcess_CalcTangentSpace | aiProcess_Triangulate | aiProcess_JoinIdenticalVertices)
+// Whole model loads in flight at once through load_model_async. Each one fans its textures out over the decode pool
+#define ASYNC_LOAD_THREAD_COUNT 2
+
+// Octahedral normal encoding, two snorm16s packed into 32 bits (x in the low half)
+static uint32_t oct_encode(glm::vec3 n)
+{
+    float length = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if(length == 0.0f)
+    {
+        // Mesh without normals, point it down +z
+        return glm::packSnorm2x16(glm::vec2(0.0f));
+    }
+
+    n /= length;
+    glm::vec2 encoded = glm::vec2(n.x, n.y);
+    if(n.z < 0.0f)
+    {
+        glm::vec2 sign_not_zero = glm::vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+        encoded = (1.0f - glm::abs(glm::vec2(n.y, n.x))) * sign_not_zero;
+    }
+    return glm::packSnorm2x16(encoded);
+}
+
 namespace Twilight
 {
+    ModelHandle::ModelHandle()
+    {
+
+    }
+
+    ModelHandle::ModelHandle(std::shared_future<std::shared_ptr<SceneNode>> result)
+    :result(std::move(result))
+    {
+
+    }
+
+    bool ModelHandle::is_valid() const
+    {
+        return this->result.valid();
+    }
+
+    bool ModelHandle::is_ready() const
+    {
+        return this->result.valid() && this->result.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+
+    std::shared_ptr<SceneNode> ModelHandle::get() const
+    {
+        return is_ready() ? this->result.get() : nullptr;
+    }
+
+    std::shared_ptr<SceneNode> ModelHandle::wait() const
+    {
+        return this->result.valid() ? this->result.get() : nullptr;
+    }
+
     AssetManager::AssetManager()
-    :importer(), renderer(nullptr)
+    :renderer(nullptr)
     {
         stbi_set_flip_vertically_on_load(true);
     }
 
+    // Loads still queued or running finish first, they use the decode pool
     AssetManager::~AssetManager()
     {
-
+        this->load_pool.destroy();
+        this->thread_pool.destroy();
     }
 
     void AssetManager::init(Twilight::Render::Renderer* renderer)
     {
         this->renderer = renderer;
+        this->thread_pool.init();
+        this->load_pool.init(ASYNC_LOAD_THREAD_COUNT);
     }
 
     std::shared_ptr<SceneNode> AssetManager::load_model(const std::string& path)
     {
-        // FIXME: hacky way to do this for now
+        // Kept local until the end so concurrent loads don't mix their numbers
+        AssetLoadTimings timings = {};
+        auto start = std::chrono::high_resolution_clock::now();
+
+        // Cached models reference cooked textures so there's nothing to cache without them
+        std::string cache_path;
+        uint64_t cache_key = 0;
+        if(this->cache_models && this->compress_textures)
+        {
+            MappedFile source;
+            if(source.open(path))
+            {
+                cache_key = get_model_cache_key(source);
+                char name[32];
+                snprintf(name, sizeof(name), "%016llx.tmdl", (unsigned long long)cache_key);
+                cache_path = (std::filesystem::path(this->model_cache_directory) / name).string();
+            }
+
+            MappedFile cache_file;
+            ModelCache::View view;
+            if(!cache_path.empty() && cache_file.open(cache_path) && ModelCache::open(cache_file, cache_key, view) && cached_textures_exist(view))
+            {
+                auto parse_end = std::chrono::high_resolution_clock::now();
+                timings.parse_ms = std::chrono::duration<double, std::milli>(parse_end - start).count();
+                timings.from_cache = true;
+
+                std::shared_ptr<SceneNode> root = load_cached_model(view, parse_end, timings);
+                timings.total_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
 
-        const aiScene* scene = importer.ReadFile(path, aiProcess_CalcTangentSpace | aiProcess_Triangulate | aiProcess_JoinIdenticalVertices);
+                {
+                    std::lock_guard<std::mutex> lock(this->stats_mutex);
+                    this->load_timings = timings;
+                }
+                print_vertex_memory_report();
+                print_load_timings(path, timings);
+                return root;
+            }
+        }
+
+        ModelCache::Writer cache_writer;
+        ModelCache::Writer* writer = cache_path.empty() ? nullptr : &cache_writer;
 
-        if(scene == nullptr)
+        // The document has to outlive the uploads, its accessors and images point into its mapping.
+        // Each load gets its own importer, they can't be shared between threads
+        std::shared_ptr<SceneNode> root;
+        Gltf::Document document;
+        Assimp::Importer importer;
+        if(this->use_native_gltf && std::filesystem::path(path).extension() == ".glb" && document.open(path))
         {
-            std::cout << "Failed to load model: " << path << std::endl;
-            return {};
+            auto parse_end = std::chrono::high_resolution_clock::now();
+            timings.parse_ms = std::chrono::duration<double, std::milli>(parse_end - start).count();
+            root = load_gltf(document, writer, parse_end, timings);
         }
+        else
+        {
+            const aiScene* scene = importer.ReadFile(path, MODEL_IMPORT_FLAGS);
+            auto parse_end = std::chrono::high_resolution_clock::now();
+            timings.parse_ms = std::chrono::duration<double, std::milli>(parse_end - start).count();
 
-        std::vector<uint32_t> material_offsets = load_materials(scene);
+            if(scene == nullptr)
+            {
+                std::lock_guard<std::mutex> lock(this->log_mutex);
+                std::cout << "Failed to load model: " << path << std::endl;
+                return {};
+            }
+
+            std::vector<uint32_t> cache_materials;
+            std::vector<uint32_t> material_ids = load_materials(scene, writer, cache_materials, timings);
+            auto materials_end = std::chrono::high_resolution_clock::now();
+            timings.materials_ms = std::chrono::duration<double, std::milli>(materials_end - parse_end).count();
+
+            // load_lights();
+            // load_cameras();
+
+            root = load_node(scene->mRootNode, scene, material_ids, cache_materials, glm::mat4(1.0f), nullptr, writer, -1);
+            for(uint32_t material_id : material_ids)
+            {
+                if(material_id != 0) renderer->release_material(material_id);
+            }
+            timings.meshes_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - materials_end).count();
+        }
+        timings.total_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
 
-        // load_lights();
-        // load_cameras();
+        if(writer != nullptr)
+        {
+            // Written under a per-thread name and renamed, two loads of the same model can be saving at once
+            std::error_code error;
+            std::filesystem::create_directories(this->model_cache_directory, error);
+            std::string temp_path = cache_path + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+            if(!error && writer->save(temp_path, cache_key))
+            {
+                std::filesystem::rename(temp_path, cache_path, error);
+                std::lock_guard<std::mutex> lock(this->log_mutex);
+                if(!error) std::cout << "Model cached: " << cache_path << std::endl;
+            }
+            if(error) std::filesystem::remove(temp_path, error);
+        }
 
-        std::shared_ptr<SceneNode> root = load_node(scene->mRootNode, scene, material_offsets, glm::mat4(1.0f), nullptr);
+        {
+            std::lock_guard<std::mutex> lock(this->stats_mutex);
+            this->load_timings = timings;
+        }
+        print_vertex_memory_report();
+        print_load_timings(path, timings);
 
         return root;
     }
 
-    std::shared_ptr<SceneNode> AssetManager::load_node(aiNode* node, const aiScene* scene, const std::vector<uint32_t>& material_offsets, const glm::mat4& parent_transform, std::shared_ptr<SceneNode> parent)
+    ModelHandle AssetManager::load_model_async(const std::string& path)
+    {
+        return ModelHandle(this->load_pool.submit([this, path]() { return load_model(path); }).share());
+    }
+
+    static void collect_nodes(const std::shared_ptr<SceneNode>& node, std::vector<std::shared_ptr<SceneNode>>& out_nodes)
+    {
+        out_nodes.push_back(node);
+        for(const std::shared_ptr<SceneNode>& child : node->children)
+        {
+            collect_nodes(child, out_nodes);
+        }
+    }
+
+    ModelHandle AssetManager::acquire_model(const std::string& path)
+    {
+        auto resident = this->resident_models.find(path);
+        if(resident != this->resident_models.end())
+        {
+            resident->second.ref_count++;
+            return resident->second.handle;
+        }
+
+        // Nodes are collected on the load thread, before anyone gets the root to attach things to
+        std::shared_ptr<std::vector<std::shared_ptr<SceneNode>>> nodes = std::make_shared<std::vector<std::shared_ptr<SceneNode>>>();
+        ModelHandle handle(this->load_pool.submit([this, path, nodes]() {
+            std::shared_ptr<SceneNode> root = load_model(path);
+            if(root) collect_nodes(root, *nodes);
+            return root;
+        }).share());
+
+        this->resident_models[path] = { handle, 1, nodes };
+        return handle;
+    }
+
+    void AssetManager::release_model(const std::string& path)
+    {
+        auto resident = this->resident_models.find(path);
+        if(resident == this->resident_models.end() || resident->second.ref_count == 0)
+        {
+            std::cout << "Released " << path << " without acquiring it" << std::endl;
+            return;
+        }
+        resident->second.ref_count--;
+    }
+
+    void AssetManager::set_memory_budget(uint64_t bytes)
+    {
+        this->memory_budget = bytes;
+    }
+
+    void AssetManager::unload_model(ResidentModel& model)
+    {
+        for(const std::shared_ptr<SceneNode>& node : *model.nodes)
+        {
+            for(Render::Mesh& mesh : node->meshes)
+            {
+                this->renderer->destroy_mesh(mesh);
+            }
+            node->meshes.clear();
+        }
+        model.nodes->clear();
+    }
+
+    // Only device local memory VMA knows about counts, geometry pool space is reused rather than given back.
+    // One model per call since what it frees only shows up in the usage once the frames in flight are done with it
+    void AssetManager::update_residency()
+    {
+        uint64_t frame = this->renderer->get_frame_number();
+        if(frame < this->next_eviction_frame) return;
+
+        Render::MemoryBudget memory = this->renderer->get_memory_budget();
+        uint64_t budget = this->memory_budget > 0 ? this->memory_budget : memory.budget / 10 * 9;
+        if(memory.usage <= budget) return;
+
+        // Loads still running can't be unloaded yet
+        auto victim = this->resident_models.end();
+        uint64_t victim_drawn = UINT64_MAX;
+        for(auto resident = this->resident_models.begin(); resident != this->resident_models.end(); resident++)
+        {
+            if(resident->second.ref_count > 0 || !resident->second.handle.is_ready()) continue;
+
+            uint64_t last_drawn = 0;
+            for(const std::shared_ptr<SceneNode>& node : *resident->second.nodes)
+            {
+                last_drawn = std::max(last_drawn, node->last_drawn_frame);
+            }
+            if(last_drawn < victim_drawn)
+            {
+                victim = resident;
+                victim_drawn = last_drawn;
+            }
+        }
+        if(victim == this->resident_models.end()) return;
+
+        {
+            std::lock_guard<std::mutex> lock(this->log_mutex);
+            std::cout << "Evicting " << victim->first << " (last drawn on frame " << victim_drawn << "), device memory at " << memory.usage / (1024 * 1024)
+                      << " MB of " << budget / (1024 * 1024) << " MB" << std::endl;
+        }
+        unload_model(victim->second);
+        this->resident_models.erase(victim);
+        this->next_eviction_frame = frame + this->renderer->get_frames_in_flight() + 1;
+    }
+
+    void AssetManager::unload_all_models()
+    {
+        for(std::pair<const std::string, ResidentModel>& resident : this->resident_models)
+        {
+            resident.second.handle.wait();
+            unload_model(resident.second);
+        }
+        this->resident_models.clear();
+    }
+
+    // Everything that changes what a model cooks to goes into the key, including the layouts the blobs are stored in
+    uint64_t AssetManager::get_model_cache_key(const MappedFile& source) const
+    {
+        struct
+        {
+            uint32_t import_flags;
+            uint32_t vertex_size, packed_vertex_size, meshlet_size;
+            uint8_t pack_vertices, optimize_meshes, build_meshlets, native_gltf;
+        } settings = { MODEL_IMPORT_FLAGS, sizeof(Render::Vertex), sizeof(Render::PackedVertex), sizeof(Render::Meshlet),
+                       this->pack_vertices, this->optimize_meshes, this->build_meshlets, this->use_native_gltf };
+
+        uint64_t hash = hash_bytes(source.get_data(), source.get_size());
+        return hash_bytes(&settings, sizeof(settings), hash);
+    }
+
+    bool AssetManager::cached_textures_exist(const ModelCache::View& view) const
+    {
+        std::error_code error;
+        for(uint32_t i = 0; i < view.header->material_count; i++)
+        {
+            if(!std::filesystem::exists(std::filesystem::path(this->texture_cache_directory) / view.materials[i].texture, error)) return false;
+        }
+        return true;
+    }
+
+    // Rebuilds the scene graph from a mapped cache. Geometry goes from the mapping straight into the upload manager's staging
+    std::shared_ptr<SceneNode> AssetManager::load_cached_model(const ModelCache::View& view, std::chrono::high_resolution_clock::time_point start, AssetLoadTimings& timings)
+    {
+        std::vector<std::future<DecodedTexture>> decodes;
+        decodes.reserve(view.header->material_count);
+        for(uint32_t i = 0; i < view.header->material_count; i++)
+        {
+            std::string texture_path = (std::filesystem::path(this->texture_cache_directory) / view.materials[i].texture).string();
+            decodes.push_back(this->thread_pool.submit([this, texture_path]() { return load_cooked_texture(texture_path, Render::MaterialTextureType::BASE_COLOR); }));
+        }
+        std::vector<uint32_t> material_ids = upload_textures(decodes, nullptr, timings);
+        auto materials_end = std::chrono::high_resolution_clock::now();
+        timings.materials_ms = std::chrono::duration<double, std::milli>(materials_end - start).count();
+
+        std::vector<std::shared_ptr<SceneNode>> nodes(view.header->node_count);
+        for(uint32_t node_index = 0; node_index < view.header->node_count; node_index++)
+        {
+            const ModelCache::Node& cached_node = view.nodes[node_index];
+            std::shared_ptr<SceneNode> scene_node = std::make_shared<SceneNode>();
+            scene_node->local_transform = cached_node.local_transform;
+            scene_node->world_matrix = cached_node.parent < 0 ? cached_node.local_transform : nodes[cached_node.parent]->world_matrix * cached_node.local_transform;
+
+            for(uint32_t mesh_index = cached_node.first_mesh; mesh_index < cached_node.first_mesh + cached_node.mesh_count; mesh_index++)
+            {
+                const ModelCache::Mesh& cached = view.meshes[mesh_index];
+                // Untextured materials (UINT32_MAX) and cooked textures that failed to load use material 0 instead
+                uint32_t material = cached.material < material_ids.size() && material_ids[cached.material] != UINT32_MAX ? material_ids[cached.material] : 0;
+                Render::Mesh mesh = renderer->create_mesh(view.data + cached.vertex_offset, cached.vertex_count, cached.vertex_format, cached.quantization, cached.bounds,
+                                                          view.data + cached.index_offset, cached.index_count, cached.index_type, material);
+                if(cached.meshlet_count > 0)
+                {
+                    renderer->upload_meshlets(mesh, (const Render::Meshlet*)(view.data + cached.meshlet_offset), cached.meshlet_count);
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(this->stats_mutex);
+                    this->vertex_memory.vertex_count += cached.vertex_count;
+                    this->vertex_memory.standard_bytes += cached.vertex_count * sizeof(Render::Vertex);
+                    this->vertex_memory.packed_bytes += cached.vertex_count * sizeof(Render::PackedVertex);
+                }
+
+                scene_node->meshes.push_back(mesh);
+            }
+
+            if(cached_node.parent >= 0)
+            {
+                scene_node->parent = nodes[cached_node.parent];
+                nodes[cached_node.parent]->children.push_back(scene_node);
+            }
+            nodes[node_index] = scene_node;
+        }
+
+        for(uint32_t material_id : material_ids)
+        {
+            if(material_id != UINT32_MAX) renderer->release_material(material_id);
+        }
+
+        timings.meshes_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - materials_end).count();
+        return nodes[0];
+    }
+
+    std::shared_ptr<SceneNode> AssetManager::load_node(aiNode* node, const aiScene* scene, const std::vector<uint32_t>& material_ids, const std::vector<uint32_t>& cache_materials,
+                                                       const glm::mat4& parent_transform, std::shared_ptr<SceneNode> parent, ModelCache::Writer* cache_writer, int32_t parent_index)
     {
         std::shared_ptr<SceneNode> scene_node = std::make_shared<SceneNode>();
         scene_node->local_transform = mat4x4_assimp_to_glm(node->mTransformation);
         scene_node->world_matrix = parent_transform * scene_node->local_transform;
+        uint32_t node_index = cache_writer != nullptr ? cache_writer->add_node(scene_node->local_transform, parent_index) : 0;
         
         for(int mesh_idx = 0; mesh_idx < node->mNumMeshes; mesh_idx++)
         {
@@ -70,21 +430,166 @@ namespace Twilight
                 load_indices(mesh, indices);
             }
 
-            Render::Mesh node_mesh = renderer->create_mesh(vertices, indices, material_offsets[mesh->mMaterialIndex]);
-
-            scene_node->meshes.push_back(node_mesh);
+            scene_node->meshes.push_back(upload_mesh(mesh->mName.C_Str(), vertices, indices, material_ids[mesh->mMaterialIndex], cache_writer, node_index, cache_materials[mesh->mMaterialIndex]));
         }
 
         for(int child_idx = 0; child_idx < node->mNumChildren; child_idx++)
         {
-            scene_node->children.push_back(load_node(node->mChildren[child_idx], scene, material_offsets, scene_node->world_matrix, scene_node));
+            scene_node->children.push_back(load_node(node->mChildren[child_idx], scene, material_ids, cache_materials, scene_node->world_matrix, scene_node, cache_writer, (int32_t)node_index));
+        }
+
+        scene_node->parent = parent;
+
+        return scene_node;
+    }
+
+    // Materials are uploaded in glTF material order. The root is an identity node over the scene's root nodes, like the importer's
+    std::shared_ptr<SceneNode> AssetManager::load_gltf(const Gltf::Document& document, ModelCache::Writer* cache_writer, std::chrono::high_resolution_clock::time_point start,
+                                                       AssetLoadTimings& timings)
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->log_mutex);
+            std::cout << "Material Count: " << document.materials.size() << std::endl;
+        }
+
+        std::vector<int32_t> material_decodes(document.materials.size(), -1);
+        std::vector<std::future<DecodedTexture>> decodes;
+        decodes.reserve(document.materials.size());
+        for(size_t mat_index = 0; mat_index < document.materials.size(); mat_index++)
+        {
+            const Gltf::Material& material = document.materials[mat_index];
+            if(material.base_color_data == nullptr) continue;
+
+            material_decodes[mat_index] = (int32_t)decodes.size();
+            decodes.push_back(this->thread_pool.submit([this, material]() { return decode_texture(material.base_color_data, material.base_color_size, Render::MaterialTextureType::BASE_COLOR); }));
+        }
+        std::vector<uint32_t> decode_ids = upload_textures(decodes, cache_writer, timings);
+
+        // The cache's material table only has the textures that were uploaded, in upload order
+        std::vector<uint32_t> material_ids(document.materials.size(), 0);
+        std::vector<uint32_t> cache_materials(document.materials.size(), UINT32_MAX);
+        std::vector<uint32_t> cache_indices(decode_ids.size(), UINT32_MAX);
+        uint32_t cache_count = 0;
+        for(size_t i = 0; i < decode_ids.size(); i++)
+        {
+            if(decode_ids[i] != UINT32_MAX) cache_indices[i] = cache_count++;
+        }
+        for(size_t mat_index = 0; mat_index < document.materials.size(); mat_index++)
+        {
+            int32_t decode = material_decodes[mat_index];
+            if(decode < 0 || decode_ids[decode] == UINT32_MAX) continue;
+            material_ids[mat_index] = decode_ids[decode];
+            cache_materials[mat_index] = cache_indices[decode];
+        }
+
+        auto materials_end = std::chrono::high_resolution_clock::now();
+        timings.materials_ms = std::chrono::duration<double, std::milli>(materials_end - start).count();
+
+        std::shared_ptr<SceneNode> root = std::make_shared<SceneNode>();
+        root->local_transform = glm::mat4(1.0f);
+        root->world_matrix = glm::mat4(1.0f);
+        if(cache_writer != nullptr) cache_writer->add_node(root->local_transform, -1);
+
+        for(uint32_t root_node : document.scene_roots)
+        {
+            root->children.push_back(load_gltf_node(document, root_node, material_ids, cache_materials, root, cache_writer, 0));
         }
 
+        for(uint32_t material_id : decode_ids)
+        {
+            if(material_id != UINT32_MAX) renderer->release_material(material_id);
+        }
+
+        timings.meshes_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - materials_end).count();
+        return root;
+    }
+
+    // Each glTF primitive becomes one mesh of the node
+    std::shared_ptr<SceneNode> AssetManager::load_gltf_node(const Gltf::Document& document, uint32_t node_index, const std::vector<uint32_t>& material_ids, const std::vector<uint32_t>& cache_materials,
+                                                            std::shared_ptr<SceneNode> parent, ModelCache::Writer* cache_writer, int32_t parent_index)
+    {
+        const Gltf::Node& node = document.nodes[node_index];
+        std::shared_ptr<SceneNode> scene_node = std::make_shared<SceneNode>();
+        scene_node->local_transform = node.local_transform;
+        scene_node->world_matrix = parent->world_matrix * scene_node->local_transform;
         scene_node->parent = parent;
+        uint32_t cache_node = cache_writer != nullptr ? cache_writer->add_node(scene_node->local_transform, parent_index) : 0;
+
+        if(node.mesh >= 0)
+        {
+            const Gltf::Mesh& mesh = document.meshes[node.mesh];
+            for(const Gltf::Primitive& primitive : mesh.primitives)
+            {
+                std::vector<Render::Vertex> vertices = {};
+                std::vector<unsigned int> indices = {};
+                document.read_vertices(primitive, vertices);
+                document.read_indices(primitive, indices);
+
+                bool has_material = primitive.material >= 0 && (size_t)primitive.material < material_ids.size();
+                uint32_t material_id = has_material ? material_ids[primitive.material] : 0;
+                uint32_t cache_material = has_material ? cache_materials[primitive.material] : UINT32_MAX;
+                scene_node->meshes.push_back(upload_mesh(mesh.name, vertices, indices, material_id, cache_writer, cache_node, cache_material));
+            }
+        }
+
+        for(uint32_t child : node.children)
+        {
+            scene_node->children.push_back(load_gltf_node(document, child, material_ids, cache_materials, scene_node, cache_writer, (int32_t)cache_node));
+        }
 
         return scene_node;
     }
 
+    // Everything after getting a mesh's vertices and indices out of the source: optimizing, meshlets, packing, the upload and the cache
+    Render::Mesh AssetManager::upload_mesh(const std::string& name, std::vector<Render::Vertex>& vertices, std::vector<unsigned int>& indices, uint32_t material_id,
+                                           ModelCache::Writer* cache_writer, uint32_t cache_node, uint32_t cache_material)
+    {
+        if(this->optimize_meshes && !vertices.empty() && !indices.empty())
+        {
+            optimize_mesh(name.c_str(), vertices, indices);
+        }
+
+        // Built from the float positions so the bounds are in object space for both vertex formats
+        std::vector<Render::Meshlet> meshlets = {};
+        if(this->build_meshlets && !vertices.empty() && !indices.empty())
+        {
+            meshlets = build_mesh_meshlets(vertices, indices);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(this->stats_mutex);
+            this->vertex_memory.vertex_count += vertices.size();
+            this->vertex_memory.standard_bytes += vertices.size() * sizeof(Render::Vertex);
+            this->vertex_memory.packed_bytes += vertices.size() * sizeof(Render::PackedVertex);
+        }
+
+        Render::Mesh node_mesh;
+        std::vector<Render::PackedVertex> packed_vertices = {};
+        if(this->pack_vertices)
+        {
+            Render::VertexQuantization quantization = {glm::vec3(0.0f), glm::vec3(1.0f)};
+            quantize_vertices(vertices, packed_vertices, quantization);
+            node_mesh = renderer->create_mesh(packed_vertices, quantization, indices, material_id);
+        }
+        else
+        {
+            node_mesh = renderer->create_mesh(vertices, indices, material_id);
+        }
+
+        if(!meshlets.empty())
+        {
+            renderer->upload_meshlets(node_mesh, meshlets);
+        }
+
+        if(cache_writer != nullptr)
+        {
+            const void* vertex_data = this->pack_vertices ? (const void*)packed_vertices.data() : (const void*)vertices.data();
+            cache_writer->add_mesh(cache_node, node_mesh, vertex_data, indices, meshlets, cache_material);
+        }
+
+        return node_mesh;
+    }
+
     void AssetManager::load_vertices(const aiMesh* mesh, std::vector<Render::Vertex>& out_vertices)
     {
         for(int vert_idx = 0; vert_idx < mesh->mNumVertices; vert_idx++)
@@ -114,6 +619,72 @@ namespace Twilight
         }
     }
 
+    // Positions are stored relative to the mesh's AABB which is returned in quantization
+    void AssetManager::quantize_vertices(const std::vector<Render::Vertex>& vertices, std::vector<Render::PackedVertex>& out_vertices, Render::VertexQuantization& out_quantization)
+    {
+        if(vertices.empty()) return;
+        out_vertices.reserve(vertices.size());
+
+        glm::vec3 min = vertices[0].pos, max = vertices[0].pos;
+        for(const Render::Vertex& vertex : vertices)
+        {
+            min = glm::min(min, vertex.pos);
+            max = glm::max(max, vertex.pos);
+        }
+        glm::vec3 extent = max - min;
+        out_quantization = {min, extent};
+
+        // Flat axes (extent 0) all quantize to 0
+        glm::vec3 inv_extent = glm::vec3(extent.x > 0.0f ? 1.0f / extent.x : 0.0f, extent.y > 0.0f ? 1.0f / extent.y : 0.0f, extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+
+        for(const Render::Vertex& vertex : vertices)
+        {
+            glm::vec3 unorm = glm::clamp((vertex.pos - min) * inv_extent, 0.0f, 1.0f);
+            Render::PackedVertex packed = {};
+            packed.pos[0] = static_cast<uint16_t>(std::lround(unorm.x * 65535.0f));
+            packed.pos[1] = static_cast<uint16_t>(std::lround(unorm.y * 65535.0f));
+            packed.pos[2] = static_cast<uint16_t>(std::lround(unorm.z * 65535.0f));
+            packed.norm = oct_encode(vertex.norm);
+            packed.tex = glm::packHalf2x16(vertex.tex);
+            out_vertices.push_back(packed);
+        }
+    }
+
+    // Reorders triangles for the post transform cache, then clusters them to cut overdraw, then renumbers vertices in the order they are used
+    void AssetManager::optimize_mesh(const char* name, std::vector<Render::Vertex>& vertices, std::vector<unsigned int>& indices)
+    {
+        MeshOptimizer::VertexCacheStats before = MeshOptimizer::analyze_vertex_cache(indices, vertices.size());
+
+        MeshOptimizer::optimize_vertex_cache(indices, vertices.size());
+        MeshOptimizer::optimize_overdraw(indices, &vertices[0].pos.x, vertices.size(), sizeof(Render::Vertex));
+        std::vector<uint32_t> remap = MeshOptimizer::optimize_vertex_fetch(indices, vertices.size());
+        MeshOptimizer::remap_vertices(vertices, remap);
+
+        MeshOptimizer::VertexCacheStats after = MeshOptimizer::analyze_vertex_cache(indices, vertices.size());
+        std::lock_guard<std::mutex> lock(this->log_mutex);
+        std::cout << "Mesh " << name << " (" << indices.size() / 3 << " triangles): ACMR " << before.acmr << " -> " << after.acmr
+                  << ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
+    }
+
+    std::vector<Render::Meshlet> AssetManager::build_mesh_meshlets(const std::vector<Render::Vertex>& vertices, const std::vector<unsigned int>& indices)
+    {
+        std::vector<MeshOptimizer::Meshlet> clusters = MeshOptimizer::build_meshlets(indices, &vertices[0].pos.x, vertices.size(), sizeof(Render::Vertex));
+
+        std::vector<Render::Meshlet> meshlets;
+        meshlets.reserve(clusters.size());
+        for(const MeshOptimizer::Meshlet& cluster : clusters)
+        {
+            meshlets.push_back({
+                .sphere = glm::vec4(cluster.center[0], cluster.center[1], cluster.center[2], cluster.radius),
+                .cone = glm::vec4(cluster.cone_axis[0], cluster.cone_axis[1], cluster.cone_axis[2], cluster.cone_cutoff),
+                .cone_apex = glm::vec3(cluster.cone_apex[0], cluster.cone_apex[1], cluster.cone_apex[2]),
+                .first_index = cluster.first_index,
+                .index_count = cluster.index_count
+            });
+        }
+        return meshlets;
+    }
+
     void AssetManager::load_indices(const aiMesh* mesh, std::vector<unsigned int>& out_indices)
     {
         for(int face_idx = 0; face_idx < mesh->mNumFaces; face_idx++)
@@ -127,13 +698,19 @@ namespace Twilight
     }
 
     // Loads materials from a given scene. The materials are referenced by meshes via their material index (i.e. mesh0 might have material at index 0 and mesh1 might have material at index 2)
-    // returns the offset in the renderer's global material list. Add offset to the loaded mesh's material index to get the global index
-    // i.e. If mesh0 has a material index of 2 and load_materials returns 3 then the global offset (the number that should be stored in the mesh's material_index member) should be 5
-    std::vector<uint32_t> AssetManager::load_materials(const aiScene* scene)
+    // returns the renderer material id for every scene material, indexed by the mesh's material index. Untextured materials and failed decodes get 0, the default material
+    // cache_materials gets each scene material's index in the cache's material table, UINT32_MAX for the ones without a texture
+    std::vector<uint32_t> AssetManager::load_materials(const aiScene* scene, ModelCache::Writer* cache_writer, std::vector<uint32_t>& cache_materials, AssetLoadTimings& timings)
     {
-        std::cout << "Material Count: " << scene->mNumMaterials << std::endl;
-        std::vector<uint32_t> material_offsets;
-        material_offsets.reserve(scene->mNumMaterials);
+        {
+            std::lock_guard<std::mutex> lock(this->log_mutex);
+            std::cout << "Material Count: " << scene->mNumMaterials << std::endl;
+        }
+
+        // Every texture is decoded on the pool up front, uploads happen here in material order as each one is ready
+        std::vector<int32_t> material_decodes(scene->mNumMaterials, -1);
+        std::vector<std::future<DecodedTexture>> decodes;
+        decodes.reserve(scene->mNumMaterials);
         for(int mat_index = 0; mat_index < scene->mNumMaterials; mat_index++)
         {
             aiMaterial* material = scene->mMaterials[mat_index];
@@ -141,18 +718,313 @@ namespace Twilight
             aiString tex_path;
             material->GetTexture(aiTextureType_BASE_COLOR, 0, &tex_path);
             const aiTexture* texture = scene->GetEmbeddedTexture(tex_path.C_Str());
-            if(texture != nullptr)
+            // mHeight is 0 for textures still in their file format, anything else is raw aiTexels which aren't handled
+            if(texture != nullptr && texture->mHeight == 0)
+            {
+                material_decodes[mat_index] = (int32_t)decodes.size();
+                decodes.push_back(this->thread_pool.submit([this, texture]() { return decode_texture((const uint8_t*)texture->pcData, texture->mWidth, Render::MaterialTextureType::BASE_COLOR); }));
+            }
+        }
+
+        std::vector<uint32_t> decode_ids = upload_textures(decodes, cache_writer, timings);
+
+        // The cache's material table only has the textures that were uploaded, in upload order
+        std::vector<uint32_t> material_ids(scene->mNumMaterials, 0);
+        cache_materials.assign(scene->mNumMaterials, UINT32_MAX);
+        std::vector<uint32_t> cache_indices(decode_ids.size(), UINT32_MAX);
+        uint32_t cache_count = 0;
+        for(size_t i = 0; i < decode_ids.size(); i++)
+        {
+            if(decode_ids[i] != UINT32_MAX) cache_indices[i] = cache_count++;
+        }
+        for(uint32_t mat_index = 0; mat_index < scene->mNumMaterials; mat_index++)
+        {
+            int32_t decode = material_decodes[mat_index];
+            if(decode < 0 || decode_ids[decode] == UINT32_MAX) continue;
+            material_ids[mat_index] = decode_ids[decode];
+            cache_materials[mat_index] = cache_indices[decode];
+        }
+        return material_ids;
+    }
+
+    // Uploads decode results in order as they finish, so earlier uploads overlap later decodes. Returns the material id of
+    // each decode, UINT32_MAX for ones that failed. Identical textures come back as the same material, and every id holds
+    // a reference the caller drops once its meshes have taken their own
+    std::vector<uint32_t> AssetManager::upload_textures(std::vector<std::future<DecodedTexture>>& decodes, ModelCache::Writer* cache_writer, AssetLoadTimings& timings)
+    {
+        std::vector<uint32_t> material_ids(decodes.size(), UINT32_MAX);
+        for(size_t i = 0; i < decodes.size(); i++)
+        {
+            auto wait_start = std::chrono::high_resolution_clock::now();
+            DecodedTexture decoded = decodes[i].get();
+            auto upload_start = std::chrono::high_resolution_clock::now();
+            timings.decode_wait_ms += std::chrono::duration<double, std::milli>(upload_start - wait_start).count();
+            timings.decode_ms += decoded.decode_ms;
+
+            if(decoded.binding.data == nullptr) continue;
+
+            material_ids[i] = renderer->load_material({}, {decoded.binding});
+            if(cache_writer != nullptr)
             {
-                int width, height;
-                unsigned char* image_data = stbi_load_from_memory((unsigned char*)texture->pcData, texture->mWidth, &width, &height, nullptr, 4);
+                cache_writer->add_material(decoded.cache_name);
+            }
+            timings.texture_upload_ms += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - upload_start).count();
+            timings.texture_count++;
+        }
 
-                material_offsets.push_back(renderer->load_material({}, {{image_data, static_cast<uint32_t>(width), static_cast<uint32_t>(height), Render::MaterialTextureType::BASE_COLOR}}));
+        return material_ids;
+    }
 
+    // Runs on the thread pool. data is the encoded image (PNG, JPEG...), only it and the asset manager's settings are touched
+    AssetManager::DecodedTexture AssetManager::decode_texture(const uint8_t* data, uint64_t size, Render::MaterialTextureType type)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        DecodedTexture decoded = {};
+
+        TextureCompressor::CompressedTexture compressed;
+        if(this->compress_textures && cook_texture(data, size, type, compressed, decoded.cache_name))
+        {
+            set_compressed_binding(decoded, compressed, type);
+            // The cache entry's name is the source hash plus the format, the same for a model loaded from its cache
+            decoded.binding.content_hash = hash_bytes(decoded.cache_name.data(), decoded.cache_name.size());
+        }
+        else
+        {
+            int width, height;
+            unsigned char* image_data = stbi_load_from_memory(data, (int)size, &width, &height, nullptr, 4);
+            if(image_data != nullptr)
+            {
+                decoded.binding = {nullptr, static_cast<uint32_t>(width), static_cast<uint32_t>(height), type, 1, VK_FORMAT_UNDEFINED, 0};
+                if(this->precompute_mips)
+                {
+                    decoded.pixels = MipGenerator::generate(image_data, decoded.binding.width, decoded.binding.height, type == Render::MaterialTextureType::BASE_COLOR);
+                    decoded.binding.mip_levels = MipGenerator::get_level_count(decoded.binding.width, decoded.binding.height);
+                }
+                else
+                {
+                    decoded.pixels.assign(image_data, image_data + (uint64_t)width * height * 4);
+                }
+                decoded.binding.data = decoded.pixels.data();
+                decoded.binding.content_hash = hash_bytes(&decoded.binding.mip_levels, sizeof(decoded.binding.mip_levels), hash_bytes(data, size));
                 stbi_image_free(image_data);
             }
+            else
+            {
+                std::lock_guard<std::mutex> lock(this->log_mutex);
+                std::cout << "Failed to decode texture: " << stbi_failure_reason() << std::endl;
+            }
+        }
+
+        decoded.decode_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        return decoded;
+    }
+
+    // Runs on the thread pool. For models loaded from their cache, whose textures are always already cooked
+    AssetManager::DecodedTexture AssetManager::load_cooked_texture(const std::string& path, Render::MaterialTextureType type)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        DecodedTexture decoded = {};
+
+        TextureCompressor::CompressedTexture compressed;
+        if(TextureCompressor::load(path, compressed))
+        {
+            set_compressed_binding(decoded, compressed, type);
+            std::string name = std::filesystem::path(path).filename().string();
+            decoded.binding.content_hash = hash_bytes(name.data(), name.size());
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock(this->log_mutex);
+            std::cout << "Failed to load cooked texture: " << path << std::endl;
+        }
+
+        decoded.decode_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        return decoded;
+    }
+
+    // Takes the blocks out of compressed
+    void AssetManager::set_compressed_binding(DecodedTexture& decoded, TextureCompressor::CompressedTexture& compressed, Render::MaterialTextureType type)
+    {
+        VkFormat format = compressed.format == TextureCompressor::Format::BC7 ? VK_FORMAT_BC7_SRGB_BLOCK
+                        : compressed.format == TextureCompressor::Format::BC5 ? VK_FORMAT_BC5_UNORM_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+        decoded.pixels = std::move(compressed.data);
+        decoded.binding = {decoded.pixels.data(), compressed.width, compressed.height, type, compressed.level_count, format, 0};
+    }
+
+    // Loads the texture's cooked blocks from the cache, or decodes, mips, compresses and caches it on a miss.
+    // Color textures are compressed as sRGB, BC1/BC5 expect linear data. out_cache_name is the entry's file name in the cache
+    bool AssetManager::cook_texture(const uint8_t* data, uint64_t size, Render::MaterialTextureType type, TextureCompressor::CompressedTexture& out_texture, std::string& out_cache_name)
+    {
+        TextureCompressor::Format format = type == Render::MaterialTextureType::BASE_COLOR ? TextureCompressor::Format::BC7
+                                         : type == Render::MaterialTextureType::NORMAL ? TextureCompressor::Format::BC5 : TextureCompressor::Format::BC1;
+
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx_%u.ttex", (unsigned long long)hash_bytes(data, size), (uint32_t)format);
+        std::filesystem::path cache_path = std::filesystem::path(this->texture_cache_directory) / name;
+        out_cache_name = name;
+
+        auto start = std::chrono::high_resolution_clock::now();
+        if(TextureCompressor::load(cache_path.string(), out_texture) && out_texture.format == format)
+        {
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+            std::lock_guard<std::mutex> lock(this->log_mutex);
+            std::cout << "Texture cache hit: " << cache_path.string() << " (" << out_texture.width << "x" << out_texture.height << ", "
+                      << out_texture.data.size() / 1024 << " KB, " << ms << " ms)" << std::endl;
+            return true;
+        }
+
+        int width, height;
+        unsigned char* image_data = stbi_load_from_memory(data, (int)size, &width, &height, nullptr, 4);
+        if(image_data == nullptr) return false;
+
+        std::vector<uint8_t> mip_chain = MipGenerator::generate(image_data, width, height, format == TextureCompressor::Format::BC7);
+        stbi_image_free(image_data);
+        out_texture = TextureCompressor::compress(mip_chain.data(), width, height, MipGenerator::get_level_count(width, height), format, this->thread_pool);
+
+        // Written under a per-thread name and renamed so two materials cooking the same image can't interleave their writes
+        std::error_code error;
+        std::filesystem::create_directories(this->texture_cache_directory, error);
+        std::filesystem::path temp_path = cache_path;
+        temp_path += "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+        bool saved = !error && TextureCompressor::save(temp_path.string(), out_texture);
+        if(saved)
+        {
+            std::filesystem::rename(temp_path, cache_path, error);
+            saved = !error;
+        }
+        if(!saved) std::filesystem::remove(temp_path, error);
+
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        std::lock_guard<std::mutex> lock(this->log_mutex);
+        if(!saved)
+        {
+            std::cout << "Failed to write texture cache: " << cache_path.string() << std::endl;
+        }
+        std::cout << "Texture cooked: " << cache_path.string() << " (" << width << "x" << height << ", " << out_texture.data.size() / 1024 << " KB vs "
+                  << mip_chain.size() / 1024 << " KB RGBA8, " << ms << " ms)" << std::endl;
+        return true;
+    }
+
+    void AssetManager::set_vertex_packing(bool enabled)
+    {
+        this->pack_vertices = enabled;
+    }
+
+    void AssetManager::set_mesh_optimization(bool enabled)
+    {
+        this->optimize_meshes = enabled;
+    }
+
+    void AssetManager::set_meshlet_building(bool enabled)
+    {
+        this->build_meshlets = enabled;
+    }
+
+    void AssetManager::set_mip_precompute(bool enabled)
+    {
+        this->precompute_mips = enabled;
+    }
+
+    void AssetManager::set_texture_compression(bool enabled)
+    {
+        this->compress_textures = enabled;
+    }
+
+    void AssetManager::set_model_caching(bool enabled)
+    {
+        this->cache_models = enabled;
+    }
+
+    void AssetManager::set_native_gltf(bool enabled)
+    {
+        this->use_native_gltf = enabled;
+    }
+
+    void AssetManager::print_vertex_memory_report() const
+    {
+        VertexMemoryReport vertex_memory;
+        {
+            std::lock_guard<std::mutex> lock(this->stats_mutex);
+            vertex_memory = this->vertex_memory;
+        }
+
+        const double mb = 1024.0 * 1024.0;
+        std::lock_guard<std::mutex> lock(this->log_mutex);
+        std::cout << "Vertex memory: " << vertex_memory.vertex_count << " vertices, "
+                  << vertex_memory.standard_bytes / mb << " MB standard (" << sizeof(Render::Vertex) << " B/vertex) vs "
+                  << vertex_memory.packed_bytes / mb << " MB packed (" << sizeof(Render::PackedVertex) << " B/vertex)"
+                  << (this->pack_vertices ? ", using packed" : ", using standard") << std::endl;
+    }
+
+    void AssetManager::print_load_timings(const std::string& path, const AssetLoadTimings& timings) const
+    {
+        std::lock_guard<std::mutex> lock(this->log_mutex);
+        std::cout << "Loaded " << path << (timings.from_cache ? " from cache" : "") << " in " << timings.total_ms << " ms: " << (timings.from_cache ? "map " : "parse ") << timings.parse_ms << " ms, materials " << timings.materials_ms
+                  << " ms (" << timings.texture_count << " textures, decode " << timings.decode_ms << " ms over " << this->thread_pool.get_thread_count()
+                  << " threads, waited " << timings.decode_wait_ms << " ms, upload " << timings.texture_upload_ms << " ms), meshes " << timings.meshes_ms << " ms" << std::endl;
+    }
+
+    AssetLoadTimings AssetManager::get_load_timings() const
+    {
+        std::lock_guard<std::mutex> lock(this->stats_mutex);
+        return this->load_timings;
+    }
+
+    // Both sides end with the same std::vectors the mesh pipeline takes, so the difference is purely parsing and copying.
+    // Vertex counts are printed too since JoinIdenticalVertices can change what the importer hands back
+    void AssetManager::benchmark_import(const std::string& path, uint32_t iterations)
+    {
+        double importer_ms = 0.0, native_ms = 0.0;
+        uint64_t importer_vertices = 0, native_vertices = 0;
+        std::vector<Render::Vertex> vertices;
+        std::vector<unsigned int> indices;
+        Assimp::Importer importer;
+
+        for(uint32_t iteration = 0; iteration < iterations; iteration++)
+        {
+            importer_vertices = 0;
+            native_vertices = 0;
+
+            auto start = std::chrono::high_resolution_clock::now();
+            const aiScene* scene = importer.ReadFile(path, MODEL_IMPORT_FLAGS);
+            if(scene == nullptr)
+            {
+                std::cout << "Benchmark: failed to import " << path << std::endl;
+                return;
+            }
+            for(uint32_t mesh_index = 0; mesh_index < scene->mNumMeshes; mesh_index++)
+            {
+                vertices.clear();
+                indices.clear();
+                load_vertices(scene->mMeshes[mesh_index], vertices);
+                load_indices(scene->mMeshes[mesh_index], indices);
+                importer_vertices += vertices.size();
+            }
+            importer.FreeScene();
+
+            auto middle = std::chrono::high_resolution_clock::now();
+            Gltf::Document document;
+            if(!document.open(path)) return;
+            for(const Gltf::Mesh& mesh : document.meshes)
+            {
+                for(const Gltf::Primitive& primitive : mesh.primitives)
+                {
+                    document.read_vertices(primitive, vertices);
+                    document.read_indices(primitive, indices);
+                    native_vertices += vertices.size();
+                }
+            }
+            auto end = std::chrono::high_resolution_clock::now();
+
+            importer_ms += std::chrono::duration<double, std::milli>(middle - start).count();
+            native_ms += std::chrono::duration<double, std::milli>(end - middle).count();
         }
 
-        return material_offsets;
+        if(iterations == 0) return;
+        importer_ms /= iterations;
+        native_ms /= iterations;
+        std::cout << "Import benchmark " << path << " (" << iterations << " runs): Assimp " << importer_ms << " ms (" << importer_vertices << " vertices), native "
+                  << native_ms << " ms (" << native_vertices << " vertices), " << importer_ms / std::max(native_ms, 0.001) << "x" << std::endl;
     }
 
     glm::mat4 AssetManager::mat4x4_assimp_to_glm(const aiMatrix4x4& mat)
@@ -1,5 +1,7 @@
 #pragma once
 #include <string>
+#include <mutex>
+#include <unordered_map>
 #include <assimp/Importer.hpp>      // C++ importer interface
 #include <assimp/scene.h>           // Output data structure
 #include <assimp/postprocess.h>     // Post processing flags
@@ -8,20 +10,149 @@
 #include "twilight_types.h"
 #include "render/Renderer.h"
 #include "Scene.h"
+#include "TextureCompressor.h"
+#include "ThreadPool.h"
+#include "ModelCache.h"
+#include "Gltf.h"
+#include <future>
+#include <chrono>
 
 namespace Twilight
 {
+    // Breakdown of a load_model call. decode_ms is summed over the worker threads, decode_wait_ms is how long uploading
+    // sat waiting on them, so decode_ms well above decode_wait_ms means the decodes overlapped
+    struct AssetLoadTimings
+    {
+        double parse_ms;
+        double materials_ms;
+        double decode_ms;
+        double decode_wait_ms;
+        double texture_upload_ms;
+        double meshes_ms;
+        double total_ms;
+        uint32_t texture_count;
+        bool from_cache;            // parse_ms is mapping and validating the model cache when set
+    };
+
+    // Result of AssetManager::load_model_async. Copies refer to the same load
+    class ModelHandle
+    {
+        private:
+            std::shared_future<std::shared_ptr<SceneNode>> result;
+
+        public:
+            ModelHandle();
+            explicit ModelHandle(std::shared_future<std::shared_ptr<SceneNode>> result);
+
+            // False for a default constructed handle
+            bool is_valid() const;
+            // Never blocks. True once the load has finished, whether or not it succeeded
+            bool is_ready() const;
+            // nullptr while the load is still running and after a failed one
+            std::shared_ptr<SceneNode> get() const;
+            // Blocks until the load has finished
+            std::shared_ptr<SceneNode> wait() const;
+    };
 
     class AssetManager
     {
         private:
-            Assimp::Importer importer;
             Render::Renderer* renderer = nullptr;
 
-            std::shared_ptr<SceneNode> load_node(aiNode* node, const aiScene* scene, const std::vector<uint32_t>& material_offsets, const glm::mat4& parent_transform, std::shared_ptr<SceneNode> parent);
+            // Meshes are uploaded as Render::PackedVertex (16 bytes) instead of Render::Vertex (32 bytes) when set
+            bool pack_vertices = false;
+
+            // Runs the MeshOptimizer passes on every imported mesh and prints ACMR/ATVR before and after
+            bool optimize_meshes = true;
+
+            // Splits every imported mesh into meshlets for the renderer's cluster culling path
+            bool build_meshlets = true;
+
+            // Builds texture mip chains here instead of leaving it to the renderer's blits
+            bool precompute_mips = false;
+
+            // Embedded textures are cooked to BC7 (base color), BC5 (normal) or BC1 (everything else) with all their mips
+            // and cached in texture_cache_directory, keyed by a hash of the source image. Takes precedence over precompute_mips
+            bool compress_textures = true;
+            std::string texture_cache_directory = "texture_cache";
+
+            // Imported models are cooked into model_cache_directory (GPU ready geometry, node hierarchy and the cooked texture
+            // of each material) keyed by a hash of the source file and the import settings. Later loads map the cache and skip
+            // Assimp entirely. Needs compress_textures
+            bool cache_models = true;
+            std::string model_cache_directory = "model_cache";
+
+            // .glb files are read by Gltf::Document straight out of a mapping instead of going through Assimp. Files it can't
+            // handle (external buffers, sparse accessors, required extensions...) still fall back to Assimp
+            bool use_native_gltf = true;
+
+            // Vertex memory of everything loaded so far, in both formats, so the saving can be reported
+            struct VertexMemoryReport
+            {
+                uint64_t vertex_count;
+                uint64_t standard_bytes;
+                uint64_t packed_bytes;
+            };
+            VertexMemoryReport vertex_memory = {};
+
+            // Texture decoding and block compression run here. Anything a job prints goes through log_mutex
+            ThreadPool thread_pool;
+            mutable std::mutex log_mutex;
+
+            // load_model_async runs whole loads here. Kept apart from thread_pool since a load blocks on its decode jobs
+            ThreadPool load_pool;
+            // Guards vertex_memory and load_timings, which concurrent loads both update
+            mutable std::mutex stats_mutex;
+            AssetLoadTimings load_timings = {};
+
+            // Models loaded through acquire_model, by path. An entry stays resident after its last release and is only unloaded
+            // once update_residency needs the memory back
+            struct ResidentModel
+            {
+                ModelHandle handle;
+                uint32_t ref_count;
+                // The model's own nodes, filled in by the load before its handle becomes ready. Anything attached under them
+                // later belongs to another model and isn't unloaded with this one
+                std::shared_ptr<std::vector<std::shared_ptr<SceneNode>>> nodes;
+            };
+            std::unordered_map<std::string, ResidentModel> resident_models;
+            // Device local bytes to stay under, 0 for 90% of the driver's budget
+            uint64_t memory_budget = 0;
+            // Evicted images are only freed once the frames in flight are done with them, usage isn't judged again before that
+            uint64_t next_eviction_frame = 0;
+
+            // Output of a decode job. binding.data points into pixels, nullptr if the texture couldn't be decoded
+            struct DecodedTexture
+            {
+                Render::MaterialTextureBinding binding;
+                std::vector<uint8_t> pixels;
+                std::string cache_name;     // Texture cache entry, empty if the texture wasn't cooked
+                double decode_ms;
+            };
+
+            uint64_t get_model_cache_key(const MappedFile& source) const;
+            bool cached_textures_exist(const ModelCache::View& view) const;
+            std::shared_ptr<SceneNode> load_cached_model(const ModelCache::View& view, std::chrono::high_resolution_clock::time_point start, AssetLoadTimings& timings);
+            std::shared_ptr<SceneNode> load_node(aiNode* node, const aiScene* scene, const std::vector<uint32_t>& material_ids, const std::vector<uint32_t>& cache_materials,
+                                                 const glm::mat4& parent_transform, std::shared_ptr<SceneNode> parent, ModelCache::Writer* cache_writer, int32_t parent_index);
+            std::shared_ptr<SceneNode> load_gltf(const Gltf::Document& document, ModelCache::Writer* cache_writer, std::chrono::high_resolution_clock::time_point start, AssetLoadTimings& timings);
+            std::shared_ptr<SceneNode> load_gltf_node(const Gltf::Document& document, uint32_t node_index, const std::vector<uint32_t>& material_ids, const std::vector<uint32_t>& cache_materials,
+                                                      std::shared_ptr<SceneNode> parent, ModelCache::Writer* cache_writer, int32_t parent_index);
+            Render::Mesh upload_mesh(const std::string& name, std::vector<Render::Vertex>& vertices, std::vector<unsigned int>& indices, uint32_t material_id,
+                                     ModelCache::Writer* cache_writer, uint32_t cache_node, uint32_t cache_material);
             void load_vertices(const aiMesh* mesh, std::vector<Render::Vertex>& vertices);
+            void quantize_vertices(const std::vector<Render::Vertex>& vertices, std::vector<Render::PackedVertex>& packed_vertices, Render::VertexQuantization& quantization);
+            void optimize_mesh(const char* name, std::vector<Render::Vertex>& vertices, std::vector<unsigned int>& indices);
+            std::vector<Render::Meshlet> build_mesh_meshlets(const std::vector<Render::Vertex>& vertices, const std::vector<unsigned int>& indices);
             void load_indices(const aiMesh* mesh, std::vector<unsigned int>& indices);
-            std::vector<uint32_t> load_materials(const aiScene* scene);
+            std::vector<uint32_t> load_materials(const aiScene* scene, ModelCache::Writer* cache_writer, std::vector<uint32_t>& cache_materials, AssetLoadTimings& timings);
+            std::vector<uint32_t> upload_textures(std::vector<std::future<DecodedTexture>>& decodes, ModelCache::Writer* cache_writer, AssetLoadTimings& timings);
+            DecodedTexture decode_texture(const uint8_t* data, uint64_t size, Render::MaterialTextureType type);
+            DecodedTexture load_cooked_texture(const std::string& path, Render::MaterialTextureType type);
+            void set_compressed_binding(DecodedTexture& decoded, TextureCompressor::CompressedTexture& compressed, Render::MaterialTextureType type);
+            bool cook_texture(const uint8_t* data, uint64_t size, Render::MaterialTextureType type, TextureCompressor::CompressedTexture& out_texture, std::string& out_cache_name);
+            void print_load_timings(const std::string& path, const AssetLoadTimings& timings) const;
+            void unload_model(ResidentModel& model);
             glm::mat4 mat4x4_assimp_to_glm(const aiMatrix4x4& mat);
 
         public:
@@ -29,6 +160,35 @@ namespace Twilight
             ~AssetManager();
             void init(Render::Renderer* renderer);
             std::shared_ptr<SceneNode> load_model(const std::string& path);
+            // Runs load_model on a background thread, parsing, decoding and uploading included. Several loads can be in flight
+            // at once. Settings must not be changed while any are
+            ModelHandle load_model_async(const std::string& path);
+
+            // Refcounted loads shared by path. The first acquire starts a load_model_async, later ones get the same handle whether
+            // it's still loading or not. Every acquire needs a matching release_model. Call these, update_residency and
+            // unload_all_models from the thread that presents
+            ModelHandle acquire_model(const std::string& path);
+            void release_model(const std::string& path);
+            // While device memory is over budget, unloads the least recently drawn model nobody holds. Call once per frame
+            void update_residency();
+            void set_memory_budget(uint64_t bytes);
+            // Waits for loads in flight then unloads every registry model, held or not. For shutdown, after Renderer::wait
+            void unload_all_models();
+
+            void set_vertex_packing(bool enabled);
+            void set_mesh_optimization(bool enabled);
+            void set_meshlet_building(bool enabled);
+            void set_mip_precompute(bool enabled);
+            void set_texture_compression(bool enabled);
+            void set_model_caching(bool enabled);
+            void set_native_gltf(bool enabled);
+            void print_vertex_memory_report() const;
+            // Timings of the last load_model call to finish
+            AssetLoadTimings get_load_timings() const;
+
+            // Times getting every mesh's vertices and indices out of path through Assimp and through Gltf::Document, averaged
+            // over iterations. CPU only, nothing is uploaded
+            void benchmark_import(const std::string& path, uint32_t iterations);
     };
 
 }
\ No newline at end of file
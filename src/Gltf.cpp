@@ -0,0 +1,339 @@
+#include "Gltf.h"
+#include "Json.h"
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+
+#define GLB_MAGIC 0x46546C67u           // "glTF"
+#define GLB_CHUNK_JSON 0x4E4F534Au
+#define GLB_CHUNK_BIN 0x004E4942u
+
+#define GLTF_UNSIGNED_BYTE 5121
+#define GLTF_UNSIGNED_SHORT 5123
+#define GLTF_UNSIGNED_INT 5125
+#define GLTF_FLOAT 5126
+#define GLTF_TRIANGLES 4
+
+namespace Twilight
+{
+    namespace Gltf
+    {
+        struct BufferView
+        {
+            const uint8_t* data;
+            uint64_t length;
+            uint32_t stride;
+        };
+
+        static uint32_t get_component_size(uint32_t component_type)
+        {
+            switch(component_type)
+            {
+                case 5120: case GLTF_UNSIGNED_BYTE: return 1;
+                case 5122: case GLTF_UNSIGNED_SHORT: return 2;
+                case GLTF_UNSIGNED_INT: case GLTF_FLOAT: return 4;
+                default: return 0;
+            }
+        }
+
+        static uint32_t get_component_count(const std::string& type)
+        {
+            if(type == "SCALAR") return 1;
+            if(type == "VEC2") return 2;
+            if(type == "VEC3") return 3;
+            if(type == "VEC4") return 4;
+            if(type == "MAT2") return 4;
+            if(type == "MAT3") return 9;
+            if(type == "MAT4") return 16;
+            return 0;
+        }
+
+        static bool fail(const std::string& path, const char* reason)
+        {
+            std::cout << "GLB loader can't handle " << path << ": " << reason << std::endl;
+            return false;
+        }
+
+        static glm::mat4 read_node_transform(const Json::Value& node)
+        {
+            const Json::Value& matrix = node["matrix"];
+            if(matrix.size() == 16)
+            {
+                // Column major, same as glm
+                glm::mat4 transform;
+                for(int i = 0; i < 16; i++) transform[i / 4][i % 4] = (float)matrix[i].get_number();
+                return transform;
+            }
+
+            const Json::Value& translation = node["translation"];
+            const Json::Value& rotation = node["rotation"];
+            const Json::Value& scale = node["scale"];
+            glm::vec3 t = glm::vec3(translation[0].get_number(0.0), translation[1].get_number(0.0), translation[2].get_number(0.0));
+            glm::quat r = glm::quat((float)rotation[3].get_number(1.0), (float)rotation[0].get_number(0.0), (float)rotation[1].get_number(0.0), (float)rotation[2].get_number(0.0));
+            glm::vec3 s = glm::vec3(scale[0].get_number(1.0), scale[1].get_number(1.0), scale[2].get_number(1.0));
+            return glm::translate(glm::mat4(1.0f), t) * glm::mat4_cast(r) * glm::scale(glm::mat4(1.0f), s);
+        }
+
+        template<typename T>
+        static T read_element(const Accessor& accessor, uint32_t index, uint32_t component)
+        {
+            T value;
+            memcpy(&value, accessor.data + (uint64_t)index * accessor.stride + component * sizeof(T), sizeof(T));
+            return value;
+        }
+
+        static uint32_t read_index(const Accessor& accessor, uint32_t index)
+        {
+            switch(accessor.component_type)
+            {
+                case GLTF_UNSIGNED_BYTE: return accessor.data[(uint64_t)index * accessor.stride];
+                case GLTF_UNSIGNED_SHORT: return read_element<uint16_t>(accessor, index, 0);
+                default: return read_element<uint32_t>(accessor, index, 0);
+            }
+        }
+
+        bool Document::open(const std::string& path)
+        {
+            if(!this->file.open(path)) return fail(path, "file couldn't be mapped");
+
+            const uint8_t* base = this->file.get_data();
+            uint64_t size = this->file.get_size();
+            uint32_t header[5];
+            if(size < sizeof(header)) return fail(path, "too small");
+            memcpy(header, base, sizeof(header));
+            if(header[0] != GLB_MAGIC || header[1] != 2 || header[2] > size) return fail(path, "not a glTF 2.0 binary");
+            size = header[2];
+
+            // JSON chunk then an optional BIN chunk
+            uint64_t json_length = header[3];
+            if(header[4] != GLB_CHUNK_JSON || 20 + json_length > size) return fail(path, "missing JSON chunk");
+            const char* json_text = (const char*)base + 20;
+
+            const uint8_t* bin = nullptr;
+            uint64_t bin_length = 0;
+            uint64_t bin_header = 20 + ((json_length + 3) & ~3ull);
+            if(bin_header + 8 <= size)
+            {
+                uint32_t chunk[2];
+                memcpy(chunk, base + bin_header, sizeof(chunk));
+                if(chunk[1] == GLB_CHUNK_BIN && bin_header + 8 + chunk[0] <= size)
+                {
+                    bin = base + bin_header + 8;
+                    bin_length = chunk[0];
+                }
+            }
+
+            Json::Value json;
+            std::string error;
+            if(!Json::parse(json_text, json_length, json, &error)) return fail(path, error.c_str());
+            if(json["extensionsRequired"].size() > 0) return fail(path, "required extensions");
+
+            const Json::Value& buffers = json["buffers"];
+            std::vector<BufferView> views(json["bufferViews"].size());
+            for(size_t i = 0; i < views.size(); i++)
+            {
+                const Json::Value& view = json["bufferViews"][i];
+                int64_t buffer = view["buffer"].get_int(-1);
+                int64_t offset = view["byteOffset"].get_int(0);
+                int64_t length = view["byteLength"].get_int(-1);
+                // Only the GLB's own binary chunk (buffer 0 without a uri)
+                if(buffer != 0 || buffers[0].has("uri") || bin == nullptr) return fail(path, "external buffers");
+                if(offset < 0 || length < 0 || (uint64_t)offset + (uint64_t)length > bin_length) return fail(path, "buffer view out of range");
+
+                views[i] = { bin + offset, (uint64_t)length, (uint32_t)view["byteStride"].get_int(0) };
+            }
+
+            const Json::Value& accessors = json["accessors"];
+            this->accessors.resize(accessors.size());
+            for(size_t i = 0; i < accessors.size(); i++)
+            {
+                const Json::Value& accessor = accessors[i];
+                int64_t view_index = accessor["bufferView"].get_int(-1);
+                if(accessor.has("sparse") || view_index < 0 || (size_t)view_index >= views.size()) return fail(path, "sparse or view-less accessors");
+
+                const BufferView& view = views[view_index];
+                uint32_t component_type = (uint32_t)accessor["componentType"].get_int(0);
+                uint32_t component_count = get_component_count(accessor["type"].get_string());
+                uint32_t element_size = get_component_size(component_type) * component_count;
+                int64_t offset = accessor["byteOffset"].get_int(0);
+                int64_t count = accessor["count"].get_int(-1);
+                if(element_size == 0 || offset < 0 || count < 0 || count > UINT32_MAX) return fail(path, "invalid accessor");
+
+                uint32_t stride = view.stride != 0 ? view.stride : element_size;
+                if(count > 0 && (uint64_t)offset + (uint64_t)(count - 1) * stride + element_size > view.length) return fail(path, "accessor out of range");
+
+                this->accessors[i] = { view.data + offset, (uint32_t)count, stride, component_type, component_count, accessor["normalized"].get_bool() };
+            }
+
+            // Attribute formats the vertex reader handles. Anything else goes to the importer instead
+            auto check_accessor = [this](int32_t index, uint32_t components, bool allow_normalized) -> bool
+            {
+                if(index < 0) return true;
+                if((size_t)index >= this->accessors.size()) return false;
+                const Accessor& accessor = this->accessors[index];
+                if(accessor.component_count != components) return false;
+                if(accessor.component_type == GLTF_FLOAT) return true;
+                return allow_normalized && accessor.normalized && (accessor.component_type == GLTF_UNSIGNED_BYTE || accessor.component_type == GLTF_UNSIGNED_SHORT);
+            };
+
+            const Json::Value& meshes = json["meshes"];
+            this->meshes.resize(meshes.size());
+            for(size_t i = 0; i < meshes.size(); i++)
+            {
+                this->meshes[i].name = meshes[i]["name"].get_string();
+                const Json::Value& primitives = meshes[i]["primitives"];
+                for(size_t p = 0; p < primitives.size(); p++)
+                {
+                    const Json::Value& primitive = primitives[p];
+                    if(primitive["mode"].get_int(GLTF_TRIANGLES) != GLTF_TRIANGLES) continue;
+
+                    const Json::Value& attributes = primitive["attributes"];
+                    Primitive out = {
+                        .position = (int32_t)attributes["POSITION"].get_int(-1),
+                        .normal = (int32_t)attributes["NORMAL"].get_int(-1),
+                        .texcoord = (int32_t)attributes["TEXCOORD_0"].get_int(-1),
+                        .indices = (int32_t)primitive["indices"].get_int(-1),
+                        .material = (int32_t)primitive["material"].get_int(-1)
+                    };
+                    if(out.position < 0 || !check_accessor(out.position, 3, false) || !check_accessor(out.normal, 3, false) || !check_accessor(out.texcoord, 2, true))
+                    {
+                        return fail(path, "unsupported vertex attribute format");
+                    }
+
+                    uint32_t vertex_count = this->accessors[out.position].count;
+                    if((out.normal >= 0 && this->accessors[out.normal].count != vertex_count) || (out.texcoord >= 0 && this->accessors[out.texcoord].count != vertex_count))
+                    {
+                        return fail(path, "attribute counts differ");
+                    }
+
+                    // Indices are checked here so reading them later can't go out of the vertex range
+                    if(out.indices >= 0)
+                    {
+                        if((size_t)out.indices >= this->accessors.size()) return fail(path, "invalid index accessor");
+                        const Accessor& indices = this->accessors[out.indices];
+                        if(indices.component_count != 1 || (indices.component_type != GLTF_UNSIGNED_BYTE && indices.component_type != GLTF_UNSIGNED_SHORT &&
+                                                            indices.component_type != GLTF_UNSIGNED_INT))
+                        {
+                            return fail(path, "invalid index accessor");
+                        }
+                        for(uint32_t index = 0; index < indices.count; index++)
+                        {
+                            if(read_index(indices, index) >= vertex_count) return fail(path, "index out of range");
+                        }
+                    }
+
+                    this->meshes[i].primitives.push_back(out);
+                }
+            }
+
+            const Json::Value& nodes = json["nodes"];
+            this->nodes.resize(nodes.size());
+            std::vector<uint32_t> parent_count(nodes.size(), 0);
+            for(size_t i = 0; i < nodes.size(); i++)
+            {
+                const Json::Value& node = nodes[i];
+                this->nodes[i].local_transform = read_node_transform(node);
+                this->nodes[i].mesh = (int32_t)node["mesh"].get_int(-1);
+                if(this->nodes[i].mesh >= (int32_t)this->meshes.size()) return fail(path, "invalid node mesh");
+
+                const Json::Value& children = node["children"];
+                for(size_t c = 0; c < children.size(); c++)
+                {
+                    int64_t child = children[c].get_int(-1);
+                    // A node with two parents (or a cycle) would be walked forever or twice
+                    if(child < 0 || (size_t)child >= nodes.size() || ++parent_count[child] > 1) return fail(path, "invalid node hierarchy");
+                    this->nodes[i].children.push_back((uint32_t)child);
+                }
+            }
+
+            const Json::Value& scene = json["scenes"][(size_t)json["scene"].get_int(0)];
+            if(scene.is_null())
+            {
+                for(uint32_t i = 0; i < this->nodes.size(); i++)
+                {
+                    if(parent_count[i] == 0) this->scene_roots.push_back(i);
+                }
+            }
+            for(size_t i = 0; i < scene["nodes"].size(); i++)
+            {
+                int64_t root = scene["nodes"][i].get_int(-1);
+                if(root < 0 || (size_t)root >= this->nodes.size() || parent_count[root] != 0) return fail(path, "invalid scene root");
+                this->scene_roots.push_back((uint32_t)root);
+            }
+
+            // Only images stored in the binary chunk, the same ones the importer path finds as embedded textures
+            const Json::Value& materials = json["materials"];
+            this->materials.resize(materials.size());
+            for(size_t i = 0; i < materials.size(); i++)
+            {
+                this->materials[i] = { nullptr, 0 };
+                int64_t texture = materials[i]["pbrMetallicRoughness"]["baseColorTexture"]["index"].get_int(-1);
+                int64_t image = json["textures"][(size_t)std::max<int64_t>(texture, 0)]["source"].get_int(-1);
+                int64_t view = json["images"][(size_t)std::max<int64_t>(image, 0)]["bufferView"].get_int(-1);
+                if(texture >= 0 && image >= 0 && view >= 0 && (size_t)view < views.size())
+                {
+                    this->materials[i] = { views[view].data, views[view].length };
+                }
+            }
+
+            return true;
+        }
+
+        void Document::read_vertices(const Primitive& primitive, std::vector<Render::Vertex>& out_vertices) const
+        {
+            const Accessor& positions = this->accessors[primitive.position];
+            out_vertices.resize(positions.count);
+            for(uint32_t i = 0; i < positions.count; i++)
+            {
+                Render::Vertex& vertex = out_vertices[i];
+                vertex = {};
+                vertex.pos = glm::vec3(read_element<float>(positions, i, 0), read_element<float>(positions, i, 1), read_element<float>(positions, i, 2));
+            }
+
+            if(primitive.normal >= 0)
+            {
+                const Accessor& normals = this->accessors[primitive.normal];
+                for(uint32_t i = 0; i < normals.count; i++)
+                {
+                    out_vertices[i].norm = glm::vec3(read_element<float>(normals, i, 0), read_element<float>(normals, i, 1), read_element<float>(normals, i, 2));
+                }
+            }
+
+            if(primitive.texcoord >= 0)
+            {
+                const Accessor& texcoords = this->accessors[primitive.texcoord];
+                for(uint32_t i = 0; i < texcoords.count; i++)
+                {
+                    glm::vec2 tex;
+                    switch(texcoords.component_type)
+                    {
+                        case GLTF_UNSIGNED_BYTE: tex = glm::vec2(read_element<uint8_t>(texcoords, i, 0), read_element<uint8_t>(texcoords, i, 1)) / 255.0f; break;
+                        case GLTF_UNSIGNED_SHORT: tex = glm::vec2(read_element<uint16_t>(texcoords, i, 0), read_element<uint16_t>(texcoords, i, 1)) / 65535.0f; break;
+                        default: tex = glm::vec2(read_element<float>(texcoords, i, 0), read_element<float>(texcoords, i, 1)); break;
+                    }
+                    // The importer flips v for glTF and the textures are flipped on decode to match
+                    out_vertices[i].tex = glm::vec2(tex.x, 1.0f - tex.y);
+                }
+            }
+        }
+
+        void Document::read_indices(const Primitive& primitive, std::vector<unsigned int>& out_indices) const
+        {
+            if(primitive.indices < 0)
+            {
+                out_indices.resize(this->accessors[primitive.position].count);
+                for(uint32_t i = 0; i < out_indices.size(); i++) out_indices[i] = i;
+                return;
+            }
+
+            const Accessor& indices = this->accessors[primitive.indices];
+            out_indices.resize(indices.count);
+            for(uint32_t i = 0; i < indices.count; i++)
+            {
+                out_indices[i] = read_index(indices, i);
+            }
+        }
+    }
+}
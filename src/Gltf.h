@@ -0,0 +1,76 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "twilight_types.h"
+#include "MappedFile.h"
+
+namespace Twilight
+{
+    // Reads binary glTF (.glb) straight out of a mapped file. Only what the renderer uses is kept: triangle primitives with
+    // POSITION/NORMAL/TEXCOORD_0, base color textures embedded in the binary chunk and the node hierarchy.
+    // Vertex and image data are never copied by open, accessors point into the mapping
+    namespace Gltf
+    {
+        struct Accessor
+        {
+            const uint8_t* data;        // First element, inside the binary chunk
+            uint32_t count;
+            uint32_t stride;
+            uint32_t component_type;    // GL enum, 5121 = ubyte, 5123 = ushort, 5125 = uint, 5126 = float
+            uint32_t component_count;
+            bool normalized;
+        };
+
+        struct Primitive
+        {
+            int32_t position;           // Accessor indices, -1 if the attribute isn't there
+            int32_t normal;
+            int32_t texcoord;
+            int32_t indices;
+            int32_t material;
+        };
+
+        struct Mesh
+        {
+            std::string name;
+            std::vector<Primitive> primitives;
+        };
+
+        struct Node
+        {
+            glm::mat4 local_transform;
+            int32_t mesh;
+            std::vector<uint32_t> children;
+        };
+
+        // Encoded (PNG/JPEG) bytes of the material's base color image, nullptr without one
+        struct Material
+        {
+            const uint8_t* base_color_data;
+            uint64_t base_color_size;
+        };
+
+        class Document
+        {
+            private:
+                MappedFile file;
+
+            public:
+                std::vector<Accessor> accessors;
+                std::vector<Mesh> meshes;
+                std::vector<Node> nodes;
+                std::vector<Material> materials;
+                std::vector<uint32_t> scene_roots;
+
+                // Parses and validates everything up front. False (with the reason printed) if the file isn't a .glb this reader
+                // can handle, e.g. external buffers, sparse accessors or required extensions
+                bool open(const std::string& path);
+
+                // Interleaves the primitive's attributes into out_vertices. Texture coordinates are flipped to match the importer
+                void read_vertices(const Primitive& primitive, std::vector<Render::Vertex>& out_vertices) const;
+                // Widens the indices to 32 bits, or generates them for non indexed primitives
+                void read_indices(const Primitive& primitive, std::vector<unsigned int>& out_indices) const;
+        };
+    }
+}
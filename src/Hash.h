@@ -0,0 +1,19 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+namespace Twilight
+{
+    // FNV-1a, enough to tell cached assets apart and catch a truncated or corrupted file. Pass a previous hash as the seed to extend it
+    inline uint64_t hash_bytes(const void* data, size_t size, uint64_t seed = 14695981039346656037ull)
+    {
+        const uint8_t* bytes = (const uint8_t*)data;
+        uint64_t hash = seed;
+        for(size_t i = 0; i < size; i++)
+        {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+}
@@ -0,0 +1,357 @@
+#include "Json.h"
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+
+#define JSON_MAX_DEPTH 128
+
+namespace Twilight
+{
+    namespace Json
+    {
+        static const Value NULL_JSON_VALUE;
+
+        Value::Value()
+        :type(Type::NULL_VALUE), boolean(false), number(0.0)
+        {
+
+        }
+
+        Type Value::get_type() const
+        {
+            return this->type;
+        }
+
+        bool Value::is_null() const
+        {
+            return this->type == Type::NULL_VALUE;
+        }
+
+        bool Value::is_number() const
+        {
+            return this->type == Type::NUMBER;
+        }
+
+        bool Value::is_string() const
+        {
+            return this->type == Type::STRING;
+        }
+
+        bool Value::is_array() const
+        {
+            return this->type == Type::ARRAY;
+        }
+
+        bool Value::is_object() const
+        {
+            return this->type == Type::OBJECT;
+        }
+
+        size_t Value::size() const
+        {
+            if(this->type == Type::ARRAY) return this->array.size();
+            if(this->type == Type::OBJECT) return this->object.size();
+            return 0;
+        }
+
+        const Value& Value::operator[](size_t index) const
+        {
+            if(this->type != Type::ARRAY || index >= this->array.size()) return NULL_JSON_VALUE;
+            return this->array[index];
+        }
+
+        const Value& Value::operator[](std::string_view key) const
+        {
+            if(this->type != Type::OBJECT) return NULL_JSON_VALUE;
+            for(const std::pair<std::string, Value>& member : this->object)
+            {
+                if(member.first == key) return member.second;
+            }
+            return NULL_JSON_VALUE;
+        }
+
+        bool Value::has(std::string_view key) const
+        {
+            return !(*this)[key].is_null();
+        }
+
+        bool Value::get_bool(bool fallback) const
+        {
+            return this->type == Type::BOOL ? this->boolean : fallback;
+        }
+
+        double Value::get_number(double fallback) const
+        {
+            return this->type == Type::NUMBER ? this->number : fallback;
+        }
+
+        int64_t Value::get_int(int64_t fallback) const
+        {
+            if(this->type != Type::NUMBER || this->number != std::floor(this->number) || std::fabs(this->number) > 9007199254740992.0) return fallback;
+            return (int64_t)this->number;
+        }
+
+        const std::string& Value::get_string() const
+        {
+            return this->type == Type::STRING ? this->string : NULL_JSON_VALUE.string;
+        }
+
+        // Recursive descent over the whole text. Stops at the first error
+        class Parser
+        {
+            private:
+                const char* current;
+                const char* end;
+                const char* error;
+                uint32_t depth;
+
+                bool fail(const char* message)
+                {
+                    if(this->error == nullptr) this->error = message;
+                    return false;
+                }
+
+                void skip_whitespace()
+                {
+                    while(this->current < this->end && (*this->current == ' ' || *this->current == '\t' || *this->current == '\n' || *this->current == '\r'))
+                    {
+                        this->current++;
+                    }
+                }
+
+                bool match(const char* literal)
+                {
+                    size_t length = strlen(literal);
+                    if((size_t)(this->end - this->current) < length || memcmp(this->current, literal, length) != 0) return false;
+                    this->current += length;
+                    return true;
+                }
+
+                static void append_utf8(std::string& out, uint32_t codepoint)
+                {
+                    if(codepoint < 0x80)
+                    {
+                        out += (char)codepoint;
+                    }
+                    else if(codepoint < 0x800)
+                    {
+                        out += (char)(0xC0 | (codepoint >> 6));
+                        out += (char)(0x80 | (codepoint & 0x3F));
+                    }
+                    else if(codepoint < 0x10000)
+                    {
+                        out += (char)(0xE0 | (codepoint >> 12));
+                        out += (char)(0x80 | ((codepoint >> 6) & 0x3F));
+                        out += (char)(0x80 | (codepoint & 0x3F));
+                    }
+                    else
+                    {
+                        out += (char)(0xF0 | (codepoint >> 18));
+                        out += (char)(0x80 | ((codepoint >> 12) & 0x3F));
+                        out += (char)(0x80 | ((codepoint >> 6) & 0x3F));
+                        out += (char)(0x80 | (codepoint & 0x3F));
+                    }
+                }
+
+                bool parse_hex4(uint32_t& out)
+                {
+                    if(this->end - this->current < 4) return fail("Truncated \\u escape");
+                    out = 0;
+                    for(int i = 0; i < 4; i++)
+                    {
+                        char c = *this->current++;
+                        out <<= 4;
+                        if(c >= '0' && c <= '9') out |= c - '0';
+                        else if(c >= 'a' && c <= 'f') out |= c - 'a' + 10;
+                        else if(c >= 'A' && c <= 'F') out |= c - 'A' + 10;
+                        else return fail("Invalid \\u escape");
+                    }
+                    return true;
+                }
+
+                bool parse_string(std::string& out)
+                {
+                    this->current++;        // Opening quote
+                    while(this->current < this->end)
+                    {
+                        char c = *this->current++;
+                        if(c == '"') return true;
+                        if((unsigned char)c < 0x20) return fail("Control character in string");
+                        if(c != '\\')
+                        {
+                            out += c;
+                            continue;
+                        }
+
+                        if(this->current >= this->end) break;
+                        char escape = *this->current++;
+                        switch(escape)
+                        {
+                            case '"': out += '"'; break;
+                            case '\\': out += '\\'; break;
+                            case '/': out += '/'; break;
+                            case 'b': out += '\b'; break;
+                            case 'f': out += '\f'; break;
+                            case 'n': out += '\n'; break;
+                            case 'r': out += '\r'; break;
+                            case 't': out += '\t'; break;
+                            case 'u':
+                            {
+                                uint32_t codepoint;
+                                if(!parse_hex4(codepoint)) return false;
+                                // Surrogate pairs come as two escapes
+                                if(codepoint >= 0xD800 && codepoint < 0xDC00)
+                                {
+                                    uint32_t low;
+                                    if(!match("\\u") || !parse_hex4(low) || low < 0xDC00 || low >= 0xE000) return fail("Invalid surrogate pair");
+                                    codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+                                }
+                                append_utf8(out, codepoint);
+                                break;
+                            }
+                            default:
+                                return fail("Invalid escape");
+                        }
+                    }
+                    return fail("Unterminated string");
+                }
+
+                bool parse_number(double& out)
+                {
+                    const char* start = this->current;
+                    if(this->current < this->end && *this->current == '-') this->current++;
+                    if(this->current >= this->end || *this->current < '0' || *this->current > '9') return fail("Invalid number");
+                    while(this->current < this->end && ((*this->current >= '0' && *this->current <= '9') || *this->current == '.' || *this->current == 'e' ||
+                                                        *this->current == 'E' || *this->current == '+' || *this->current == '-'))
+                    {
+                        this->current++;
+                    }
+
+                    // strtod needs a terminated string and numbers are short
+                    char buffer[64];
+                    size_t length = this->current - start;
+                    if(length >= sizeof(buffer)) return fail("Number too long");
+                    memcpy(buffer, start, length);
+                    buffer[length] = '\0';
+
+                    char* parsed_end;
+                    out = strtod(buffer, &parsed_end);
+                    if(parsed_end != buffer + length) return fail("Invalid number");
+                    return true;
+                }
+
+                bool parse_value(Value& out)
+                {
+                    skip_whitespace();
+                    if(this->current >= this->end) return fail("Unexpected end of input");
+                    if(++this->depth > JSON_MAX_DEPTH) return fail("Nested too deeply");
+
+                    bool result = false;
+                    char c = *this->current;
+                    if(c == '{')
+                    {
+                        out.type = Type::OBJECT;
+                        this->current++;
+                        skip_whitespace();
+                        if(this->current < this->end && *this->current == '}')
+                        {
+                            this->current++;
+                            result = true;
+                        }
+                        while(!result)
+                        {
+                            skip_whitespace();
+                            if(this->current >= this->end || *this->current != '"') return fail("Expected object key");
+
+                            out.object.emplace_back();
+                            if(!parse_string(out.object.back().first)) return false;
+                            skip_whitespace();
+                            if(!match(":")) return fail("Expected ':'");
+                            if(!parse_value(out.object.back().second)) return false;
+
+                            skip_whitespace();
+                            if(match("}")) result = true;
+                            else if(!match(",")) return fail("Expected ',' or '}'");
+                        }
+                    }
+                    else if(c == '[')
+                    {
+                        out.type = Type::ARRAY;
+                        this->current++;
+                        skip_whitespace();
+                        if(this->current < this->end && *this->current == ']')
+                        {
+                            this->current++;
+                            result = true;
+                        }
+                        while(!result)
+                        {
+                            out.array.emplace_back();
+                            if(!parse_value(out.array.back())) return false;
+
+                            skip_whitespace();
+                            if(match("]")) result = true;
+                            else if(!match(",")) return fail("Expected ',' or ']'");
+                        }
+                    }
+                    else if(c == '"')
+                    {
+                        out.type = Type::STRING;
+                        result = parse_string(out.string);
+                    }
+                    else if(match("true"))
+                    {
+                        out.type = Type::BOOL;
+                        out.boolean = true;
+                        result = true;
+                    }
+                    else if(match("false"))
+                    {
+                        out.type = Type::BOOL;
+                        result = true;
+                    }
+                    else if(match("null"))
+                    {
+                        result = true;
+                    }
+                    else
+                    {
+                        out.type = Type::NUMBER;
+                        result = parse_number(out.number);
+                    }
+
+                    this->depth--;
+                    return result;
+                }
+
+            public:
+                Parser(const char* text, size_t length)
+                :current(text), end(text + length), error(nullptr), depth(0)
+                {
+
+                }
+
+                bool parse(Value& out, std::string* out_error)
+                {
+                    bool result = parse_value(out);
+                    if(result)
+                    {
+                        skip_whitespace();
+                        // GLB pads the JSON chunk with spaces, but a stray NUL from other writers is tolerated too
+                        while(this->current < this->end && *this->current == '\0') this->current++;
+                        if(this->current != this->end) result = fail("Trailing characters");
+                    }
+
+                    if(!result && out_error != nullptr) *out_error = this->error;
+                    return result;
+                }
+        };
+
+        bool parse(const char* text, size_t length, Value& out_value, std::string* out_error)
+        {
+            out_value = Value();
+            Parser parser(text, length);
+            return parser.parse(out_value, out_error);
+        }
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <cstdint>
+
+namespace Twilight
+{
+    // Small DOM style JSON reader, enough for glTF. Lookups on missing keys or indices return a null value so
+    // chains like doc["a"]["b"][0] never need checking along the way
+    namespace Json
+    {
+        enum class Type : uint8_t
+        {
+            NULL_VALUE,
+            BOOL,
+            NUMBER,
+            STRING,
+            ARRAY,
+            OBJECT
+        };
+
+        class Value
+        {
+            private:
+                Type type;
+                bool boolean;
+                double number;
+                std::string string;
+                std::vector<Value> array;
+                std::vector<std::pair<std::string, Value>> object;     // In file order, lookups are linear
+
+                friend class Parser;
+
+            public:
+                Value();
+
+                Type get_type() const;
+                bool is_null() const;
+                bool is_number() const;
+                bool is_string() const;
+                bool is_array() const;
+                bool is_object() const;
+
+                // Elements of an array or members of an object, 0 for anything else
+                size_t size() const;
+                const Value& operator[](size_t index) const;
+                // string_view rather than const char* so value[0] isn't ambiguous
+                const Value& operator[](std::string_view key) const;
+                bool has(std::string_view key) const;
+
+                // Return fallback if the value isn't of that type
+                bool get_bool(bool fallback = false) const;
+                double get_number(double fallback = 0.0) const;
+                int64_t get_int(int64_t fallback = 0) const;
+                const std::string& get_string() const;
+        };
+
+        // False with out_error set if text isn't a single valid JSON value
+        bool parse(const char* text, size_t length, Value& out_value, std::string* out_error = nullptr);
+    }
+}
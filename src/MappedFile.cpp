@@ -0,0 +1,116 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Twilight
+{
+#ifdef _WIN32
+    MappedFile::MappedFile()
+    :data(nullptr), size(0), file(INVALID_HANDLE_VALUE), mapping(nullptr)
+    {
+
+    }
+#else
+    MappedFile::MappedFile()
+    :data(nullptr), size(0), file(-1)
+    {
+
+    }
+#endif
+
+    MappedFile::~MappedFile()
+    {
+        close();
+    }
+
+    bool MappedFile::open(const std::string& path)
+    {
+        close();
+
+#ifdef _WIN32
+        this->file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if(this->file == INVALID_HANDLE_VALUE) return false;
+
+        LARGE_INTEGER file_size;
+        if(!GetFileSizeEx(this->file, &file_size) || file_size.QuadPart == 0)
+        {
+            close();
+            return false;
+        }
+
+        this->mapping = CreateFileMappingA(this->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if(this->mapping == nullptr)
+        {
+            close();
+            return false;
+        }
+
+        this->data = (const uint8_t*)MapViewOfFile(this->mapping, FILE_MAP_READ, 0, 0, 0);
+        if(this->data == nullptr)
+        {
+            close();
+            return false;
+        }
+        this->size = (uint64_t)file_size.QuadPart;
+#else
+        this->file = ::open(path.c_str(), O_RDONLY);
+        if(this->file < 0) return false;
+
+        struct stat file_stat;
+        if(fstat(this->file, &file_stat) != 0 || file_stat.st_size == 0)
+        {
+            close();
+            return false;
+        }
+
+        void* mapped = mmap(nullptr, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, this->file, 0);
+        if(mapped == MAP_FAILED)
+        {
+            close();
+            return false;
+        }
+
+        // Everything mapped is read front to back once, let the kernel read ahead
+        madvise(mapped, (size_t)file_stat.st_size, MADV_SEQUENTIAL);
+        this->data = (const uint8_t*)mapped;
+        this->size = (uint64_t)file_stat.st_size;
+#endif
+        return true;
+    }
+
+    void MappedFile::close()
+    {
+#ifdef _WIN32
+        if(this->data != nullptr) UnmapViewOfFile(this->data);
+        if(this->mapping != nullptr) CloseHandle(this->mapping);
+        if(this->file != INVALID_HANDLE_VALUE) CloseHandle(this->file);
+        this->mapping = nullptr;
+        this->file = INVALID_HANDLE_VALUE;
+#else
+        if(this->data != nullptr) munmap((void*)this->data, (size_t)this->size);
+        if(this->file >= 0) ::close(this->file);
+        this->file = -1;
+#endif
+        this->data = nullptr;
+        this->size = 0;
+    }
+
+    const uint8_t* MappedFile::get_data() const
+    {
+        return this->data;
+    }
+
+    uint64_t MappedFile::get_size() const
+    {
+        return this->size;
+    }
+}
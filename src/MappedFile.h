@@ -0,0 +1,34 @@
+#pragma once
+#include <string>
+#include <cstdint>
+
+namespace Twilight
+{
+    // Read only view of a whole file through the OS's page cache. Pages are faulted in as they're touched so nothing
+    // is copied until the data is actually used
+    class MappedFile
+    {
+        private:
+            const uint8_t* data;
+            uint64_t size;
+#ifdef _WIN32
+            void* file;
+            void* mapping;
+#else
+            int file;
+#endif
+
+        public:
+            MappedFile();
+            ~MappedFile();
+            MappedFile(const MappedFile&) = delete;
+            MappedFile& operator=(const MappedFile&) = delete;
+
+            // False if the file doesn't exist, is empty or couldn't be mapped
+            bool open(const std::string& path);
+            void close();
+
+            const uint8_t* get_data() const;
+            uint64_t get_size() const;
+    };
+}
@@ -0,0 +1,506 @@
+#include "MeshOptimizer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cfloat>
+
+#define FORSYTH_CACHE_SIZE 32
+#define OVERDRAW_CACHE_SIZE 16
+
+namespace Twilight
+{
+    namespace MeshOptimizer
+    {
+        // Forsyth's scoring. Vertices just used score a flat 0.75 so the next triangle doesn't just reuse the same edge,
+        // older cache entries fall off with the 1.5 power. Vertices with few triangles left get a boost so they get finished off
+        static float vertex_score(int32_t cache_position, uint32_t remaining_triangles)
+        {
+            if(remaining_triangles == 0) return -1.0f;
+
+            float score = 0.0f;
+            if(cache_position >= 0)
+            {
+                if(cache_position < 3)
+                {
+                    score = 0.75f;
+                }
+                else
+                {
+                    float scaled = 1.0f - (float)(cache_position - 3) / (float)(FORSYTH_CACHE_SIZE - 3);
+                    score = std::pow(scaled, 1.5f);
+                }
+            }
+
+            score += 2.0f / std::sqrt((float)remaining_triangles);
+            return score;
+        }
+
+        VertexCacheStats analyze_vertex_cache(const std::vector<unsigned int>& indices, size_t vertex_count, uint32_t cache_size)
+        {
+            // FIFO cache via timestamps, a vertex is in the cache if it was added in the last cache_size misses
+            std::vector<uint32_t> timestamps(vertex_count, 0);
+            uint32_t time = cache_size + 1;
+            uint32_t misses = 0;
+            size_t used_vertices = 0;
+            std::vector<bool> used(vertex_count, false);
+
+            for(unsigned int index : indices)
+            {
+                if(time - timestamps[index] > cache_size)
+                {
+                    timestamps[index] = time++;
+                    misses++;
+                }
+                if(!used[index])
+                {
+                    used[index] = true;
+                    used_vertices++;
+                }
+            }
+
+            size_t triangle_count = indices.size() / 3;
+            return {
+                .acmr = triangle_count > 0 ? (float)misses / (float)triangle_count : 0.0f,
+                .atvr = used_vertices > 0 ? (float)misses / (float)used_vertices : 0.0f
+            };
+        }
+
+        void optimize_vertex_cache(std::vector<unsigned int>& indices, size_t vertex_count)
+        {
+            size_t triangle_count = indices.size() / 3;
+            if(triangle_count == 0) return;
+
+            // Triangle adjacency per vertex in one array. The first remaining[v] entries of a vertex's range are the triangles not emitted yet
+            std::vector<uint32_t> adjacency_offsets(vertex_count + 1, 0);
+            for(unsigned int index : indices)
+            {
+                adjacency_offsets[index + 1]++;
+            }
+            for(size_t vertex = 0; vertex < vertex_count; vertex++)
+            {
+                adjacency_offsets[vertex + 1] += adjacency_offsets[vertex];
+            }
+
+            std::vector<uint32_t> adjacency(indices.size());
+            std::vector<uint32_t> remaining(vertex_count, 0);
+            for(size_t triangle = 0; triangle < triangle_count; triangle++)
+            {
+                for(uint32_t corner = 0; corner < 3; corner++)
+                {
+                    unsigned int vertex = indices[triangle * 3 + corner];
+                    adjacency[adjacency_offsets[vertex] + remaining[vertex]++] = static_cast<uint32_t>(triangle);
+                }
+            }
+
+            std::vector<int32_t> cache_position(vertex_count, -1);
+            std::vector<float> vertex_scores(vertex_count);
+            for(size_t vertex = 0; vertex < vertex_count; vertex++)
+            {
+                vertex_scores[vertex] = vertex_score(-1, remaining[vertex]);
+            }
+
+            std::vector<float> triangle_scores(triangle_count);
+            std::vector<bool> emitted(triangle_count, false);
+            int64_t best_triangle = 0;
+            for(size_t triangle = 0; triangle < triangle_count; triangle++)
+            {
+                const unsigned int* tri = &indices[triangle * 3];
+                triangle_scores[triangle] = vertex_scores[tri[0]] + vertex_scores[tri[1]] + vertex_scores[tri[2]];
+                if(triangle_scores[triangle] > triangle_scores[best_triangle]) best_triangle = triangle;
+            }
+
+            std::vector<unsigned int> output;
+            output.reserve(indices.size());
+
+            uint32_t cache[FORSYTH_CACHE_SIZE + 3];
+            uint32_t cache_count = 0;
+            size_t dead_end_cursor = 0;
+
+            while(output.size() < indices.size())
+            {
+                // Nothing in the cache has triangles left, carry on from the next triangle in the original order
+                if(best_triangle < 0)
+                {
+                    while(emitted[dead_end_cursor]) dead_end_cursor++;
+                    best_triangle = dead_end_cursor;
+                }
+
+                const unsigned int* tri = &indices[best_triangle * 3];
+                emitted[best_triangle] = true;
+
+                uint32_t new_cache[FORSYTH_CACHE_SIZE + 3];
+                uint32_t new_cache_count = 0;
+                for(uint32_t corner = 0; corner < 3; corner++)
+                {
+                    unsigned int vertex = tri[corner];
+                    output.push_back(vertex);
+                    new_cache[new_cache_count++] = vertex;
+
+                    // Swap remove the triangle from the vertex's live range
+                    uint32_t* live = &adjacency[adjacency_offsets[vertex]];
+                    for(uint32_t i = 0; i < remaining[vertex]; i++)
+                    {
+                        if(live[i] == best_triangle)
+                        {
+                            live[i] = live[remaining[vertex] - 1];
+                            remaining[vertex]--;
+                            break;
+                        }
+                    }
+                }
+
+                // Emitted vertices go to the front, everything else keeps its order behind them
+                for(uint32_t i = 0; i < cache_count; i++)
+                {
+                    uint32_t vertex = cache[i];
+                    if(vertex != tri[0] && vertex != tri[1] && vertex != tri[2])
+                    {
+                        new_cache[new_cache_count++] = vertex;
+                    }
+                }
+
+                // Update scores of everything that moved or fell out of the cache
+                for(uint32_t i = 0; i < new_cache_count; i++)
+                {
+                    uint32_t vertex = new_cache[i];
+                    int32_t position = i < FORSYTH_CACHE_SIZE ? static_cast<int32_t>(i) : -1;
+                    cache_position[vertex] = position;
+
+                    float score = vertex_score(position, remaining[vertex]);
+                    float delta = score - vertex_scores[vertex];
+                    vertex_scores[vertex] = score;
+
+                    const uint32_t* live = &adjacency[adjacency_offsets[vertex]];
+                    for(uint32_t j = 0; j < remaining[vertex]; j++)
+                    {
+                        triangle_scores[live[j]] += delta;
+                    }
+                }
+
+                cache_count = std::min<uint32_t>(new_cache_count, FORSYTH_CACHE_SIZE);
+                memcpy(cache, new_cache, cache_count * sizeof(uint32_t));
+
+                // Best next triangle is one that touches the cache
+                best_triangle = -1;
+                float best_score = -1.0f;
+                for(uint32_t i = 0; i < cache_count; i++)
+                {
+                    uint32_t vertex = cache[i];
+                    const uint32_t* live = &adjacency[adjacency_offsets[vertex]];
+                    for(uint32_t j = 0; j < remaining[vertex]; j++)
+                    {
+                        if(triangle_scores[live[j]] > best_score)
+                        {
+                            best_score = triangle_scores[live[j]];
+                            best_triangle = live[j];
+                        }
+                    }
+                }
+            }
+
+            indices.swap(output);
+        }
+
+        void optimize_overdraw(std::vector<unsigned int>& indices, const float* positions, size_t vertex_count, size_t position_stride, float threshold)
+        {
+            size_t triangle_count = indices.size() / 3;
+            if(triangle_count == 0) return;
+
+            // Hard boundaries are triangles where every vertex misses the cache, cutting there costs nothing.
+            // Each cluster's misses are summed on the way for its ACMR
+            std::vector<uint32_t> timestamps(vertex_count, 0);
+            uint32_t time = OVERDRAW_CACHE_SIZE + 1;
+            std::vector<size_t> hard_clusters;
+            std::vector<uint32_t> hard_cluster_misses;
+            for(size_t triangle = 0; triangle < triangle_count; triangle++)
+            {
+                uint32_t misses = 0;
+                for(uint32_t corner = 0; corner < 3; corner++)
+                {
+                    unsigned int vertex = indices[triangle * 3 + corner];
+                    if(time - timestamps[vertex] > OVERDRAW_CACHE_SIZE)
+                    {
+                        timestamps[vertex] = time++;
+                        misses++;
+                    }
+                }
+                if(triangle == 0 || misses == 3)
+                {
+                    hard_clusters.push_back(triangle);
+                    hard_cluster_misses.push_back(0);
+                }
+                hard_cluster_misses.back() += misses;
+            }
+            hard_clusters.push_back(triangle_count);
+
+            // Soft boundaries. Within a hard cluster, cut as soon as the piece since the last cut is within threshold of the cluster's ACMR
+            std::vector<size_t> clusters;
+            for(size_t cluster = 0; cluster + 1 < hard_clusters.size(); cluster++)
+            {
+                size_t start = hard_clusters[cluster];
+                size_t end = hard_clusters[cluster + 1];
+
+                float cluster_acmr = (float)hard_cluster_misses[cluster] / (float)(end - start);
+
+                clusters.push_back(start);
+                time += OVERDRAW_CACHE_SIZE + 1;       // Fresh cache
+                uint32_t piece_misses = 0;
+                size_t piece_start = start;
+                for(size_t triangle = start; triangle < end; triangle++)
+                {
+                    for(uint32_t corner = 0; corner < 3; corner++)
+                    {
+                        unsigned int vertex = indices[triangle * 3 + corner];
+                        if(time - timestamps[vertex] > OVERDRAW_CACHE_SIZE)
+                        {
+                            timestamps[vertex] = time++;
+                            piece_misses++;
+                        }
+                    }
+
+                    float piece_acmr = (float)piece_misses / (float)(triangle - piece_start + 1);
+                    if(triangle + 1 < end && piece_acmr <= cluster_acmr * threshold)
+                    {
+                        clusters.push_back(triangle + 1);
+                        piece_start = triangle + 1;
+                        piece_misses = 0;
+                        time += OVERDRAW_CACHE_SIZE + 1;
+                    }
+                }
+            }
+            clusters.push_back(triangle_count);
+
+            // Area weighted centroid and normal per cluster
+            auto position = [&](unsigned int vertex) -> const float* {
+                return (const float*)((const char*)positions + vertex * position_stride);
+            };
+
+            size_t cluster_count = clusters.size() - 1;
+            std::vector<float> centroids(cluster_count * 3, 0.0f);
+            std::vector<float> normals(cluster_count * 3, 0.0f);
+            float mesh_centroid[3] = {0.0f, 0.0f, 0.0f};
+            float mesh_area = 0.0f;
+            for(size_t cluster = 0; cluster < cluster_count; cluster++)
+            {
+                float cluster_area = 0.0f;
+                float* centroid = &centroids[cluster * 3];
+                float* normal = &normals[cluster * 3];
+                for(size_t triangle = clusters[cluster]; triangle < clusters[cluster + 1]; triangle++)
+                {
+                    const float* a = position(indices[triangle * 3 + 0]);
+                    const float* b = position(indices[triangle * 3 + 1]);
+                    const float* c = position(indices[triangle * 3 + 2]);
+
+                    float e0[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+                    float e1[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+                    float n[3] = {e0[1] * e1[2] - e0[2] * e1[1], e0[2] * e1[0] - e0[0] * e1[2], e0[0] * e1[1] - e0[1] * e1[0]};
+                    float area = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+                    for(uint32_t axis = 0; axis < 3; axis++)
+                    {
+                        centroid[axis] += (a[axis] + b[axis] + c[axis]) / 3.0f * area;
+                        normal[axis] += n[axis];
+                    }
+                    cluster_area += area;
+                }
+
+                for(uint32_t axis = 0; axis < 3; axis++)
+                {
+                    mesh_centroid[axis] += centroid[axis];
+                    centroid[axis] = cluster_area > 0.0f ? centroid[axis] / cluster_area : 0.0f;
+                }
+                mesh_area += cluster_area;
+            }
+            for(uint32_t axis = 0; axis < 3; axis++)
+            {
+                mesh_centroid[axis] = mesh_area > 0.0f ? mesh_centroid[axis] / mesh_area : 0.0f;
+            }
+
+            // Clusters facing away from the middle of the mesh are likely to be in front of the rest so they go first
+            std::vector<float> sort_keys(cluster_count);
+            std::vector<uint32_t> order(cluster_count);
+            for(size_t cluster = 0; cluster < cluster_count; cluster++)
+            {
+                const float* centroid = &centroids[cluster * 3];
+                const float* normal = &normals[cluster * 3];
+                float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+                float dot = (centroid[0] - mesh_centroid[0]) * normal[0] + (centroid[1] - mesh_centroid[1]) * normal[1] + (centroid[2] - mesh_centroid[2]) * normal[2];
+                sort_keys[cluster] = length > 0.0f ? dot / length : 0.0f;
+                order[cluster] = static_cast<uint32_t>(cluster);
+            }
+            std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return sort_keys[a] > sort_keys[b]; });
+
+            std::vector<unsigned int> output;
+            output.reserve(indices.size());
+            for(uint32_t cluster : order)
+            {
+                output.insert(output.end(), indices.begin() + clusters[cluster] * 3, indices.begin() + clusters[cluster + 1] * 3);
+            }
+            indices.swap(output);
+        }
+
+        // Bounding sphere around the AABB center and a normal cone (same construction as meshoptimizer's meshopt_computeClusterBounds)
+        static void compute_meshlet_bounds(Meshlet& meshlet, const std::vector<unsigned int>& indices, const float* positions, size_t position_stride)
+        {
+            auto position = [&](unsigned int vertex) -> const float* {
+                return (const float*)((const char*)positions + vertex * position_stride);
+            };
+
+            float min[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+            float max[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+            for(uint32_t i = meshlet.first_index; i < meshlet.first_index + meshlet.index_count; i++)
+            {
+                const float* p = position(indices[i]);
+                for(uint32_t axis = 0; axis < 3; axis++)
+                {
+                    min[axis] = std::min(min[axis], p[axis]);
+                    max[axis] = std::max(max[axis], p[axis]);
+                }
+            }
+
+            float radius = 0.0f;
+            for(uint32_t axis = 0; axis < 3; axis++)
+            {
+                meshlet.center[axis] = (min[axis] + max[axis]) * 0.5f;
+            }
+            for(uint32_t i = meshlet.first_index; i < meshlet.first_index + meshlet.index_count; i++)
+            {
+                const float* p = position(indices[i]);
+                float d[3] = {p[0] - meshlet.center[0], p[1] - meshlet.center[1], p[2] - meshlet.center[2]};
+                radius = std::max(radius, std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]));
+            }
+            meshlet.radius = radius;
+
+            // Cone axis is the average triangle normal, the cutoff comes from the normal furthest from it
+            uint32_t triangle_count = meshlet.index_count / 3;
+            std::vector<float> normals(triangle_count * 3, 0.0f);
+            float axis[3] = {0.0f, 0.0f, 0.0f};
+            for(uint32_t triangle = 0; triangle < triangle_count; triangle++)
+            {
+                const float* a = position(indices[meshlet.first_index + triangle * 3 + 0]);
+                const float* b = position(indices[meshlet.first_index + triangle * 3 + 1]);
+                const float* c = position(indices[meshlet.first_index + triangle * 3 + 2]);
+
+                float e0[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+                float e1[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+                float* n = &normals[triangle * 3];
+                n[0] = e0[1] * e1[2] - e0[2] * e1[1];
+                n[1] = e0[2] * e1[0] - e0[0] * e1[2];
+                n[2] = e0[0] * e1[1] - e0[1] * e1[0];
+
+                float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+                if(length > 0.0f)
+                {
+                    n[0] /= length;
+                    n[1] /= length;
+                    n[2] /= length;
+                }
+                axis[0] += n[0];
+                axis[1] += n[1];
+                axis[2] += n[2];
+            }
+
+            float axis_length = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+            if(axis_length > 0.0f)
+            {
+                axis[0] /= axis_length;
+                axis[1] /= axis_length;
+                axis[2] /= axis_length;
+            }
+
+            float min_dot = 1.0f;
+            for(uint32_t triangle = 0; triangle < triangle_count; triangle++)
+            {
+                const float* n = &normals[triangle * 3];
+                min_dot = std::min(min_dot, n[0] * axis[0] + n[1] * axis[1] + n[2] * axis[2]);
+            }
+
+            memcpy(meshlet.cone_axis, axis, sizeof(axis));
+            memcpy(meshlet.cone_apex, meshlet.center, sizeof(meshlet.center));
+            meshlet.cone_cutoff = 1.0f;
+
+            // Normals spread over more than ~90 degrees, the cone can't reject anything
+            if(min_dot <= 0.1f) return;
+
+            // Apex is pushed back along the axis until every triangle's plane is in front of it
+            float max_t = 0.0f;
+            for(uint32_t triangle = 0; triangle < triangle_count; triangle++)
+            {
+                const float* n = &normals[triangle * 3];
+                const float* a = position(indices[meshlet.first_index + triangle * 3]);
+                float dc = (meshlet.center[0] - a[0]) * n[0] + (meshlet.center[1] - a[1]) * n[1] + (meshlet.center[2] - a[2]) * n[2];
+                float dn = axis[0] * n[0] + axis[1] * n[1] + axis[2] * n[2];
+                max_t = std::max(max_t, dc / dn);
+            }
+
+            for(uint32_t i = 0; i < 3; i++)
+            {
+                meshlet.cone_apex[i] = meshlet.center[i] - axis[i] * max_t;
+            }
+            meshlet.cone_cutoff = std::sqrt(1.0f - min_dot * min_dot);
+        }
+
+        std::vector<Meshlet> build_meshlets(const std::vector<unsigned int>& indices, const float* positions, size_t vertex_count, size_t position_stride, 
+                                            uint32_t max_vertices, uint32_t max_triangles)
+        {
+            std::vector<Meshlet> meshlets;
+            size_t triangle_count = indices.size() / 3;
+            if(triangle_count == 0) return meshlets;
+
+            // Vertices tagged with the current meshlet's number are already counted
+            std::vector<uint32_t> tags(vertex_count, UINT32_MAX);
+            Meshlet meshlet = {};
+            uint32_t meshlet_id = 0;
+
+            for(size_t triangle = 0; triangle < triangle_count; triangle++)
+            {
+                const unsigned int* tri = &indices[triangle * 3];
+                uint32_t new_vertices = 0;
+                for(uint32_t corner = 0; corner < 3; corner++)
+                {
+                    bool repeated = (corner > 0 && tri[corner] == tri[0]) || (corner > 1 && tri[corner] == tri[1]);
+                    if(tags[tri[corner]] != meshlet_id && !repeated) new_vertices++;
+                }
+
+                if(meshlet.vertex_count + new_vertices > max_vertices || meshlet.index_count / 3 + 1 > max_triangles)
+                {
+                    compute_meshlet_bounds(meshlet, indices, positions, position_stride);
+                    meshlets.push_back(meshlet);
+
+                    meshlet = {};
+                    meshlet.first_index = static_cast<uint32_t>(triangle * 3);
+                    meshlet_id++;
+                }
+
+                for(uint32_t corner = 0; corner < 3; corner++)
+                {
+                    if(tags[tri[corner]] != meshlet_id)
+                    {
+                        tags[tri[corner]] = meshlet_id;
+                        meshlet.vertex_count++;
+                    }
+                }
+                meshlet.index_count += 3;
+            }
+
+            compute_meshlet_bounds(meshlet, indices, positions, position_stride);
+            meshlets.push_back(meshlet);
+            return meshlets;
+        }
+
+        std::vector<uint32_t> optimize_vertex_fetch(std::vector<unsigned int>& indices, size_t vertex_count)
+        {
+            std::vector<uint32_t> remap(vertex_count, UINT32_MAX);
+            uint32_t next_vertex = 0;
+            for(unsigned int& index : indices)
+            {
+                if(remap[index] == UINT32_MAX)
+                {
+                    remap[index] = next_vertex++;
+                }
+                index = remap[index];
+            }
+            return remap;
+        }
+    }
+}
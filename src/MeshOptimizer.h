@@ -0,0 +1,73 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace Twilight
+{
+    // Index/vertex reordering run on meshes after they are imported. Indices are triangle lists.
+    // Typical order: optimize_vertex_cache -> optimize_overdraw -> optimize_vertex_fetch
+    namespace MeshOptimizer
+    {
+        struct VertexCacheStats
+        {
+            float acmr;     // Average cache miss ratio, vertex shader invocations per triangle (0.5 is ideal, 3 is worst)
+            float atvr;     // Average transformed vertex ratio, vertex shader invocations per vertex (1 is ideal)
+        };
+
+        // A run of triangles from the mesh's index buffer with bounds for culling. Triangles aren't moved,
+        // a meshlet is just indices [first_index, first_index + index_count) of the mesh
+        struct Meshlet
+        {
+            float center[3];
+            float radius;
+            float cone_apex[3];
+            float cone_axis[3];
+            float cone_cutoff;      // Backfacing if dot(normalize(apex - camera), axis) >= cutoff. 1 means the cone is too wide to cull
+            uint32_t first_index;
+            uint32_t index_count;
+            uint32_t vertex_count;
+        };
+
+        // Simulates a FIFO post transform cache of cache_size entries
+        VertexCacheStats analyze_vertex_cache(const std::vector<unsigned int>& indices, size_t vertex_count, uint32_t cache_size = 16);
+
+        // Reorders triangles for post transform cache locality (Forsyth's linear-speed vertex cache optimisation)
+        void optimize_vertex_cache(std::vector<unsigned int>& indices, size_t vertex_count);
+
+        // Splits the cache optimized order into clusters and sorts them so outward facing clusters are drawn first.
+        // Clusters are split wherever doing so costs at most threshold times the cluster's ACMR. positions points at the first
+        // vertex's xyz floats, position_stride is the size of a vertex in bytes
+        void optimize_overdraw(std::vector<unsigned int>& indices, const float* positions, size_t vertex_count, size_t position_stride, float threshold = 1.05f);
+
+        // Greedily splits the index buffer into meshlets of at most max_vertices unique vertices and max_triangles triangles.
+        // Run after the other passes so consecutive triangles are close together
+        std::vector<Meshlet> build_meshlets(const std::vector<unsigned int>& indices, const float* positions, size_t vertex_count, size_t position_stride, 
+                                            uint32_t max_vertices = 64, uint32_t max_triangles = 124);
+
+        // Renumbers vertices in the order the indices first reference them so vertex fetches walk memory forward.
+        // Rewrites the indices and returns the remap table (old index -> new index, UINT32_MAX for unused vertices)
+        std::vector<uint32_t> optimize_vertex_fetch(std::vector<unsigned int>& indices, size_t vertex_count);
+
+        // Applies a remap table from optimize_vertex_fetch to a vertex array. Unused vertices are dropped
+        template<typename T>
+        void remap_vertices(std::vector<T>& vertices, const std::vector<uint32_t>& remap)
+        {
+            size_t new_count = 0;
+            for(uint32_t new_index : remap)
+            {
+                if(new_index != UINT32_MAX) new_count++;
+            }
+
+            std::vector<T> remapped(new_count);
+            for(size_t old_index = 0; old_index < remap.size(); old_index++)
+            {
+                if(remap[old_index] != UINT32_MAX)
+                {
+                    remapped[remap[old_index]] = vertices[old_index];
+                }
+            }
+            vertices.swap(remapped);
+        }
+    }
+}
@@ -0,0 +1,97 @@
+#include "MipGenerator.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace Twilight
+{
+    namespace MipGenerator
+    {
+        static float srgb_to_linear(float c)
+        {
+            return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+
+        static float linear_to_srgb(float c)
+        {
+            return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+        }
+
+        uint32_t get_level_count(uint32_t width, uint32_t height)
+        {
+            uint32_t size = std::max(width, height);
+            uint32_t levels = 1;
+            while(size > 1)
+            {
+                size >>= 1;
+                levels++;
+            }
+            return levels;
+        }
+
+        uint64_t get_level_offset(uint32_t width, uint32_t height, uint32_t level)
+        {
+            return get_chain_size(width, height, level);
+        }
+
+        uint64_t get_chain_size(uint32_t width, uint32_t height, uint32_t level_count)
+        {
+            uint64_t size = 0;
+            for(uint32_t level = 0; level < level_count; level++)
+            {
+                size += (uint64_t)std::max(width >> level, 1u) * std::max(height >> level, 1u) * 4;
+            }
+            return size;
+        }
+
+        std::vector<uint8_t> generate(const uint8_t* rgba, uint32_t width, uint32_t height, bool srgb)
+        {
+            uint32_t level_count = get_level_count(width, height);
+            std::vector<uint8_t> chain(get_chain_size(width, height, level_count));
+            memcpy(chain.data(), rgba, (uint64_t)width * height * 4);
+
+            // 8 bit to linear lookup so the inner loop doesn't call pow
+            float to_linear[256];
+            for(int value = 0; value < 256; value++)
+            {
+                to_linear[value] = srgb ? srgb_to_linear(value / 255.0f) : value / 255.0f;
+            }
+
+            for(uint32_t level = 1; level < level_count; level++)
+            {
+                uint32_t src_width = std::max(width >> (level - 1), 1u), src_height = std::max(height >> (level - 1), 1u);
+                uint32_t dst_width = std::max(width >> level, 1u), dst_height = std::max(height >> level, 1u);
+                const uint8_t* src = chain.data() + get_level_offset(width, height, level - 1);
+                uint8_t* dst = chain.data() + get_level_offset(width, height, level);
+
+                for(uint32_t y = 0; y < dst_height; y++)
+                {
+                    // Clamped so 1 pixel wide/high sources (and odd sizes) repeat their last row/column
+                    uint32_t y0 = std::min(y * 2, src_height - 1), y1 = std::min(y * 2 + 1, src_height - 1);
+                    for(uint32_t x = 0; x < dst_width; x++)
+                    {
+                        uint32_t x0 = std::min(x * 2, src_width - 1), x1 = std::min(x * 2 + 1, src_width - 1);
+                        const uint8_t* texels[4] = {
+                            src + ((uint64_t)y0 * src_width + x0) * 4, src + ((uint64_t)y0 * src_width + x1) * 4,
+                            src + ((uint64_t)y1 * src_width + x0) * 4, src + ((uint64_t)y1 * src_width + x1) * 4
+                        };
+
+                        uint8_t* out = dst + ((uint64_t)y * dst_width + x) * 4;
+                        for(int channel = 0; channel < 3; channel++)
+                        {
+                            float sum = 0.0f;
+                            for(const uint8_t* texel : texels) sum += to_linear[texel[channel]];
+                            float value = srgb ? linear_to_srgb(sum * 0.25f) : sum * 0.25f;
+                            out[channel] = (uint8_t)std::clamp(value * 255.0f + 0.5f, 0.0f, 255.0f);
+                        }
+
+                        uint32_t alpha = texels[0][3] + texels[1][3] + texels[2][3] + texels[3][3];
+                        out[3] = (uint8_t)((alpha + 2) / 4);
+                    }
+                }
+            }
+
+            return chain;
+        }
+    }
+}
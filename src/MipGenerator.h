@@ -0,0 +1,19 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+namespace Twilight
+{
+    // CPU mip chains for RGBA8 images. Used offline by the asset pipeline and by the renderer for formats it can't blit.
+    // A chain is every level back to back, level 0 first, down to 1x1
+    namespace MipGenerator
+    {
+        uint32_t get_level_count(uint32_t width, uint32_t height);
+        // Byte offset of level in a tightly packed RGBA8 chain
+        uint64_t get_level_offset(uint32_t width, uint32_t height, uint32_t level);
+        uint64_t get_chain_size(uint32_t width, uint32_t height, uint32_t level_count);
+
+        // 2x2 box filter per level. Color channels are averaged in linear space when srgb is set, alpha always is linear
+        std::vector<uint8_t> generate(const uint8_t* rgba, uint32_t width, uint32_t height, bool srgb);
+    }
+}
@@ -0,0 +1,182 @@
+#include "ModelCache.h"
+#include <cstring>
+#include <fstream>
+
+#define MODEL_CACHE_MAGIC 0x444D5454u       // "TTMD"
+#define MODEL_CACHE_VERSION 1
+#define MODEL_CACHE_ALIGNMENT 16
+
+namespace Twilight
+{
+    namespace ModelCache
+    {
+        // The file is read back by pointer casts, the layout can't change without bumping the version
+        static_assert(sizeof(Header) == 48, "ModelCache::Header layout changed");
+        static_assert(sizeof(Node) == 80, "ModelCache::Node layout changed");
+        static_assert(sizeof(Mesh) == 88, "ModelCache::Mesh layout changed");
+        static_assert(sizeof(Material) == 64, "ModelCache::Material layout changed");
+
+        static uint64_t get_vertex_stride(Render::VertexFormat format)
+        {
+            return format == Render::VertexFormat::PACKED ? sizeof(Render::PackedVertex) : sizeof(Render::Vertex);
+        }
+
+        static uint64_t get_index_stride(VkIndexType index_type)
+        {
+            return index_type == VK_INDEX_TYPE_UINT16 ? 2 : 4;
+        }
+
+        static bool in_range(uint64_t offset, uint64_t size, uint64_t limit)
+        {
+            return offset <= limit && size <= limit - offset;
+        }
+
+        bool open(const MappedFile& file, uint64_t key, View& out_view)
+        {
+            const uint8_t* base = file.get_data();
+            uint64_t file_size = file.get_size();
+            if(base == nullptr || file_size < sizeof(Header)) return false;
+
+            const Header* header = (const Header*)base;
+            if(header->magic != MODEL_CACHE_MAGIC || header->version != MODEL_CACHE_VERSION || header->key != key || header->node_count == 0) return false;
+
+            uint64_t tables_size = (uint64_t)header->node_count * sizeof(Node) + (uint64_t)header->mesh_count * sizeof(Mesh) + (uint64_t)header->material_count * sizeof(Material);
+            if(sizeof(Header) + tables_size > header->data_offset || header->data_offset % MODEL_CACHE_ALIGNMENT != 0) return false;
+            if(!in_range(header->data_offset, header->data_size, file_size) || header->data_offset + header->data_size != file_size) return false;
+
+            View view = {};
+            view.header = header;
+            view.nodes = (const Node*)(base + sizeof(Header));
+            view.meshes = (const Mesh*)(view.nodes + header->node_count);
+            view.materials = (const Material*)(view.meshes + header->mesh_count);
+            view.data = base + header->data_offset;
+
+            for(uint32_t i = 0; i < header->node_count; i++)
+            {
+                const Node& node = view.nodes[i];
+                if((i == 0) != (node.parent < 0) || node.parent >= (int32_t)i) return false;
+                if(!in_range(node.first_mesh, node.mesh_count, header->mesh_count)) return false;
+            }
+
+            for(uint32_t i = 0; i < header->mesh_count; i++)
+            {
+                const Mesh& mesh = view.meshes[i];
+                if(mesh.vertex_format != Render::VertexFormat::STANDARD && mesh.vertex_format != Render::VertexFormat::PACKED) return false;
+                if(mesh.index_type != VK_INDEX_TYPE_UINT16 && mesh.index_type != VK_INDEX_TYPE_UINT32) return false;
+                if(!in_range(mesh.vertex_offset, mesh.vertex_count * get_vertex_stride(mesh.vertex_format), header->data_size)) return false;
+                if(!in_range(mesh.index_offset, mesh.index_count * get_index_stride(mesh.index_type), header->data_size)) return false;
+                if(!in_range(mesh.meshlet_offset, mesh.meshlet_count * sizeof(Render::Meshlet), header->data_size)) return false;
+            }
+
+            for(uint32_t i = 0; i < header->material_count; i++)
+            {
+                if(memchr(view.materials[i].texture, 0, sizeof(Material::texture)) == nullptr) return false;
+            }
+
+            out_view = view;
+            return true;
+        }
+
+        Writer::Writer()
+        :discarded(false)
+        {
+
+        }
+
+        Writer::~Writer()
+        {
+
+        }
+
+        // Every blob starts aligned so meshlets (vec4s) can be read straight out of the mapping
+        uint64_t Writer::append(const void* bytes, uint64_t size)
+        {
+            uint64_t offset = (this->data.size() + MODEL_CACHE_ALIGNMENT - 1) & ~(uint64_t)(MODEL_CACHE_ALIGNMENT - 1);
+            this->data.resize(offset + size);
+            if(size > 0) memcpy(this->data.data() + offset, bytes, size);
+            return offset;
+        }
+
+        uint32_t Writer::add_node(const glm::mat4& local_transform, int32_t parent)
+        {
+            this->nodes.push_back({local_transform, parent, (uint32_t)this->meshes.size(), 0, 0});
+            return (uint32_t)this->nodes.size() - 1;
+        }
+
+        void Writer::add_mesh(uint32_t node, const Render::Mesh& mesh, const void* vertices, const std::vector<unsigned int>& indices,
+                              const std::vector<Render::Meshlet>& meshlets, uint32_t material)
+        {
+            Mesh cached = {};
+            cached.vertex_format = mesh.vertex_format;
+            cached.index_type = mesh.index_type;
+            cached.quantization = mesh.quantization;
+            cached.bounds = mesh.bounds;
+            cached.material = material;
+
+            // Meshes the renderer didn't create (empty or out of pool space) are kept as empty so the loads match
+            if(mesh.index_count > 0)
+            {
+                cached.vertex_count = mesh.vertex_count;
+                cached.vertex_offset = append(vertices, mesh.vertex_count * get_vertex_stride(mesh.vertex_format));
+
+                cached.index_count = mesh.index_count;
+                if(mesh.index_type == VK_INDEX_TYPE_UINT16)
+                {
+                    std::vector<uint16_t> indices16(indices.begin(), indices.end());
+                    cached.index_offset = append(indices16.data(), indices16.size() * sizeof(uint16_t));
+                }
+                else
+                {
+                    cached.index_offset = append(indices.data(), indices.size() * sizeof(uint32_t));
+                }
+
+                cached.meshlet_count = (uint32_t)meshlets.size();
+                cached.meshlet_offset = append(meshlets.data(), meshlets.size() * sizeof(Render::Meshlet));
+            }
+
+            this->meshes.push_back(cached);
+            this->nodes[node].mesh_count++;
+        }
+
+        bool Writer::add_material(const std::string& texture)
+        {
+            if(texture.empty() || texture.size() >= sizeof(Material::texture))
+            {
+                discard();
+                return false;
+            }
+
+            Material material = {};
+            memcpy(material.texture, texture.c_str(), texture.size());
+            this->materials.push_back(material);
+            return true;
+        }
+
+        void Writer::discard()
+        {
+            this->discarded = true;
+        }
+
+        bool Writer::save(const std::string& path, uint64_t key) const
+        {
+            if(this->discarded || this->nodes.empty()) return false;
+
+            uint64_t tables_size = this->nodes.size() * sizeof(Node) + this->meshes.size() * sizeof(Mesh) + this->materials.size() * sizeof(Material);
+            uint64_t data_offset = (sizeof(Header) + tables_size + MODEL_CACHE_ALIGNMENT - 1) & ~(uint64_t)(MODEL_CACHE_ALIGNMENT - 1);
+            Header header = { MODEL_CACHE_MAGIC, MODEL_CACHE_VERSION, key, (uint32_t)this->nodes.size(), (uint32_t)this->meshes.size(), (uint32_t)this->materials.size(), 0,
+                              data_offset, this->data.size() };
+
+            std::ofstream file(path, std::ios::binary);
+            if(!file.is_open()) return false;
+
+            const char padding[MODEL_CACHE_ALIGNMENT] = {};
+            file.write((const char*)&header, sizeof(header));
+            file.write((const char*)this->nodes.data(), this->nodes.size() * sizeof(Node));
+            file.write((const char*)this->meshes.data(), this->meshes.size() * sizeof(Mesh));
+            file.write((const char*)this->materials.data(), this->materials.size() * sizeof(Material));
+            file.write(padding, data_offset - sizeof(Header) - tables_size);
+            file.write((const char*)this->data.data(), this->data.size());
+            return file.good();
+        }
+    }
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "twilight_types.h"
+#include "MappedFile.h"
+
+namespace Twilight
+{
+    // Cooked form of an imported model, laid out so a mapped file can be handed to the renderer as is:
+    // header, nodes, meshes, materials then one blob with every mesh's vertices, indices and meshlets in their GPU formats
+    namespace ModelCache
+    {
+        struct Header
+        {
+            uint32_t magic;
+            uint32_t version;
+            uint64_t key;               // Source hash mixed with the import settings, a mismatch means the entry is stale
+            uint32_t node_count;
+            uint32_t mesh_count;
+            uint32_t material_count;
+            uint32_t padding;
+            uint64_t data_offset;
+            uint64_t data_size;
+        };
+
+        // Depth first, parents always come before their children. The root is node 0
+        struct Node
+        {
+            glm::mat4 local_transform;
+            int32_t parent;             // -1 for the root
+            uint32_t first_mesh;
+            uint32_t mesh_count;
+            uint32_t padding;
+        };
+
+        // Offsets are into the data blob. Indices are already narrowed to index_type
+        struct Mesh
+        {
+            uint64_t vertex_offset;
+            uint64_t index_offset;
+            uint64_t meshlet_offset;
+            uint32_t vertex_count;
+            uint32_t index_count;
+            uint32_t meshlet_count;
+            uint32_t material;          // Index into the model's material list
+            Render::VertexFormat vertex_format;
+            VkIndexType index_type;
+            Render::VertexQuantization quantization;
+            glm::vec4 bounds;
+        };
+
+        // Textures are referenced by their name in the texture cache rather than stored again
+        struct Material
+        {
+            char texture[64];
+        };
+
+        // Pointers into a mapped cache file, only valid while the file stays open
+        struct View
+        {
+            const Header* header;
+            const Node* nodes;
+            const Mesh* meshes;
+            const Material* materials;
+            const uint8_t* data;
+        };
+
+        // Checks the header, key and every range against the file size. False if the entry can't be used
+        bool open(const MappedFile& file, uint64_t key, View& out_view);
+
+        // Built up while a model goes through the importer. Nodes have to be added depth first with all of a node's
+        // meshes added before any of its children
+        class Writer
+        {
+            private:
+                std::vector<Node> nodes;
+                std::vector<Mesh> meshes;
+                std::vector<Material> materials;
+                std::vector<uint8_t> data;
+                bool discarded;
+
+                uint64_t append(const void* bytes, uint64_t size);
+
+            public:
+                Writer();
+                ~Writer();
+
+                uint32_t add_node(const glm::mat4& local_transform, int32_t parent);
+                // mesh is what the renderer returned for this geometry, its index type and bounds are stored with it
+                void add_mesh(uint32_t node, const Render::Mesh& mesh, const void* vertices, const std::vector<unsigned int>& indices,
+                              const std::vector<Render::Meshlet>& meshlets, uint32_t material);
+                // False (and the model isn't cached) if the texture has no name, i.e. it wasn't cooked
+                bool add_material(const std::string& texture);
+                // Something the cache can't represent was loaded, save will do nothing
+                void discard();
+
+                bool save(const std::string& path, uint64_t key) const;
+        };
+    }
+}
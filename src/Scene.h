@@ -13,6 +13,7 @@ namespace Twilight
         glm::mat4 local_transform;
         glm::mat4 world_matrix;
         std::shared_ptr<SceneNode> parent;  // Problem with parent pointers (iterator invalidation when the vector the parent is stored in gets reallocated)
+        uint64_t last_drawn_frame = 0;      // Renderer frame number of the last draw that reached this node
     };
 
     /*struct Scene
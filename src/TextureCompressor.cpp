@@ -0,0 +1,482 @@
+#include "TextureCompressor.h"
+#include "MipGenerator.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+#define CONTAINER_MAGIC 0x58455454u       // "TTEX"
+#define CONTAINER_VERSION 1
+
+namespace Twilight
+{
+    namespace TextureCompressor
+    {
+        struct ContainerHeader
+        {
+            uint32_t magic;
+            uint32_t version;
+            uint32_t format;
+            uint32_t width, height;
+            uint32_t level_count;
+        };
+
+        // Same entries as a KTX2 level index
+        struct LevelIndex
+        {
+            uint64_t byte_offset;
+            uint64_t byte_length;
+        };
+
+        // Writes bits LSB first, the order BC7 blocks are laid out in
+        struct BitWriter
+        {
+            uint8_t* data;
+            uint32_t position;
+
+            void write(uint32_t value, uint32_t bits)
+            {
+                for(uint32_t bit = 0; bit < bits; bit++, position++)
+                {
+                    if(value & (1u << bit)) data[position >> 3] |= (uint8_t)(1u << (position & 7));
+                }
+            }
+        };
+
+        // Gathers a 4x4 block. Blocks hanging over the edge repeat the last row/column
+        static void load_block(const uint8_t* level, uint32_t width, uint32_t height, uint32_t block_x, uint32_t block_y, uint8_t out[16][4])
+        {
+            for(uint32_t y = 0; y < 4; y++)
+            {
+                uint32_t src_y = std::min(block_y * 4 + y, height - 1);
+                for(uint32_t x = 0; x < 4; x++)
+                {
+                    uint32_t src_x = std::min(block_x * 4 + x, width - 1);
+                    memcpy(out[y * 4 + x], level + ((uint64_t)src_y * width + src_x) * 4, 4);
+                }
+            }
+        }
+
+        // Principal axis of the block's colors by power iteration on the covariance matrix
+        static void principal_axis(const uint8_t block[16][4], uint32_t channels, float mean[4], float axis[4])
+        {
+            for(uint32_t c = 0; c < 4; c++) mean[c] = 0.0f;
+            for(uint32_t i = 0; i < 16; i++)
+            {
+                for(uint32_t c = 0; c < channels; c++) mean[c] += block[i][c] / 16.0f;
+            }
+
+            float covariance[4][4] = {};
+            for(uint32_t i = 0; i < 16; i++)
+            {
+                for(uint32_t a = 0; a < channels; a++)
+                {
+                    for(uint32_t b = 0; b < channels; b++)
+                    {
+                        covariance[a][b] += (block[i][a] - mean[a]) * (block[i][b] - mean[b]);
+                    }
+                }
+            }
+
+            for(uint32_t c = 0; c < 4; c++) axis[c] = c < channels ? 1.0f : 0.0f;
+            for(int iteration = 0; iteration < 8; iteration++)
+            {
+                float next[4] = {};
+                for(uint32_t a = 0; a < channels; a++)
+                {
+                    for(uint32_t b = 0; b < channels; b++) next[a] += covariance[a][b] * axis[b];
+                }
+
+                float length = 0.0f;
+                for(uint32_t c = 0; c < channels; c++) length += next[c] * next[c];
+                if(length < 1e-12f) break;
+
+                length = std::sqrt(length);
+                for(uint32_t c = 0; c < channels; c++) axis[c] = next[c] / length;
+            }
+        }
+
+        // Block extent along the principal axis, the starting endpoints for BC1 and BC7
+        static void axis_endpoints(const uint8_t block[16][4], uint32_t channels, float low[4], float high[4])
+        {
+            float mean[4], axis[4];
+            principal_axis(block, channels, mean, axis);
+
+            float min_t = 0.0f, max_t = 0.0f;
+            for(uint32_t i = 0; i < 16; i++)
+            {
+                float t = 0.0f;
+                for(uint32_t c = 0; c < channels; c++) t += (block[i][c] - mean[c]) * axis[c];
+                min_t = std::min(min_t, t);
+                max_t = std::max(max_t, t);
+            }
+
+            for(uint32_t c = 0; c < 4; c++)
+            {
+                low[c] = c < channels ? std::clamp(mean[c] + axis[c] * min_t, 0.0f, 255.0f) : 255.0f;
+                high[c] = c < channels ? std::clamp(mean[c] + axis[c] * max_t, 0.0f, 255.0f) : 255.0f;
+            }
+        }
+
+        static uint16_t pack_565(const float color[4])
+        {
+            uint32_t r = (uint32_t)std::lround(color[0] * 31.0f / 255.0f);
+            uint32_t g = (uint32_t)std::lround(color[1] * 63.0f / 255.0f);
+            uint32_t b = (uint32_t)std::lround(color[2] * 31.0f / 255.0f);
+            return (uint16_t)((r << 11) | (g << 5) | b);
+        }
+
+        static void unpack_565(uint16_t packed, int out[3])
+        {
+            uint32_t r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+            out[0] = (int)((r << 3) | (r >> 2));
+            out[1] = (int)((g << 2) | (g >> 4));
+            out[2] = (int)((b << 3) | (b >> 2));
+        }
+
+        // Four color mode only (color0 > color1) so black pixels don't turn transparent
+        static void encode_bc1(const uint8_t block[16][4], uint8_t* out)
+        {
+            float low[4], high[4];
+            axis_endpoints(block, 3, low, high);
+
+            uint16_t color0 = pack_565(high), color1 = pack_565(low);
+            if(color0 < color1) std::swap(color0, color1);
+
+            uint32_t indices = 0;
+            if(color0 != color1)
+            {
+                int palette[4][3];
+                unpack_565(color0, palette[0]);
+                unpack_565(color1, palette[1]);
+                for(int c = 0; c < 3; c++)
+                {
+                    palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+                    palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+                }
+
+                for(uint32_t i = 0; i < 16; i++)
+                {
+                    int best_error = INT32_MAX;
+                    uint32_t best = 0;
+                    for(uint32_t entry = 0; entry < 4; entry++)
+                    {
+                        int error = 0;
+                        for(int c = 0; c < 3; c++)
+                        {
+                            int delta = block[i][c] - palette[entry][c];
+                            error += delta * delta;
+                        }
+                        if(error < best_error)
+                        {
+                            best_error = error;
+                            best = entry;
+                        }
+                    }
+                    indices |= best << (i * 2);
+                }
+            }
+
+            memcpy(out, &color0, 2);
+            memcpy(out + 2, &color1, 2);
+            memcpy(out + 4, &indices, 4);
+        }
+
+        // One channel in the 8 value mode (endpoint0 > endpoint1)
+        static void encode_bc4(const uint8_t block[16][4], uint32_t channel, uint8_t* out)
+        {
+            uint8_t low = 255, high = 0;
+            for(uint32_t i = 0; i < 16; i++)
+            {
+                low = std::min(low, block[i][channel]);
+                high = std::max(high, block[i][channel]);
+            }
+
+            uint64_t bits = (uint64_t)high | ((uint64_t)low << 8);
+            if(high != low)
+            {
+                int palette[8] = { high, low };
+                for(int entry = 2; entry < 8; entry++)
+                {
+                    palette[entry] = ((8 - entry) * high + (entry - 1) * low) / 7;
+                }
+
+                for(uint32_t i = 0; i < 16; i++)
+                {
+                    int best_error = INT32_MAX;
+                    uint64_t best = 0;
+                    for(int entry = 0; entry < 8; entry++)
+                    {
+                        int error = std::abs(block[i][channel] - palette[entry]);
+                        if(error < best_error)
+                        {
+                            best_error = error;
+                            best = entry;
+                        }
+                    }
+                    bits |= best << (16 + i * 3);
+                }
+            }
+
+            memcpy(out, &bits, 8);
+        }
+
+        static void encode_bc5(const uint8_t block[16][4], uint8_t* out)
+        {
+            encode_bc4(block, 0, out);
+            encode_bc4(block, 1, out + 8);
+        }
+
+        static const int BC7_WEIGHTS4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+        // Picks the closest of the 16 interpolated colors for every pixel. Returns the total squared error
+        static uint32_t bc7_mode6_indices(const uint8_t block[16][4], const int endpoint0[4], const int endpoint1[4], uint8_t indices[16])
+        {
+            int palette[16][4];
+            for(int entry = 0; entry < 16; entry++)
+            {
+                for(int c = 0; c < 4; c++)
+                {
+                    palette[entry][c] = ((64 - BC7_WEIGHTS4[entry]) * endpoint0[c] + BC7_WEIGHTS4[entry] * endpoint1[c] + 32) >> 6;
+                }
+            }
+
+            uint32_t total_error = 0;
+            for(uint32_t i = 0; i < 16; i++)
+            {
+                uint32_t best_error = UINT32_MAX;
+                for(uint8_t entry = 0; entry < 16; entry++)
+                {
+                    uint32_t error = 0;
+                    for(int c = 0; c < 4; c++)
+                    {
+                        int delta = block[i][c] - palette[entry][c];
+                        error += (uint32_t)(delta * delta);
+                    }
+                    if(error < best_error)
+                    {
+                        best_error = error;
+                        indices[i] = entry;
+                    }
+                }
+                total_error += best_error;
+            }
+            return total_error;
+        }
+
+        // Least squares endpoints for a fixed set of indices. Returns false if every pixel uses the same weight
+        static bool bc7_refine_endpoints(const uint8_t block[16][4], const uint8_t indices[16], float low[4], float high[4])
+        {
+            float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+            float ax[4] = {}, bx[4] = {};
+            for(uint32_t i = 0; i < 16; i++)
+            {
+                float b = BC7_WEIGHTS4[indices[i]] / 64.0f, a = 1.0f - b;
+                aa += a * a;
+                ab += a * b;
+                bb += b * b;
+                for(int c = 0; c < 4; c++)
+                {
+                    ax[c] += a * block[i][c];
+                    bx[c] += b * block[i][c];
+                }
+            }
+
+            float determinant = aa * bb - ab * ab;
+            if(std::fabs(determinant) < 1e-6f) return false;
+
+            for(int c = 0; c < 4; c++)
+            {
+                low[c] = std::clamp((bb * ax[c] - ab * bx[c]) / determinant, 0.0f, 255.0f);
+                high[c] = std::clamp((aa * bx[c] - ab * ax[c]) / determinant, 0.0f, 255.0f);
+            }
+            return true;
+        }
+
+        struct BC7Mode6Block
+        {
+            uint32_t error;
+            int quantized[2][4];
+            int pbits[2];
+            uint8_t indices[16];
+        };
+
+        // Quantizes the endpoints with every p-bit combination and keeps whichever is better than best
+        static void bc7_try_endpoints(const uint8_t block[16][4], const float low[4], const float high[4], BC7Mode6Block& best)
+        {
+            for(int pbit0 = 0; pbit0 < 2; pbit0++)
+            {
+                for(int pbit1 = 0; pbit1 < 2; pbit1++)
+                {
+                    BC7Mode6Block candidate = { 0, {}, { pbit0, pbit1 }, {} };
+                    int endpoint0[4], endpoint1[4];
+                    for(int c = 0; c < 4; c++)
+                    {
+                        candidate.quantized[0][c] = std::clamp((int)std::lround((low[c] - pbit0) / 2.0f), 0, 127);
+                        candidate.quantized[1][c] = std::clamp((int)std::lround((high[c] - pbit1) / 2.0f), 0, 127);
+                        endpoint0[c] = (candidate.quantized[0][c] << 1) | pbit0;
+                        endpoint1[c] = (candidate.quantized[1][c] << 1) | pbit1;
+                    }
+
+                    candidate.error = bc7_mode6_indices(block, endpoint0, endpoint1, candidate.indices);
+                    if(candidate.error < best.error) best = candidate;
+                }
+            }
+        }
+
+        // Mode 6: one subset, RGBA endpoints of 7 bits + a p-bit each, 4 bit indices.
+        // Starts from the principal axis extent then refits the endpoints to the chosen indices a couple of times
+        static void encode_bc7(const uint8_t block[16][4], uint8_t* out)
+        {
+            float low[4], high[4];
+            axis_endpoints(block, 4, low, high);
+
+            BC7Mode6Block best = { UINT32_MAX, {}, {}, {} };
+            bc7_try_endpoints(block, low, high, best);
+            for(int iteration = 0; iteration < 2 && best.error > 0; iteration++)
+            {
+                if(!bc7_refine_endpoints(block, best.indices, low, high)) break;
+                bc7_try_endpoints(block, low, high, best);
+            }
+
+            // The first index is stored with its top bit implied 0, swap the endpoints if it's set
+            if(best.indices[0] & 8)
+            {
+                for(int c = 0; c < 4; c++) std::swap(best.quantized[0][c], best.quantized[1][c]);
+                std::swap(best.pbits[0], best.pbits[1]);
+                for(uint8_t& index : best.indices) index = 15 - index;
+            }
+
+            memset(out, 0, 16);
+            BitWriter writer = { out, 0 };
+            writer.write(1u << 6, 7);
+            for(int c = 0; c < 4; c++)
+            {
+                writer.write(best.quantized[0][c], 7);
+                writer.write(best.quantized[1][c], 7);
+            }
+            writer.write(best.pbits[0], 1);
+            writer.write(best.pbits[1], 1);
+            writer.write(best.indices[0], 3);
+            for(int i = 1; i < 16; i++)
+            {
+                writer.write(best.indices[i], 4);
+            }
+        }
+
+        uint32_t get_block_size(Format format)
+        {
+            return format == Format::BC1 ? 8 : 16;
+        }
+
+        uint64_t get_level_size(Format format, uint32_t width, uint32_t height, uint32_t level)
+        {
+            uint32_t level_width = std::max(width >> level, 1u), level_height = std::max(height >> level, 1u);
+            return (uint64_t)((level_width + 3) / 4) * ((level_height + 3) / 4) * get_block_size(format);
+        }
+
+        CompressedTexture compress(const uint8_t* chain, uint32_t width, uint32_t height, uint32_t level_count, Format format, ThreadPool& pool)
+        {
+            CompressedTexture texture = { format, width, height, level_count, {}, {} };
+            uint64_t size = 0;
+            for(uint32_t level = 0; level < level_count; level++)
+            {
+                texture.level_offsets.push_back(size);
+                size += get_level_size(format, width, height, level);
+            }
+            texture.data.resize(size);
+
+            // Every block is independent so the rows of blocks of all levels are handed out to the pool
+            struct BlockRow
+            {
+                uint32_t level;
+                uint32_t block_y;
+            };
+            std::vector<BlockRow> rows;
+            for(uint32_t level = 0; level < level_count; level++)
+            {
+                uint32_t level_height = std::max(height >> level, 1u);
+                for(uint32_t block_y = 0; block_y < (level_height + 3) / 4; block_y++) rows.push_back({level, block_y});
+            }
+
+            uint32_t block_size = get_block_size(format);
+            pool.parallel_for((uint32_t)rows.size(), [&](uint32_t row)
+            {
+                uint32_t level = rows[row].level;
+                uint32_t level_width = std::max(width >> level, 1u), level_height = std::max(height >> level, 1u);
+                uint32_t blocks_x = (level_width + 3) / 4;
+                const uint8_t* source = chain + MipGenerator::get_level_offset(width, height, level);
+                uint8_t* destination = texture.data.data() + texture.level_offsets[level] + (uint64_t)rows[row].block_y * blocks_x * block_size;
+
+                for(uint32_t block_x = 0; block_x < blocks_x; block_x++)
+                {
+                    uint8_t block[16][4];
+                    load_block(source, level_width, level_height, block_x, rows[row].block_y, block);
+                    switch(format)
+                    {
+                        case Format::BC1: encode_bc1(block, destination + block_x * block_size); break;
+                        case Format::BC5: encode_bc5(block, destination + block_x * block_size); break;
+                        case Format::BC7: encode_bc7(block, destination + block_x * block_size); break;
+                    }
+                }
+            });
+
+            return texture;
+        }
+
+        bool save(const std::string& path, const CompressedTexture& texture)
+        {
+            std::ofstream file(path, std::ios::binary);
+            if(!file.is_open()) return false;
+
+            ContainerHeader header = { CONTAINER_MAGIC, CONTAINER_VERSION, (uint32_t)texture.format, texture.width, texture.height, texture.level_count };
+            file.write((const char*)&header, sizeof(header));
+
+            uint64_t data_start = sizeof(ContainerHeader) + texture.level_count * sizeof(LevelIndex);
+            for(uint32_t level = 0; level < texture.level_count; level++)
+            {
+                LevelIndex index = { data_start + texture.level_offsets[level], get_level_size(texture.format, texture.width, texture.height, level) };
+                file.write((const char*)&index, sizeof(index));
+            }
+
+            file.write((const char*)texture.data.data(), texture.data.size());
+            return file.good();
+        }
+
+        bool load(const std::string& path, CompressedTexture& texture)
+        {
+            std::ifstream file(path, std::ios::binary | std::ios::ate);
+            if(!file.is_open()) return false;
+
+            uint64_t file_size = (uint64_t)file.tellg();
+            file.seekg(0);
+
+            ContainerHeader header;
+            if(file_size < sizeof(header) || !file.read((char*)&header, sizeof(header))) return false;
+            if(header.magic != CONTAINER_MAGIC || header.version != CONTAINER_VERSION || header.format > (uint32_t)Format::BC7 || header.level_count == 0 || header.level_count > 32) return false;
+
+            Format format = (Format)header.format;
+            std::vector<LevelIndex> levels(header.level_count);
+            if(!file.read((char*)levels.data(), levels.size() * sizeof(LevelIndex))) return false;
+
+            // Levels are expected tightly packed in order, which is all save writes
+            uint64_t data_start = sizeof(ContainerHeader) + header.level_count * sizeof(LevelIndex);
+            uint64_t data_size = 0;
+            texture.level_offsets.clear();
+            for(uint32_t level = 0; level < header.level_count; level++)
+            {
+                if(levels[level].byte_offset != data_start + data_size || levels[level].byte_length != get_level_size(format, header.width, header.height, level)) return false;
+                texture.level_offsets.push_back(data_size);
+                data_size += levels[level].byte_length;
+            }
+            if(data_start + data_size != file_size) return false;
+
+            texture.format = format;
+            texture.width = header.width;
+            texture.height = header.height;
+            texture.level_count = header.level_count;
+            texture.data.resize(data_size);
+            return (bool)file.read((char*)texture.data.data(), data_size);
+        }
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "ThreadPool.h"
+
+namespace Twilight
+{
+    // CPU block compression for the asset cook step and the container the results are cached in.
+    // Input is always RGBA8, output is 4x4 blocks level after level
+    namespace TextureCompressor
+    {
+        enum class Format : uint32_t
+        {
+            BC1 = 0,        // RGB, 8 bytes per block. ORM and other data without alpha
+            BC5 = 1,        // RG, 16 bytes per block. Tangent space normals, z is rebuilt in the shader
+            BC7 = 2         // RGBA, 16 bytes per block. Base color. Only mode 6 is used
+        };
+
+        // All levels back to back, level 0 first
+        struct CompressedTexture
+        {
+            Format format;
+            uint32_t width, height;
+            uint32_t level_count;
+            std::vector<uint64_t> level_offsets;
+            std::vector<uint8_t> data;
+        };
+
+        uint32_t get_block_size(Format format);
+        uint64_t get_level_size(Format format, uint32_t width, uint32_t height, uint32_t level);
+
+        // Encodes every level of an RGBA8 mip chain (laid out like MipGenerator's). Rows of blocks are split across the pool
+        CompressedTexture compress(const uint8_t* chain, uint32_t width, uint32_t height, uint32_t level_count, Format format, ThreadPool& pool);
+
+        // KTX2 style container: header, level index then the level data. Returns false if the file is missing or isn't a valid cache entry
+        bool save(const std::string& path, const CompressedTexture& texture);
+        bool load(const std::string& path, CompressedTexture& texture);
+    }
+}
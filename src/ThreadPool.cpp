@@ -0,0 +1,126 @@
+#include "ThreadPool.h"
+#include <atomic>
+#include <algorithm>
+
+namespace Twilight
+{
+    ThreadPool::ThreadPool()
+    :stopping(false)
+    {
+
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        destroy();
+    }
+
+    void ThreadPool::init(uint32_t thread_count)
+    {
+        if(thread_count == 0)
+        {
+            thread_count = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+        }
+
+        this->stopping = false;
+        for(uint32_t i = 0; i < thread_count; i++)
+        {
+            this->workers.emplace_back(&ThreadPool::worker_loop, this);
+        }
+    }
+
+    void ThreadPool::destroy()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+        this->job_available.notify_all();
+
+        for(std::thread& worker : this->workers)
+        {
+            worker.join();
+        }
+        this->workers.clear();
+    }
+
+    void ThreadPool::worker_loop()
+    {
+        while(true)
+        {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->job_available.wait(lock, [this]() { return this->stopping || !this->jobs.empty(); });
+                if(this->jobs.empty()) return;
+
+                job = std::move(this->jobs.front());
+                this->jobs.pop_front();
+            }
+            job();
+        }
+    }
+
+    void ThreadPool::enqueue(std::function<void()> job)
+    {
+        // Without workers (before init or after destroy) the job runs on the caller
+        if(this->workers.empty())
+        {
+            job();
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->jobs.push_back(std::move(job));
+        }
+        this->job_available.notify_one();
+    }
+
+    void ThreadPool::parallel_for(uint32_t count, const std::function<void(uint32_t)>& function)
+    {
+        if(count == 0) return;
+
+        // Shared by the caller and the helper jobs, which may only get to run after everything is done
+        struct Range
+        {
+            std::atomic<uint32_t> next;
+            std::atomic<uint32_t> done;
+            std::mutex mutex;
+            std::condition_variable finished;
+        };
+        std::shared_ptr<Range> range = std::make_shared<Range>();
+        range->next = 0;
+        range->done = 0;
+
+        auto run = [range, count, &function]()
+        {
+            uint32_t index;
+            while((index = range->next.fetch_add(1)) < count)
+            {
+                function(index);
+                if(range->done.fetch_add(1) + 1 == count)
+                {
+                    std::lock_guard<std::mutex> lock(range->mutex);
+                    range->finished.notify_all();
+                }
+            }
+        };
+
+        // function is only referenced by helpers that claim an index, and all of those finish before this returns
+        uint32_t helper_count = std::min((uint32_t)this->workers.size(), count - 1);
+        for(uint32_t i = 0; i < helper_count; i++)
+        {
+            enqueue(run);
+        }
+        run();
+
+        std::unique_lock<std::mutex> lock(range->mutex);
+        range->finished.wait(lock, [&range, count]() { return range->done.load() == count; });
+    }
+
+    uint32_t ThreadPool::get_thread_count() const
+    {
+        return (uint32_t)this->workers.size();
+    }
+}
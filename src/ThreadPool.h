@@ -0,0 +1,52 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <cstdint>
+
+namespace Twilight
+{
+    // Fixed set of worker threads pulling jobs off one queue. Used by the asset pipeline for decoding and block compression
+    class ThreadPool
+    {
+        private:
+            std::vector<std::thread> workers;
+            std::deque<std::function<void()>> jobs;
+            std::mutex mutex;
+            std::condition_variable job_available;
+            bool stopping;
+
+            void worker_loop();
+            void enqueue(std::function<void()> job);
+
+        public:
+            ThreadPool();
+            ~ThreadPool();
+
+            // 0 uses one thread per hardware thread, leaving one for the caller
+            void init(uint32_t thread_count = 0);
+            // Finishes the jobs already queued then joins the workers
+            void destroy();
+
+            template<typename F>
+            std::future<std::invoke_result_t<F>> submit(F&& function)
+            {
+                typedef std::invoke_result_t<F> Result;
+                std::shared_ptr<std::packaged_task<Result()>> task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(function));
+                std::future<Result> result = task->get_future();
+                enqueue([task]() { (*task)(); });
+                return result;
+            }
+
+            // Calls function(i) for every i in [0, count) and returns when all of them are done. The calling thread takes
+            // indices as well, so this is safe to call from inside a job and runs serially if the pool is busy or empty
+            void parallel_for(uint32_t count, const std::function<void(uint32_t)>& function);
+
+            uint32_t get_thread_count() const;
+    };
+}
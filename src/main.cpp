@@ -22,20 +22,6 @@
 
 const int WIN_WIDTH = 1920, WIN_HEIGHT = 1080;
 
-// Temporary
-void free_node(Twilight::Render::Renderer* renderer, std::shared_ptr<Twilight::SceneNode> node)
-{
-    for(Twilight::Render::Mesh& mesh : node->meshes)
-    {
-        renderer->destroy_mesh(mesh);
-    }
-
-    for(std::shared_ptr<Twilight::SceneNode> child : node->children)
-    {
-        free_node(renderer, child);
-    }
-}
-
 void print_matrices(const std::shared_ptr<Twilight::SceneNode> node)
 {
     for(int i = 0; i < 4; i++)
@@ -81,9 +67,12 @@ int main()
     Twilight::AssetManager asset_manager;
     asset_manager.init(&renderer);
 
-    std::shared_ptr<Twilight::SceneNode> little_guy = asset_manager.load_model("../little-guy.glb");
-    std::shared_ptr<Twilight::SceneNode> helmet = asset_manager.load_model("../DamagedHelmet.glb");
-    std::shared_ptr<Twilight::SceneNode> mech = asset_manager.load_model("../assets/halo_infinite_oddball.glb");
+    // Loaded in the background, each model is drawn once its load finishes. Held for the whole run so none get evicted
+    Twilight::ModelHandle little_guy_load = asset_manager.acquire_model("../little-guy.glb");
+    Twilight::ModelHandle helmet_load = asset_manager.acquire_model("../DamagedHelmet.glb");
+    Twilight::ModelHandle mech_load = asset_manager.acquire_model("../assets/halo_infinite_oddball.glb");
+    std::shared_ptr<Twilight::SceneNode> little_guy, helmet, mech;
+    bool helmet_attached = false;
 
     Twilight::Physics::PhysicsWorld world;
     world.init();
@@ -94,36 +83,55 @@ int main()
 
     float angle = 0.0f;
 
-    Twilight::Scene::AppendChild(little_guy, helmet);
-    Twilight::Scene::SetTransform(helmet, glm::translate(glm::mat4(1.0f), glm::vec3(1.0f)) * glm::rotate(glm::mat4(1.0f), glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f)));
-
     while(!glfwWindowShouldClose(window))
     {
+        // Input and simulation happen as late as possible, right before the frame is recorded
+        renderer.wait_frame();
+
         double current_time = glfwGetTime();
         delta = current_time - previous_time;
         previous_time = current_time;
 
         glfwPollEvents();
+        renderer.mark_input();
+        asset_manager.update_residency();
         
         world.update(delta);
 
+        if(!little_guy) little_guy = little_guy_load.get();
+        if(!helmet) helmet = helmet_load.get();
+        if(!mech) mech = mech_load.get();
+        if(little_guy && helmet && !helmet_attached)
+        {
+            Twilight::Scene::AppendChild(little_guy, helmet);
+            Twilight::Scene::SetTransform(helmet, glm::translate(glm::mat4(1.0f), glm::vec3(1.0f)) * glm::rotate(glm::mat4(1.0f), glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f)));
+            helmet_attached = true;
+        }
+
         JPH::Mat44 box_transform_jph = world.get_transform_test();
         glm::mat4 box_transform = jph_to_glm(box_transform_jph);
 
-        Twilight::Scene::SetTransform(little_guy, box_transform);
+        if(little_guy) Twilight::Scene::SetTransform(little_guy, box_transform);
         
-        //renderer.draw(mech);
-        renderer.draw(little_guy);
-        renderer.draw(helmet);
+        //if(mech) renderer.draw(mech);
+        if(little_guy) renderer.draw(little_guy);
+        if(helmet) renderer.draw(helmet);
 
         renderer.present();
     }
     world.deinit();
-    
+
+    // A load still running would upload into the renderer after it's been idled, let them all finish first
+    little_guy_load.wait();
+    helmet_load.wait();
+    mech_load.wait();
+
+    asset_manager.release_model("../little-guy.glb");
+    asset_manager.release_model("../DamagedHelmet.glb");
+    asset_manager.release_model("../assets/halo_infinite_oddball.glb");
+
     renderer.wait();
-    free_node(&renderer, little_guy);
-    free_node(&renderer, helmet);
-    free_node(&renderer, mech);
+    asset_manager.unload_all_models();
 
     renderer.deinit();
 
@@ -0,0 +1,98 @@
+#include "GeometryPool.h"
+#include "render_backend.h"
+
+GeometryPool::GeometryPool()
+:vertex_buffer{}, index_buffer{}, meshlet_buffer{}, vertex_address(0)
+{
+
+}
+
+GeometryPool::~GeometryPool()
+{
+
+}
+
+void GeometryPool::init(VkDevice device, VmaAllocator allocator, uint64_t vertex_capacity, uint64_t index_capacity, uint64_t meshlet_capacity)
+{
+    // Storage + device address so the vertex pulling shaders can read the arena directly
+    this->vertex_buffer = Twilight::Render::Vulkan::create_buffer(allocator, vertex_capacity, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | 
+                                                                  VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+    this->index_buffer = Twilight::Render::Vulkan::create_buffer(allocator, index_capacity, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+    this->meshlet_buffer = Twilight::Render::Vulkan::create_buffer(allocator, meshlet_capacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+    this->vertex_allocator.init(vertex_capacity);
+    this->index_allocator.init(index_capacity);
+    this->meshlet_allocator.init(meshlet_capacity);
+
+    VkBufferDeviceAddressInfo address_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+        .buffer = this->vertex_buffer.handle
+    };
+    this->vertex_address = vkGetBufferDeviceAddress(device, &address_info);
+}
+
+void GeometryPool::destroy(VmaAllocator allocator)
+{
+    Twilight::Render::Vulkan::destroy_buffer(allocator, this->vertex_buffer);
+    Twilight::Render::Vulkan::destroy_buffer(allocator, this->index_buffer);
+    Twilight::Render::Vulkan::destroy_buffer(allocator, this->meshlet_buffer);
+}
+
+uint64_t GeometryPool::allocate_vertices(uint64_t size, uint64_t stride)
+{
+    return this->vertex_allocator.allocate(size, stride);
+}
+
+uint64_t GeometryPool::allocate_indices(uint64_t size, uint64_t stride)
+{
+    return this->index_allocator.allocate(size, stride);
+}
+
+void GeometryPool::free_vertices(uint64_t offset, uint64_t size)
+{
+    this->vertex_allocator.free(offset, size);
+}
+
+void GeometryPool::free_indices(uint64_t offset, uint64_t size)
+{
+    this->index_allocator.free(offset, size);
+}
+
+uint64_t GeometryPool::allocate_meshlets(uint64_t size)
+{
+    return this->meshlet_allocator.allocate(size, sizeof(Twilight::Render::Meshlet));
+}
+
+void GeometryPool::free_meshlets(uint64_t offset, uint64_t size)
+{
+    this->meshlet_allocator.free(offset, size);
+}
+
+const Twilight::Render::Buffer& GeometryPool::get_vertex_buffer() const
+{
+    return this->vertex_buffer;
+}
+
+const Twilight::Render::Buffer& GeometryPool::get_index_buffer() const
+{
+    return this->index_buffer;
+}
+
+const Twilight::Render::Buffer& GeometryPool::get_meshlet_buffer() const
+{
+    return this->meshlet_buffer;
+}
+
+VkDeviceAddress GeometryPool::get_vertex_address() const
+{
+    return this->vertex_address;
+}
+
+const OffsetAllocator& GeometryPool::get_vertex_allocator() const
+{
+    return this->vertex_allocator;
+}
+
+const OffsetAllocator& GeometryPool::get_index_allocator() const
+{
+    return this->index_allocator;
+}
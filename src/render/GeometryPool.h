@@ -0,0 +1,41 @@
+#pragma once
+#include "OffsetAllocator.h"
+#include "../twilight_types.h"
+
+// Device local vertex and index arenas that every mesh is sub allocated from so the whole
+// scene can be drawn with one vertex and one index buffer bound. Offsets and sizes are in bytes.
+// Meshlets get their own arena which the cluster cull shader reads
+class GeometryPool
+{
+    private:
+        Twilight::Render::Buffer vertex_buffer;
+        Twilight::Render::Buffer index_buffer;
+        Twilight::Render::Buffer meshlet_buffer;
+        OffsetAllocator vertex_allocator;
+        OffsetAllocator index_allocator;
+        OffsetAllocator meshlet_allocator;
+        VkDeviceAddress vertex_address;
+
+    public:
+        GeometryPool();
+        ~GeometryPool();
+
+        void init(VkDevice device, VmaAllocator allocator, uint64_t vertex_capacity, uint64_t index_capacity, uint64_t meshlet_capacity);
+        void destroy(VmaAllocator allocator);
+
+        // Offsets are aligned to the stride so they can be turned into vertexOffset / firstIndex. Returns OffsetAllocator::INVALID_OFFSET when full
+        uint64_t allocate_vertices(uint64_t size, uint64_t stride);
+        uint64_t allocate_indices(uint64_t size, uint64_t stride);
+        void free_vertices(uint64_t offset, uint64_t size);
+        void free_indices(uint64_t offset, uint64_t size);
+        uint64_t allocate_meshlets(uint64_t size);
+        void free_meshlets(uint64_t offset, uint64_t size);
+
+        const Twilight::Render::Buffer& get_vertex_buffer() const;
+        const Twilight::Render::Buffer& get_index_buffer() const;
+        const Twilight::Render::Buffer& get_meshlet_buffer() const;
+        // Device address of the vertex arena for vertex pulling
+        VkDeviceAddress get_vertex_address() const;
+        const OffsetAllocator& get_vertex_allocator() const;
+        const OffsetAllocator& get_index_allocator() const;
+};
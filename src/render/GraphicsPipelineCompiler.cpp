@@ -52,12 +52,24 @@ void GraphicsPipelineCompiler::add_shader(VkShaderModule shader, VkShaderStageFl
     m_shader_stages.push_back(shader_stage);
 }
 
+void GraphicsPipelineCompiler::add_specialization_constant(uint32_t constant_id, uint32_t value)
+{
+    VkSpecializationMapEntry entry = {
+        .constantID = constant_id,
+        .offset = static_cast<uint32_t>(m_specialization_data.size() * sizeof(uint32_t)),
+        .size = sizeof(uint32_t)
+    };
+
+    m_specialization_entries.push_back(entry);
+    m_specialization_data.push_back(value);
+}
+
 void GraphicsPipelineCompiler::set_color_formats(std::vector<VkFormat> formats)
 {
     color_formats = formats;
 }
 
-Twilight::Render::GraphicsPipeline GraphicsPipelineCompiler::compile(VkDevice device)
+Twilight::Render::GraphicsPipeline GraphicsPipelineCompiler::compile(VkDevice device, VkPipelineCache cache)
 {
     VkPipelineInputAssemblyStateCreateInfo input_assembler = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
@@ -137,6 +149,21 @@ Twilight::Render::GraphicsPipeline GraphicsPipelineCompiler::compile(VkDevice de
         .pDynamicStates = state
     };
 
+    VkSpecializationInfo specialization_info = {
+        .mapEntryCount = static_cast<uint32_t>(m_specialization_entries.size()),
+        .pMapEntries = m_specialization_entries.data(),
+        .dataSize = m_specialization_data.size() * sizeof(uint32_t),
+        .pData = m_specialization_data.data()
+    };
+
+    if(!m_specialization_entries.empty())
+    {
+        for(VkPipelineShaderStageCreateInfo& shader_stage : m_shader_stages)
+        {
+            shader_stage.pSpecializationInfo = &specialization_info;
+        }
+    }
+
     VkGraphicsPipelineCreateInfo pipeline_info = {
         .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
         .pNext = &render_info,
@@ -154,7 +181,7 @@ Twilight::Render::GraphicsPipeline GraphicsPipelineCompiler::compile(VkDevice de
     };
 
     VkPipeline pipeline;
-    VK_CHECK(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &pipeline));
+    VK_CHECK(vkCreateGraphicsPipelines(device, cache, 1, &pipeline_info, nullptr, &pipeline));
 
     return {pipeline, m_layout};
 }
\ No newline at end of file
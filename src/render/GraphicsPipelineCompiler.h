@@ -11,6 +11,8 @@ class GraphicsPipelineCompiler
         std::vector<VkVertexInputAttributeDescription> m_attributes;
         std::vector<VkPipelineShaderStageCreateInfo> m_shader_stages;
         std::vector<VkFormat> color_formats;
+        std::vector<VkSpecializationMapEntry> m_specialization_entries;
+        std::vector<uint32_t> m_specialization_data;
 
     public:
         GraphicsPipelineCompiler();
@@ -21,6 +23,8 @@ class GraphicsPipelineCompiler
         void add_binding(uint32_t binding_index, uint32_t stride, VkVertexInputRate rate);
         void add_attribute(uint32_t binding, uint32_t location, uint32_t offset, VkFormat format);
         void add_shader(VkShaderModule shader, VkShaderStageFlagBits stage); 
+        // Applied to every stage, stages that don't declare the constant ignore it
+        void add_specialization_constant(uint32_t constant_id, uint32_t value);
 
-        Twilight::Render::GraphicsPipeline compile(VkDevice device);
+        Twilight::Render::GraphicsPipeline compile(VkDevice device, VkPipelineCache cache);
 };
@@ -0,0 +1,113 @@
+#include "OffsetAllocator.h"
+#include <algorithm>
+#include <cassert>
+
+OffsetAllocator::OffsetAllocator()
+:capacity(0), used(0)
+{
+
+}
+
+OffsetAllocator::~OffsetAllocator()
+{
+
+}
+
+void OffsetAllocator::init(uint64_t capacity)
+{
+    this->capacity = capacity;
+    this->used = 0;
+    this->free_ranges.clear();
+    this->free_ranges.push_back({0, capacity});
+}
+
+// First fit. Any padding needed for alignment stays in the free list as its own range
+uint64_t OffsetAllocator::allocate(uint64_t size, uint64_t alignment)
+{
+    if(size == 0) return INVALID_OFFSET;
+
+    for(size_t i = 0; i < free_ranges.size(); i++)
+    {
+        Range range = free_ranges[i];
+        uint64_t aligned = (range.offset + alignment - 1) / alignment * alignment;
+        uint64_t padding = aligned - range.offset;
+        if(padding + size > range.size) continue;
+
+        uint64_t tail = range.size - padding - size;
+
+        if(padding > 0 && tail > 0)
+        {
+            free_ranges[i].size = padding;
+            free_ranges.insert(free_ranges.begin() + i + 1, {aligned + size, tail});
+        }
+        else if(padding > 0)
+        {
+            free_ranges[i].size = padding;
+        }
+        else if(tail > 0)
+        {
+            free_ranges[i] = {aligned + size, tail};
+        }
+        else
+        {
+            free_ranges.erase(free_ranges.begin() + i);
+        }
+
+        used += size;
+        return aligned;
+    }
+
+    return INVALID_OFFSET;
+}
+
+void OffsetAllocator::free(uint64_t offset, uint64_t size)
+{
+    if(offset == INVALID_OFFSET || size == 0) return;
+
+    std::vector<Range>::iterator next = std::lower_bound(free_ranges.begin(), free_ranges.end(), offset, [](const Range& range, uint64_t value) { return range.offset < value; });
+    assert(next == free_ranges.end() || next->offset >= offset + size);
+
+    used -= size;
+
+    bool merge_prev = next != free_ranges.begin() && (next - 1)->offset + (next - 1)->size == offset;
+    bool merge_next = next != free_ranges.end() && offset + size == next->offset;
+
+    if(merge_prev && merge_next)
+    {
+        (next - 1)->size += size + next->size;
+        free_ranges.erase(next);
+    }
+    else if(merge_prev)
+    {
+        (next - 1)->size += size;
+    }
+    else if(merge_next)
+    {
+        next->offset = offset;
+        next->size += size;
+    }
+    else
+    {
+        free_ranges.insert(next, {offset, size});
+    }
+}
+
+uint64_t OffsetAllocator::get_capacity() const
+{
+    return capacity;
+}
+
+uint64_t OffsetAllocator::get_used() const
+{
+    return used;
+}
+
+uint64_t OffsetAllocator::get_largest_free_range() const
+{
+    uint64_t largest = 0;
+    for(const Range& range : free_ranges)
+    {
+        largest = std::max(largest, range.size);
+    }
+    return largest;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+// Sub allocates ranges out of a fixed size arena. Free ranges are kept sorted by offset
+// and merged with their neighbours when freed so the arena doesn't fragment over time
+class OffsetAllocator
+{
+    private:
+        struct Range
+        {
+            uint64_t offset;
+            uint64_t size;
+        };
+
+        std::vector<Range> free_ranges;
+        uint64_t capacity;
+        uint64_t used;
+
+    public:
+        static constexpr uint64_t INVALID_OFFSET = UINT64_MAX;
+
+        OffsetAllocator();
+        ~OffsetAllocator();
+
+        void init(uint64_t capacity);
+
+        // Returns INVALID_OFFSET if there is no free range big enough
+        uint64_t allocate(uint64_t size, uint64_t alignment = 1);
+        void free(uint64_t offset, uint64_t size);
+
+        uint64_t get_capacity() const;
+        uint64_t get_used() const;
+        uint64_t get_largest_free_range() const;
+};
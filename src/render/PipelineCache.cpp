@@ -0,0 +1,158 @@
+#include "PipelineCache.h"
+#include "render_util.h"
+#include "../MappedFile.h"
+#include "../Hash.h"
+#include <fstream>
+#include <filesystem>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+
+#define PIPELINE_CACHE_MAGIC 0x50434354u     // "TCCP"
+#define PIPELINE_CACHE_VERSION 1u
+
+PipelineCache::PipelineCache()
+:device(VK_NULL_HANDLE), handle(VK_NULL_HANDLE), loaded(false), expected_header{}
+{
+
+}
+
+PipelineCache::~PipelineCache()
+{
+
+}
+
+void PipelineCache::init(VkDevice device, VkPhysicalDevice physical_device, const std::string& directory, bool enabled)
+{
+    this->device = device;
+    this->loaded = false;
+    if(!enabled) return;
+
+    VkPhysicalDeviceIDProperties id_properties = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES
+    };
+    VkPhysicalDeviceProperties2 properties = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+        .pNext = &id_properties
+    };
+    vkGetPhysicalDeviceProperties2(physical_device, &properties);
+
+    this->expected_header = {
+        .magic = PIPELINE_CACHE_MAGIC,
+        .version = PIPELINE_CACHE_VERSION,
+        .vendor_id = properties.properties.vendorID,
+        .device_id = properties.properties.deviceID,
+        .driver_version = properties.properties.driverVersion
+    };
+    memcpy(this->expected_header.device_uuid, id_properties.deviceUUID, VK_UUID_SIZE);
+    memcpy(this->expected_header.cache_uuid, properties.properties.pipelineCacheUUID, VK_UUID_SIZE);
+
+    // One file per device and driver so machines with several GPUs don't keep overwriting each other's cache
+    char name[2 * VK_UUID_SIZE + 1];
+    for(uint32_t i = 0; i < VK_UUID_SIZE; i++)
+    {
+        snprintf(name + 2 * i, 3, "%02x", id_properties.deviceUUID[i]);
+    }
+    this->path = (std::filesystem::path(directory) / (std::string(name) + "_" + std::to_string(properties.properties.driverVersion) + ".bin")).string();
+
+    const void* initial_data = nullptr;
+    size_t initial_size = 0;
+    Twilight::MappedFile file;
+    if(file.open(this->path))
+    {
+        if(validate(file.get_data(), file.get_size()))
+        {
+            initial_data = file.get_data() + sizeof(FileHeader);
+            initial_size = file.get_size() - sizeof(FileHeader);
+            this->loaded = true;
+        }
+        else
+        {
+            std::cout << "Pipeline cache " << this->path << " is stale or corrupt, starting empty" << std::endl;
+        }
+    }
+
+    VkPipelineCacheCreateInfo cache_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .initialDataSize = initial_size,
+        .pInitialData = initial_data
+    };
+    VK_CHECK(vkCreatePipelineCache(this->device, &cache_info, nullptr, &this->handle));
+}
+
+// Checks our header, then the header Vulkan puts at the start of the cache data itself
+bool PipelineCache::validate(const uint8_t* file_data, uint64_t file_size) const
+{
+    if(file_size < sizeof(FileHeader) + sizeof(VkPipelineCacheHeaderVersionOne)) return false;
+
+    FileHeader header;
+    memcpy(&header, file_data, sizeof(header));
+    if(header.magic != PIPELINE_CACHE_MAGIC || header.version != PIPELINE_CACHE_VERSION || header.vendor_id != this->expected_header.vendor_id ||
+       header.device_id != this->expected_header.device_id || header.driver_version != this->expected_header.driver_version ||
+       memcmp(header.device_uuid, this->expected_header.device_uuid, VK_UUID_SIZE) != 0 || memcmp(header.cache_uuid, this->expected_header.cache_uuid, VK_UUID_SIZE) != 0)
+    {
+        return false;
+    }
+
+    const uint8_t* data = file_data + sizeof(FileHeader);
+    if(header.data_size != file_size - sizeof(FileHeader) || header.data_hash != Twilight::hash_bytes(data, header.data_size)) return false;
+
+    VkPipelineCacheHeaderVersionOne cache_header;
+    memcpy(&cache_header, data, sizeof(cache_header));
+    return cache_header.headerSize >= sizeof(cache_header) && cache_header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+           cache_header.vendorID == header.vendor_id && cache_header.deviceID == header.device_id &&
+           memcmp(cache_header.pipelineCacheUUID, header.cache_uuid, VK_UUID_SIZE) == 0;
+}
+
+bool PipelineCache::save() const
+{
+    if(this->handle == VK_NULL_HANDLE) return false;
+
+    size_t size = 0;
+    VK_CHECK(vkGetPipelineCacheData(this->device, this->handle, &size, nullptr));
+    std::vector<uint8_t> data(size);
+    VK_CHECK(vkGetPipelineCacheData(this->device, this->handle, &size, data.data()));
+    data.resize(size);
+
+    FileHeader header = this->expected_header;
+    header.data_size = data.size();
+    header.data_hash = Twilight::hash_bytes(data.data(), data.size());
+
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(this->path).parent_path(), error);
+    std::string temp_path = this->path + ".tmp";
+    {
+        std::ofstream file(temp_path, std::ios::binary);
+        if(!file.is_open()) return false;
+        file.write((const char*)&header, sizeof(header));
+        file.write((const char*)data.data(), data.size());
+        if(!file.good()) return false;
+    }
+
+    std::filesystem::rename(temp_path, this->path, error);
+    if(error)
+    {
+        std::filesystem::remove(temp_path, error);
+        return false;
+    }
+    return true;
+}
+
+void PipelineCache::destroy()
+{
+    if(this->handle != VK_NULL_HANDLE)
+    {
+        vkDestroyPipelineCache(this->device, this->handle, nullptr);
+        this->handle = VK_NULL_HANDLE;
+    }
+}
+
+VkPipelineCache PipelineCache::get_handle() const
+{
+    return this->handle;
+}
+
+bool PipelineCache::was_loaded() const
+{
+    return this->loaded;
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <string>
+#include <cstdint>
+
+// VkPipelineCache kept on disk between runs. The file is named after the device UUID and driver version and starts with a header
+// repeating them, plus a hash of the data. Anything that doesn't match (another GPU, a driver update, a torn write) is ignored
+// and the cache starts empty rather than handing the driver data it can't use
+class PipelineCache
+{
+    private:
+        VkDevice device;
+        VkPipelineCache handle;
+        std::string path;
+        bool loaded;
+
+        struct FileHeader
+        {
+            uint32_t magic;
+            uint32_t version;
+            uint32_t vendor_id;
+            uint32_t device_id;
+            uint32_t driver_version;
+            uint8_t device_uuid[VK_UUID_SIZE];
+            uint8_t cache_uuid[VK_UUID_SIZE];       // VkPhysicalDeviceProperties::pipelineCacheUUID
+            uint32_t padding;
+            uint64_t data_size;
+            uint64_t data_hash;
+        };
+        // Written and read back as raw bytes, the layout can't change without bumping the version
+        static_assert(sizeof(FileHeader) == 72, "PipelineCache::FileHeader layout changed");
+        FileHeader expected_header;
+
+        bool validate(const uint8_t* file_data, uint64_t file_size) const;
+
+    public:
+        PipelineCache();
+        ~PipelineCache();
+
+        // Loads the cache for this device from directory if there's a valid one. With enabled unset the handle stays VK_NULL_HANDLE
+        // so pipelines are built without a cache, for timing
+        void init(VkDevice device, VkPhysicalDevice physical_device, const std::string& directory, bool enabled = true);
+        // Written to a temporary file and renamed over the old one
+        bool save() const;
+        void destroy();
+
+        VkPipelineCache get_handle() const;
+        // True if init found a valid file for this device
+        bool was_loaded() const;
+};
@@ -0,0 +1,78 @@
+#include "RenderQueue.h"
+
+RenderQueue::RenderQueue()
+{
+
+}
+
+RenderQueue::~RenderQueue()
+{
+
+}
+
+uint64_t RenderQueue::make_key(uint32_t pipeline, uint32_t material, uint32_t mesh, uint16_t depth)
+{
+    return ((uint64_t)(pipeline & 0xFF) << 56) | ((uint64_t)(material & 0xFFFFF) << 36) | ((uint64_t)(mesh & 0xFFFFF) << 16) | (uint64_t)depth;
+}
+
+void RenderQueue::push(uint64_t key, uint32_t index)
+{
+    entries.push_back({key, index});
+}
+
+// LSD radix sort on the key, one byte per pass. Passes where every key has the same byte are skipped
+// which is the common case for the pipeline byte right now
+void RenderQueue::sort()
+{
+    size_t count = entries.size();
+    if(count < 2) return;
+
+    scratch.resize(count);
+
+    Entry* src = entries.data();
+    Entry* dst = scratch.data();
+
+    for(uint32_t shift = 0; shift < 64; shift += 8)
+    {
+        uint32_t histogram[256] = {};
+        for(size_t i = 0; i < count; i++)
+        {
+            histogram[(src[i].key >> shift) & 0xFF]++;
+        }
+
+        if(histogram[(src[0].key >> shift) & 0xFF] == count) continue;
+
+        uint32_t offset = 0;
+        for(uint32_t bucket = 0; bucket < 256; bucket++)
+        {
+            uint32_t bucket_count = histogram[bucket];
+            histogram[bucket] = offset;
+            offset += bucket_count;
+        }
+
+        for(size_t i = 0; i < count; i++)
+        {
+            dst[histogram[(src[i].key >> shift) & 0xFF]++] = src[i];
+        }
+
+        Entry* temp = src;
+        src = dst;
+        dst = temp;
+    }
+
+    // Sorted data ended up in scratch after an odd number of passes
+    if(src != entries.data())
+    {
+        entries.swap(scratch);
+    }
+}
+
+void RenderQueue::clear()
+{
+    entries.clear();
+}
+
+const std::vector<RenderQueue::Entry>& RenderQueue::get_entries() const
+{
+    return entries;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Holds a 64 bit sort key per draw so draws can be recorded grouped by state.
+// Key layout (most significant first): pipeline (8 bits) | material (20 bits) | mesh (20 bits) | depth (16 bits)
+class RenderQueue
+{
+    public:
+        struct Entry
+        {
+            uint64_t key;
+            uint32_t index;     // Index into the renderer's draw list
+        };
+
+    private:
+        std::vector<Entry> entries;
+        std::vector<Entry> scratch;
+
+    public:
+        RenderQueue();
+        ~RenderQueue();
+
+        static uint64_t make_key(uint32_t pipeline, uint32_t material, uint32_t mesh, uint16_t depth);
+
+        void push(uint64_t key, uint32_t index);
+        void sort();
+        void clear();
+
+        const std::vector<Entry>& get_entries() const;
+};
@@ -7,18 +7,114 @@
 #include "GraphicsPipelineCompiler.h"
 #include "render_util.h"
 #include "render_backend.h"
+#include "../MipGenerator.h"
 #include <fstream>
+#include <chrono>
+#include <algorithm>
 
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
-struct PushConstants
+#define INITIAL_INSTANCE_CAPACITY 1024
+#define MAX_BINDLESS_TEXTURES 4096
+#define MAX_MATERIALS 4096
+#define GEOMETRY_POOL_VERTEX_CAPACITY (128ull * 1024 * 1024)
+#define GEOMETRY_POOL_INDEX_CAPACITY (64ull * 1024 * 1024)
+#define GEOMETRY_POOL_MESHLET_CAPACITY (16ull * 1024 * 1024)
+#define UPLOAD_STAGING_SIZE (64ull * 1024 * 1024)
+#define CLUSTER_WRITES_INSTANCE 0x80000000u
+#define PIPELINE_CACHE_DIRECTORY "pipeline_cache"
+// Below this many CPU path batches recording goes straight into the frame's command buffer, splitting it costs more than it saves
+#define PARALLEL_RECORD_MIN_BATCHES 128
+
+// Matches InstanceData in default.vert (std430)
+struct InstanceData
 {
     glm::mat4 model;
     glm::mat4 norm_mat;
+    uint32_t material_index;
+    uint32_t vertex_format;     // Only read by the vertex pulling shader
+    uint32_t padding[2];
 };
 
+// Matches the push constants in default_pull.vert
+struct VertexPullConstants
+{
+    VkDeviceAddress vertex_address;
+};
+
+// Matches MaterialData in default.frag (std430)
+struct MaterialData
+{
+    uint32_t base_color_texture;
+    uint32_t padding[3];
+};
+
+// Matches the structs in cull.comp (std430)
+struct ObjectData
+{
+    glm::mat4 model;
+    glm::vec4 bounds;
+    glm::vec4 quantization_min;
+    glm::vec4 quantization_extent;
+    uint32_t first_index;
+    uint32_t index_count;
+    int32_t vertex_offset;
+    uint32_t bucket;
+    uint32_t material_index;
+    uint32_t vertex_format;
+    uint32_t padding[2];
+};
+
+struct BucketData
+{
+    uint32_t draw_count;
+    uint32_t first_command;
+};
+
+// Matches ClusterData in cluster_cull.comp. The first cluster of every object has CLUSTER_WRITES_INSTANCE set in object
+// so the instance is written exactly once. meshlet is UINT32_MAX for meshes without meshlets, the whole mesh is one cluster
+struct ClusterData
+{
+    uint32_t object;
+    uint32_t meshlet;
+};
+
+// Shared by cull.comp and cluster_cull.comp
+struct CullConstants
+{
+    glm::vec4 planes[6];
+    glm::vec4 camera_position;      // Only read by the cluster cone test
+    uint32_t object_count;          // Clusters for cluster_cull.comp
+};
+
+static uint32_t vertex_format_stride(Twilight::Render::VertexFormat format)
+{
+    switch(format)
+    {
+        case Twilight::Render::VertexFormat::STANDARD: return sizeof(Twilight::Render::Vertex);
+        case Twilight::Render::VertexFormat::PACKED: return sizeof(Twilight::Render::PackedVertex);
+    }
+    return sizeof(Twilight::Render::Vertex);
+}
+
+static uint32_t index_type_size(VkIndexType index_type)
+{
+    return index_type == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+// Maps quantized positions back to object space. Goes on the right of the model matrix
+static glm::mat4 dequantize_matrix(const Twilight::Render::VertexQuantization& quantization)
+{
+    glm::mat4 dequantize = glm::mat4(1.0f);
+    dequantize[0][0] = quantization.extent.x;
+    dequantize[1][1] = quantization.extent.y;
+    dequantize[2][2] = quantization.extent.z;
+    dequantize[3] = glm::vec4(quantization.min, 1.0f);
+    return dequantize;
+}
+
 /* Each material type supported will have it's own pipeline that can be referenced by the material when a new material is created. What specific pipeline is referenced is based on what material type you have */
 
 namespace Twilight
@@ -36,73 +132,89 @@ namespace Twilight
 
         }
 
-        void Renderer::init(GLFWwindow* window, uint32_t width, uint32_t height)
+        void Renderer::init(GLFWwindow* window, uint32_t width, uint32_t height, PresentMode present_mode)
         {
             this->window = window;
+            this->present_mode = present_mode;
             init_vulkan();
-            create_swapchain(width, height);
+            create_swapchain(width, height, VK_NULL_HANDLE);
             init_imgui();
-            this->material_set_allocator.init_pools(this->device, 20, {{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 10}, {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 10}});
-            this->general_set_allocator.init_pools(this->device, 20, {{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 20}});
-
-            {
-                VkCommandPoolCreateInfo pool_info = {
-                    .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-                    .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
-                    .queueFamilyIndex = this->transfer_queue.family
-                };
-
-                VK_CHECK(vkCreateCommandPool(this->device, &pool_info, nullptr, &this->transfer_pool));
-
-                VkCommandBufferAllocateInfo alloc_info = {
-                    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-                    .commandPool = this->transfer_pool,
-                    .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-                    .commandBufferCount = 1
-                };
+            this->general_set_allocator.init_pools(this->device, 20, {{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 20}, {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 60}});
 
-                VK_CHECK(vkAllocateCommandBuffers(this->device, &alloc_info, &this->transfer_cmd));
-
-                VkFenceCreateInfo fence_info = {
-                    .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-                    .flags = VK_FENCE_CREATE_SIGNALED_BIT
-                };
-                VK_CHECK(vkCreateFence(this->device, &fence_info, nullptr, &this->transfer_fence));
-            }
+            this->upload_manager.init(this->device, this->allocator, this->transfer_queue.handle, this->transfer_queue.family, this->graphics_queue.family, UPLOAD_STAGING_SIZE);
 
             init_material_layouts();
+            std::chrono::high_resolution_clock::time_point pipelines_start = std::chrono::high_resolution_clock::now();
             init_material_pipelines();
+            init_compute_pipelines();
+            double pipelines_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - pipelines_start).count();
+            const char* cache_state = !this->use_pipeline_cache ? "off" : this->pipeline_cache.was_loaded() ? "loaded" : "cold";
+            std::cout << "Pipelines built in " << pipelines_ms << " ms (pipeline cache " << cache_state << ")" << std::endl;
+            // Saved right away on a cold start so a run that never reaches deinit still leaves a cache behind
+            if(this->use_pipeline_cache && !this->pipeline_cache.was_loaded()) this->pipeline_cache.save();
+            init_bindless();
+
+            this->geometry_pool.init(this->device, this->allocator, GEOMETRY_POOL_VERTEX_CAPACITY, GEOMETRY_POOL_INDEX_CAPACITY, GEOMETRY_POOL_MESHLET_CAPACITY);
             
             
             // Temporary
             {
-                this->global_set = this->general_set_allocator.allocate(this->device, this->global_layout);
-
-                GlobalUbo global_ubo_cpu = {
+                this->global_ubo_data = {
                     .projection = glm::perspective(glm::radians(45.0f), (float)width/ (float)height, 0.1f, 100.0f),
                     .view = glm::lookAt(glm::vec3(0.0, 0.0, 5.0), glm::vec3(0.0, 0.0, 0.0), glm::vec3(0.0, 1.0, 0.0))
                 };
 
-                global_ubo_cpu.projection[1][1] *= -1.0;
+                this->global_ubo_data.projection[1][1] *= -1.0;
 
-                this->global_ubo = Vulkan::create_buffer(this->device, {this->transfer_cmd, this->transfer_queue.handle, this->transfer_fence}, this->allocator, &global_ubo_cpu, sizeof(GlobalUbo), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+                this->global_ubo = create_buffer(&this->global_ubo_data, sizeof(GlobalUbo), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
 
-                VkDescriptorBufferInfo buffer_info = {
-                    .buffer = this->global_ubo.handle,
-                    .offset = 0,
-                    .range = sizeof(GlobalUbo)
-                };
+                for(int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+                {
+                    this->frames[i].global_set = this->general_set_allocator.allocate(this->device, this->global_layout);
+                    this->frames[i].cull_set = this->general_set_allocator.allocate(this->device, this->cull_layout);
+                    this->frames[i].instance_buffer = {};
+                    this->frames[i].instance_capacity = 0;
+                    this->frames[i].object_buffer = {};
+                    this->frames[i].bucket_buffer = {};
+                    this->frames[i].command_buffer = {};
+                    this->frames[i].cluster_buffer = {};
+                    this->frames[i].object_capacity = 0;
+                    this->frames[i].command_capacity = 0;
+                    this->frames[i].bucket_capacity = 0;
+                    this->frames[i].upload_wait = 0;
+
+                    VkDescriptorBufferInfo buffer_info = {
+                        .buffer = this->global_ubo.handle,
+                        .offset = 0,
+                        .range = sizeof(GlobalUbo)
+                    };
 
-                VkWriteDescriptorSet write_set = {
-                    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                    .dstSet = this->global_set,
-                    .dstBinding = 0,
-                    .descriptorCount = 1,
-                    .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                    .pBufferInfo = &buffer_info
-                };
+                    VkWriteDescriptorSet write_set = {
+                        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                        .dstSet = this->frames[i].global_set,
+                        .dstBinding = 0,
+                        .descriptorCount = 1,
+                        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                        .pBufferInfo = &buffer_info
+                    };
 
-                vkUpdateDescriptorSets(this->device, 1, &write_set, 0, nullptr);
+                    vkUpdateDescriptorSets(this->device, 1, &write_set, 0, nullptr);
+
+                    // The meshlet arena never moves so it only has to be written once
+                    VkDescriptorBufferInfo meshlet_info = { .buffer = this->geometry_pool.get_meshlet_buffer().handle, .offset = 0, .range = VK_WHOLE_SIZE };
+                    VkWriteDescriptorSet meshlet_write = {
+                        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                        .dstSet = this->frames[i].cull_set,
+                        .dstBinding = 4,
+                        .descriptorCount = 1,
+                        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                        .pBufferInfo = &meshlet_info
+                    };
+
+                    vkUpdateDescriptorSets(this->device, 1, &meshlet_write, 0, nullptr);
+
+                    reserve_instances(&this->frames[i], INITIAL_INSTANCE_CAPACITY);
+                }
             }
 
             // Figure out how to abstract this so materials are easy to create
@@ -116,37 +228,26 @@ namespace Twilight
                     image_data[i + 3] = 255;
                 }
 
+                // Trilinear over the whole mip chain
                 VkSamplerCreateInfo sampler_info = {
                     .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
-                    .magFilter = VK_FILTER_NEAREST,
-                    .minFilter = VK_FILTER_NEAREST
+                    .magFilter = VK_FILTER_LINEAR,
+                    .minFilter = VK_FILTER_LINEAR,
+                    .mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
+                    .minLod = 0.0f,
+                    .maxLod = VK_LOD_CLAMP_NONE
                 };
 
                 VK_CHECK(vkCreateSampler(this->device, &sampler_info, nullptr, &this->default_sampler));
 
-                Material default_material = {
-                    .pipeline = &this->phong_pipeline,
-                    .descriptor_set = this->material_set_allocator.allocate(this->device, this->phong_layout),
-                    .texture = Vulkan::create_image(this->device, this->allocator, {this->transfer_cmd, this->transfer_queue.handle, this->transfer_fence}, image_data.data(), {2, 2, 1}, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_USAGE_SAMPLED_BIT)
-                };
-
-                VkDescriptorImageInfo image_info = {
-                    .sampler = this->default_sampler,
-                    .imageView = default_material.texture.view,
-                    .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
-                };
-
-                VkWriteDescriptorSet write_image_set = {
-                    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                    .dstSet = default_material.descriptor_set,
-                    .dstBinding = 0,
-                    .descriptorCount = 1,
-                    .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                    .pImageInfo = &image_info
-                };
+                Image default_texture = create_image(image_data.data(), {2, 2, 1}, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_USAGE_SAMPLED_BIT);
 
-                vkUpdateDescriptorSets(this->device, 1, &write_image_set, 0, nullptr);
-                materials.push_back(default_material);
+                add_material({
+                    .pipeline = &this->phong_pipeline,
+                    .texture_index = register_texture(default_texture, 0),
+                    .buffer = {},
+                    .texture = default_texture
+                });
             }
 
 
@@ -155,6 +256,8 @@ namespace Twilight
 
         void Renderer::wait()
         {
+            // vkDeviceWaitIdle needs every queue externally synchronized, loader threads submit uploads under this lock
+            std::lock_guard<std::mutex> lock(this->resource_mutex);
             vkDeviceWaitIdle(this->device);
         }
 
@@ -166,20 +269,36 @@ namespace Twilight
             {
                 destroy_material(mat);
             }
+            for(TextureSlot& slot : this->texture_slots)
+            {
+                Vulkan::destroy_image(this->device, this->allocator, slot.image);
+            }
+            reclaim_retired(true);
 
+            this->geometry_pool.destroy(this->allocator);
             Vulkan::destroy_image(this->device, this->allocator, this->depth_buffer);
             Vulkan::destroy_buffer(this->allocator, this->global_ubo);
+            for(int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+            {
+                Vulkan::destroy_buffer(this->allocator, this->frames[i].instance_buffer);
+                Vulkan::destroy_buffer(this->allocator, this->frames[i].object_buffer);
+                Vulkan::destroy_buffer(this->allocator, this->frames[i].bucket_buffer);
+                Vulkan::destroy_buffer(this->allocator, this->frames[i].command_buffer);
+                Vulkan::destroy_buffer(this->allocator, this->frames[i].cluster_buffer);
+            }
             vkDestroySampler(this->device, this->default_sampler, nullptr);
+            deinit_bindless();
             deinit_material_layouts();
 
-            vkDestroyFence(this->device, this->transfer_fence, nullptr);
-            vkDestroyCommandPool(this->device, this->transfer_pool, nullptr);
+            this->upload_manager.destroy();
             
             deinit_material_pipelines();
+            deinit_compute_pipelines();
+            if(!this->pipeline_cache.save() && this->use_pipeline_cache) std::cout << "Couldn't save the pipeline cache" << std::endl;
+            this->pipeline_cache.destroy();
 
 
             general_set_allocator.destroy_pool(this->device);
-            material_set_allocator.destroy_pool(this->device);
             deinit_imgui();
             destroy_swapchain();
             deinit_vulkan();
@@ -188,55 +307,395 @@ namespace Twilight
         void Renderer::init_material_layouts()
         {
             {
-                VkDescriptorSetLayoutBinding global_ubo = {
-                    .binding = 0,
-                    .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                    .descriptorCount = 1,
-                    .stageFlags = VK_SHADER_STAGE_VERTEX_BIT
+                VkDescriptorSetLayoutBinding global_bindings[] = {
+                    {
+                        .binding = 0,
+                        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                        .descriptorCount = 1,
+                        .stageFlags = VK_SHADER_STAGE_VERTEX_BIT
+                    },
+                    {
+                        .binding = 1,
+                        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                        .descriptorCount = 1,
+                        .stageFlags = VK_SHADER_STAGE_VERTEX_BIT
+                    }
                 };
 
                 VkDescriptorSetLayoutCreateInfo global_info = {
                     .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-                    .bindingCount = 1,
-                    .pBindings = &global_ubo
+                    .bindingCount = 2,
+                    .pBindings = global_bindings
                 };
 
                 VK_CHECK(vkCreateDescriptorSetLayout(this->device, &global_info, nullptr, &this->global_layout));
             }
 
             {
-                VkDescriptorSetLayoutBinding diffuse_tex = {
-                    .binding = 0,
-                    .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                    .descriptorCount = 1,
-                    .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT
+                VkDescriptorSetLayoutBinding bindless_bindings[] = {
+                    {
+                        .binding = 0,
+                        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                        .descriptorCount = MAX_BINDLESS_TEXTURES,
+                        .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT
+                    },
+                    {
+                        .binding = 1,
+                        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                        .descriptorCount = 1,
+                        .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT
+                    }
+                };
+
+                // Textures get added while earlier frames that have the set bound are still in flight
+                VkDescriptorBindingFlags binding_flags[] = {
+                    VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT,
+                    0
                 };
 
-                VkDescriptorSetLayoutCreateInfo phong_info = {
+                VkDescriptorSetLayoutBindingFlagsCreateInfo binding_flags_info = {
+                    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+                    .bindingCount = 2,
+                    .pBindingFlags = binding_flags
+                };
+
+                VkDescriptorSetLayoutCreateInfo bindless_info = {
                     .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-                    .bindingCount = 1,
-                    .pBindings = &diffuse_tex
+                    .pNext = &binding_flags_info,
+                    .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT,
+                    .bindingCount = 2,
+                    .pBindings = bindless_bindings
                 };
 
-                VK_CHECK(vkCreateDescriptorSetLayout(this->device, &phong_info, nullptr, &this->phong_layout));
+                VK_CHECK(vkCreateDescriptorSetLayout(this->device, &bindless_info, nullptr, &this->bindless_layout));
             }
         }
 
         void Renderer::deinit_material_layouts()
         {
             vkDestroyDescriptorSetLayout(this->device, this->global_layout, nullptr);
-            vkDestroyDescriptorSetLayout(this->device, this->phong_layout, nullptr);
+            vkDestroyDescriptorSetLayout(this->device, this->bindless_layout, nullptr);
+        }
+
+        void Renderer::init_bindless()
+        {
+            VkDescriptorPoolSize pool_sizes[] = {
+                { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, MAX_BINDLESS_TEXTURES },
+                { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 }
+            };
+
+            VkDescriptorPoolCreateInfo pool_info = {
+                .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+                .flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
+                .maxSets = 1,
+                .poolSizeCount = 2,
+                .pPoolSizes = pool_sizes
+            };
+
+            VK_CHECK(vkCreateDescriptorPool(this->device, &pool_info, nullptr, &this->bindless_pool));
+
+            VkDescriptorSetAllocateInfo alloc_info = {
+                .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+                .descriptorPool = this->bindless_pool,
+                .descriptorSetCount = 1,
+                .pSetLayouts = &this->bindless_layout
+            };
+
+            VK_CHECK(vkAllocateDescriptorSets(this->device, &alloc_info, &this->bindless_set));
+
+            this->material_buffer = Vulkan::create_buffer(this->allocator, MAX_MATERIALS * sizeof(MaterialData), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+
+            VkDescriptorBufferInfo buffer_info = {
+                .buffer = this->material_buffer.handle,
+                .offset = 0,
+                .range = VK_WHOLE_SIZE
+            };
+
+            VkWriteDescriptorSet write_set = {
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstSet = this->bindless_set,
+                .dstBinding = 1,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .pBufferInfo = &buffer_info
+            };
+
+            vkUpdateDescriptorSets(this->device, 1, &write_set, 0, nullptr);
+        }
+
+        void Renderer::deinit_bindless()
+        {
+            Vulkan::destroy_buffer(this->allocator, this->material_buffer);
+            vkDestroyDescriptorPool(this->device, this->bindless_pool, nullptr);
+        }
+
+        // Writes the image into a free slot of the bindless texture table, which takes ownership of it. The slot starts
+        // without references, the material using it adds the first
+        uint32_t Renderer::register_texture(const Image& image, uint64_t content_hash)
+        {
+            uint32_t texture_index;
+            if(!this->free_texture_slots.empty())
+            {
+                texture_index = this->free_texture_slots.back();
+                this->free_texture_slots.pop_back();
+            }
+            else
+            {
+                if(this->texture_slots.size() >= MAX_BINDLESS_TEXTURES)
+                {
+                    std::cout << "Bindless texture table is full, using the default texture" << std::endl;
+                    return 0;
+                }
+                texture_index = static_cast<uint32_t>(this->texture_slots.size());
+                this->texture_slots.push_back({});
+            }
+
+            this->texture_slots[texture_index] = { image, content_hash, 0 };
+            if(content_hash != 0)
+            {
+                this->texture_lookup[content_hash] = texture_index;
+            }
+
+            VkDescriptorImageInfo image_info = {
+                .sampler = this->default_sampler,
+                .imageView = image.view,
+                .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+            };
+
+            VkWriteDescriptorSet write_set = {
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstSet = this->bindless_set,
+                .dstBinding = 0,
+                .dstArrayElement = texture_index,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                .pImageInfo = &image_info
+            };
+
+            vkUpdateDescriptorSets(this->device, 1, &write_set, 0, nullptr);
+            return texture_index;
+        }
+
+        // Adds the material to the material list with one reference and mirrors it into the material buffer. Returns the material index
+        uint32_t Renderer::add_material(const Material& material)
+        {
+            uint32_t material_index;
+            if(!this->free_material_slots.empty())
+            {
+                material_index = this->free_material_slots.back();
+                this->free_material_slots.pop_back();
+                this->materials[material_index] = material;
+                this->material_refs[material_index] = 1;
+            }
+            else
+            {
+                material_index = static_cast<uint32_t>(this->materials.size());
+                if(material_index >= MAX_MATERIALS)
+                {
+                    std::cout << "Material buffer is full, using the default material" << std::endl;
+                    return 0;
+                }
+                this->materials.push_back(material);
+                this->material_refs.push_back(1);
+            }
+
+            MaterialData* material_data = (MaterialData*)this->material_buffer.info.pMappedData;
+            material_data[material_index] = { .base_color_texture = material.texture_index };
+            VK_CHECK(vmaFlushAllocation(this->allocator, this->material_buffer.allocation, material_index * sizeof(MaterialData), sizeof(MaterialData)));
+
+            return material_index;
+        }
+
+        // Returns the material drawing texture_index with pipeline, creating it if there isn't one yet. Takes a reference either way
+        uint32_t Renderer::acquire_material(GraphicsPipeline* pipeline, uint32_t texture_index)
+        {
+            // Only reached with the default texture when the table is full, which is what the default material already is
+            if(texture_index == 0) return 0;
+
+            uint64_t key = ((uint64_t)pipeline->sort_id << 32) | texture_index;
+            std::unordered_map<uint64_t, uint32_t>::iterator existing = this->material_lookup.find(key);
+            if(existing != this->material_lookup.end())
+            {
+                this->material_refs[existing->second]++;
+                return existing->second;
+            }
+
+            uint32_t material_index = add_material({.pipeline = pipeline, .texture_index = texture_index, .buffer = {}, .texture = this->texture_slots[texture_index].image});
+            if(material_index == 0)
+            {
+                // No room for the material, a texture registered just for it would never be freed
+                this->texture_slots[texture_index].ref_count++;
+                drop_texture_ref(texture_index);
+                return 0;
+            }
+
+            this->texture_slots[texture_index].ref_count++;
+            this->material_lookup[key] = material_index;
+            return material_index;
+        }
+
+        void Renderer::add_material_ref(uint32_t material_index)
+        {
+            if(material_index != 0 && material_index < this->material_refs.size() && this->material_refs[material_index] > 0)
+            {
+                this->material_refs[material_index]++;
+            }
+        }
+
+        void Renderer::drop_material_ref(uint32_t material_index)
+        {
+            if(material_index == 0 || material_index >= this->material_refs.size() || this->material_refs[material_index] == 0) return;
+            if(--this->material_refs[material_index] > 0) return;
+
+            Material& material = this->materials[material_index];
+            this->material_lookup.erase(((uint64_t)material.pipeline->sort_id << 32) | material.texture_index);
+            drop_texture_ref(material.texture_index);
+            // The slot's pipeline pointer stays valid until it's reused, frames in flight may still resolve it
+            retire({}, UINT32_MAX, material_index);
+        }
+
+        void Renderer::drop_texture_ref(uint32_t texture_index)
+        {
+            if(texture_index == 0 || texture_index >= this->texture_slots.size() || this->texture_slots[texture_index].ref_count == 0) return;
+            if(--this->texture_slots[texture_index].ref_count > 0) return;
+
+            TextureSlot& slot = this->texture_slots[texture_index];
+            if(slot.content_hash != 0)
+            {
+                this->texture_lookup.erase(slot.content_hash);
+            }
+            retire(slot.image, texture_index, UINT32_MAX);
+            slot = {};
+        }
+
+        void Renderer::retire(const Image& image, uint32_t texture_slot, uint32_t material_slot)
+        {
+            this->retired_resources.push_back({ image, texture_slot, material_slot, {}, this->frame_number + 1 });
+        }
+
+        void Renderer::retire_geometry(const Mesh& mesh)
+        {
+            this->retired_resources.push_back({ {}, UINT32_MAX, UINT32_MAX, mesh, this->frame_number + 1 });
+        }
+
+        // Gives a mesh's ranges back to the geometry pool
+        void Renderer::free_geometry(const Mesh& mesh)
+        {
+            if(mesh.index_count > 0)
+            {
+                uint64_t stride = vertex_format_stride(mesh.vertex_format);
+                this->geometry_pool.free_vertices((uint64_t)mesh.vertex_offset * stride, (uint64_t)mesh.vertex_count * stride);
+                uint64_t index_stride = index_type_size(mesh.index_type);
+                this->geometry_pool.free_indices((uint64_t)mesh.first_index * index_stride, (uint64_t)mesh.index_count * index_stride);
+            }
+            if(mesh.meshlet_count > 0)
+            {
+                this->geometry_pool.free_meshlets((uint64_t)mesh.first_meshlet * sizeof(Meshlet), (uint64_t)mesh.meshlet_count * sizeof(Meshlet));
+            }
+        }
+
+        // Frees whatever the frame timeline shows every frame using it has finished with, or everything once the device is idle
+        void Renderer::reclaim_retired(bool all)
+        {
+            uint64_t completed = 0;
+            VK_CHECK(vkGetSemaphoreCounterValue(this->device, this->frame_timeline, &completed));
+
+            size_t kept = 0;
+            for(RetiredResource& retired : this->retired_resources)
+            {
+                if(!all && retired.timeline_value > completed)
+                {
+                    this->retired_resources[kept++] = retired;
+                    continue;
+                }
+
+                Vulkan::destroy_image(this->device, this->allocator, retired.image);
+                free_geometry(retired.geometry);
+                if(retired.texture_slot != UINT32_MAX) this->free_texture_slots.push_back(retired.texture_slot);
+                if(retired.material_slot != UINT32_MAX) this->free_material_slots.push_back(retired.material_slot);
+            }
+            this->retired_resources.resize(kept);
+
+            std::erase_if(this->retired_swapchains, [&](RetiredSwapchain& retired)
+            {
+                if(!all && retired.timeline_value > completed) return false;
+
+                for(VkImageView view : retired.views)
+                {
+                    vkDestroyImageView(this->device, view, nullptr);
+                }
+                vkDestroySwapchainKHR(this->device, retired.handle, nullptr);
+                Vulkan::destroy_image(this->device, this->allocator, retired.depth_buffer);
+                return true;
+            });
+        }
+
+        void Renderer::release_material(uint32_t material_id)
+        {
+            std::lock_guard<std::mutex> lock(this->resource_mutex);
+            drop_material_ref(material_id);
         }
 
         void Renderer::init_material_pipelines()
         {
             {
-                VkDescriptorSetLayout set_layouts[] = { this->global_layout, this->phong_layout };
+                VkDescriptorSetLayout set_layouts[] = { this->global_layout, this->bindless_layout };
+
+                // Per draw transforms come from the instance buffer now so there are no push constants
+                VkPipelineLayoutCreateInfo layout_info = {
+                    .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+                    .setLayoutCount = 2,
+                    .pSetLayouts = set_layouts,
+                };
+
+                VkPipelineLayout pipeline_layout;
+                VK_CHECK(vkCreatePipelineLayout(this->device, &layout_info, nullptr, &pipeline_layout));
+
+                VkShaderModule vertex_shader;
+                Vulkan::load_shader_module("../shaders/default.vert.spv", this->device, &vertex_shader);
+                VkShaderModule fragment_shader;
+                Vulkan::load_shader_module("../shaders/default.frag.spv", this->device, &fragment_shader);
+
+                GraphicsPipelineCompiler graphics_pipeline_compiler;
+                graphics_pipeline_compiler.set_layout(pipeline_layout);
+                graphics_pipeline_compiler.set_color_formats({this->swapchain.format});
+                graphics_pipeline_compiler.add_binding(0, 8 * sizeof(float), VK_VERTEX_INPUT_RATE_VERTEX);
+                graphics_pipeline_compiler.add_attribute(0, 0, 0, VK_FORMAT_R32G32B32_SFLOAT);
+                graphics_pipeline_compiler.add_attribute(0, 1, 3 * sizeof(float), VK_FORMAT_R32G32B32_SFLOAT);
+                graphics_pipeline_compiler.add_attribute(0, 2, 6 * sizeof(float), VK_FORMAT_R32G32_SFLOAT);
+                graphics_pipeline_compiler.add_shader(vertex_shader, VK_SHADER_STAGE_VERTEX_BIT);
+                graphics_pipeline_compiler.add_shader(fragment_shader, VK_SHADER_STAGE_FRAGMENT_BIT);
+                this->phong_pipeline = graphics_pipeline_compiler.compile(this->device, this->pipeline_cache.get_handle());
+                this->phong_pipeline.sort_id = 0;
+
+                // Packed variant. Same layout, the vertex shader decodes the normal when PACKED_VERTICES (constant 0) is set
+                VkPipelineLayout packed_layout;
+                VK_CHECK(vkCreatePipelineLayout(this->device, &layout_info, nullptr, &packed_layout));
+
+                GraphicsPipelineCompiler packed_pipeline_compiler;
+                packed_pipeline_compiler.set_layout(packed_layout);
+                packed_pipeline_compiler.set_color_formats({this->swapchain.format});
+                packed_pipeline_compiler.add_binding(0, sizeof(PackedVertex), VK_VERTEX_INPUT_RATE_VERTEX);
+                packed_pipeline_compiler.add_attribute(0, 0, offsetof(PackedVertex, pos), VK_FORMAT_R16G16B16A16_UNORM);
+                packed_pipeline_compiler.add_attribute(0, 1, offsetof(PackedVertex, norm), VK_FORMAT_R16G16_SNORM);
+                packed_pipeline_compiler.add_attribute(0, 2, offsetof(PackedVertex, tex), VK_FORMAT_R16G16_SFLOAT);
+                packed_pipeline_compiler.add_shader(vertex_shader, VK_SHADER_STAGE_VERTEX_BIT);
+                packed_pipeline_compiler.add_shader(fragment_shader, VK_SHADER_STAGE_FRAGMENT_BIT);
+                packed_pipeline_compiler.add_specialization_constant(0, VK_TRUE);
+                this->phong_packed_pipeline = packed_pipeline_compiler.compile(this->device, this->pipeline_cache.get_handle());
+                this->phong_packed_pipeline.sort_id = 1;
+        
+                vkDestroyShaderModule(this->device, vertex_shader, nullptr);
+                vkDestroyShaderModule(this->device, fragment_shader, nullptr);
+            }
+
+            {
+                VkDescriptorSetLayout set_layouts[] = { this->global_layout, this->bindless_layout };
 
                 VkPushConstantRange push_constant = {
                     .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
                     .offset = 0,
-                    .size = 128,   
+                    .size = sizeof(VertexPullConstants)
                 };
 
                 VkPipelineLayoutCreateInfo layout_info = {
@@ -251,21 +710,19 @@ namespace Twilight
                 VK_CHECK(vkCreatePipelineLayout(this->device, &layout_info, nullptr, &pipeline_layout));
 
                 VkShaderModule vertex_shader;
-                Vulkan::load_shader_module("../shaders/default.vert.spv", this->device, &vertex_shader);
+                Vulkan::load_shader_module("../shaders/default_pull.vert.spv", this->device, &vertex_shader);
                 VkShaderModule fragment_shader;
                 Vulkan::load_shader_module("../shaders/default.frag.spv", this->device, &fragment_shader);
 
+                // No bindings or attributes, the vertex shader decodes vertices itself
                 GraphicsPipelineCompiler graphics_pipeline_compiler;
                 graphics_pipeline_compiler.set_layout(pipeline_layout);
                 graphics_pipeline_compiler.set_color_formats({this->swapchain.format});
-                graphics_pipeline_compiler.add_binding(0, 8 * sizeof(float), VK_VERTEX_INPUT_RATE_VERTEX);
-                graphics_pipeline_compiler.add_attribute(0, 0, 0, VK_FORMAT_R32G32B32_SFLOAT);
-                graphics_pipeline_compiler.add_attribute(0, 1, 3 * sizeof(float), VK_FORMAT_R32G32B32_SFLOAT);
-                graphics_pipeline_compiler.add_attribute(0, 2, 6 * sizeof(float), VK_FORMAT_R32G32_SFLOAT);
                 graphics_pipeline_compiler.add_shader(vertex_shader, VK_SHADER_STAGE_VERTEX_BIT);
                 graphics_pipeline_compiler.add_shader(fragment_shader, VK_SHADER_STAGE_FRAGMENT_BIT);
-                this->phong_pipeline = graphics_pipeline_compiler.compile(this->device);
-        
+                this->phong_pulling_pipeline = graphics_pipeline_compiler.compile(this->device, this->pipeline_cache.get_handle());
+                this->phong_pulling_pipeline.sort_id = 2;
+
                 vkDestroyShaderModule(this->device, vertex_shader, nullptr);
                 vkDestroyShaderModule(this->device, fragment_shader, nullptr);
             }
@@ -275,6 +732,71 @@ namespace Twilight
         {
             vkDestroyPipeline(this->device, this->phong_pipeline.handle, nullptr);
             vkDestroyPipelineLayout(this->device, this->phong_pipeline.layout, nullptr);
+            vkDestroyPipeline(this->device, this->phong_packed_pipeline.handle, nullptr);
+            vkDestroyPipelineLayout(this->device, this->phong_packed_pipeline.layout, nullptr);
+            vkDestroyPipeline(this->device, this->phong_pulling_pipeline.handle, nullptr);
+            vkDestroyPipelineLayout(this->device, this->phong_pulling_pipeline.layout, nullptr);
+        }
+
+        void Renderer::init_compute_pipelines()
+        {
+            {
+                // 0 objects, 1 buckets, 2 commands, 3 instances, 4 meshlets, 5 clusters
+                VkDescriptorSetLayoutBinding cull_bindings[6];
+                for(uint32_t binding = 0; binding < 6; binding++)
+                {
+                    cull_bindings[binding] = {
+                        .binding = binding,
+                        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                        .descriptorCount = 1,
+                        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT
+                    };
+                }
+
+                VkDescriptorSetLayoutCreateInfo cull_info = {
+                    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+                    .bindingCount = 6,
+                    .pBindings = cull_bindings
+                };
+
+                VK_CHECK(vkCreateDescriptorSetLayout(this->device, &cull_info, nullptr, &this->cull_layout));
+
+                VkPushConstantRange push_constant = {
+                    .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+                    .offset = 0,
+                    .size = sizeof(CullConstants)
+                };
+
+                VkPipelineLayoutCreateInfo layout_info = {
+                    .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+                    .setLayoutCount = 1,
+                    .pSetLayouts = &this->cull_layout,
+                    .pushConstantRangeCount = 1,
+                    .pPushConstantRanges = &push_constant
+                };
+
+                VkPipelineLayout pipeline_layout;
+                VK_CHECK(vkCreatePipelineLayout(this->device, &layout_info, nullptr, &pipeline_layout));
+
+                VkShaderModule cull_shader;
+                Vulkan::load_shader_module("../shaders/cull.comp.spv", this->device, &cull_shader);
+                this->cull_pipeline = Vulkan::create_compute_pipeline(this->device, pipeline_layout, cull_shader, this->pipeline_cache.get_handle());
+                vkDestroyShaderModule(this->device, cull_shader, nullptr);
+
+                // Same set and push constants so both share the layout
+                VkShaderModule cluster_cull_shader;
+                Vulkan::load_shader_module("../shaders/cluster_cull.comp.spv", this->device, &cluster_cull_shader);
+                this->cluster_cull_pipeline = Vulkan::create_compute_pipeline(this->device, pipeline_layout, cluster_cull_shader, this->pipeline_cache.get_handle());
+                vkDestroyShaderModule(this->device, cluster_cull_shader, nullptr);
+            }
+        }
+
+        void Renderer::deinit_compute_pipelines()
+        {
+            vkDestroyPipeline(this->device, this->cull_pipeline.handle, nullptr);
+            vkDestroyPipeline(this->device, this->cluster_cull_pipeline.handle, nullptr);
+            vkDestroyPipelineLayout(this->device, this->cull_pipeline.layout, nullptr);
+            vkDestroyDescriptorSetLayout(this->device, this->cull_layout, nullptr);
         }
 
         void Renderer::init_vulkan()
@@ -298,23 +820,41 @@ namespace Twilight
 
             VkPhysicalDeviceVulkan12Features features12 = {
                 .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+                .drawIndirectCount = true,
                 .descriptorIndexing = true,
+                .shaderSampledImageArrayNonUniformIndexing = true,          // Bindless texture table
+                .descriptorBindingSampledImageUpdateAfterBind = true,
+                .descriptorBindingUpdateUnusedWhilePending = true,
+                .descriptorBindingPartiallyBound = true,
+                .runtimeDescriptorArray = true,
+                .timelineSemaphore = true,              // Upload batches
                 .bufferDeviceAddress = true
             };
-    
+
+            // Indirect commands use firstInstance to find their transform. Cooked textures are BC1/BC5/BC7
+            VkPhysicalDeviceFeatures features = {
+                .multiDrawIndirect = true,
+                .drawIndirectFirstInstance = true,
+                .textureCompressionBC = true
+            };
+    
             vkb::PhysicalDeviceSelector selector(instance);
             auto gpu = selector.set_minimum_version(1, 3)
+                                              .set_required_features(features)
                                               .set_required_features_13(features13)
                                               .set_required_features_12(features12)
                                               .set_surface(this->surface)
                                               .select()
                                               .value();
 
+            // Lets VMA report real heap usage and budgets (other processes included) instead of estimating from its own allocations
+            bool memory_budget = gpu.enable_extension_if_present(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
             vkb::DeviceBuilder device_builder(gpu);
             vkb::Device device = device_builder.build().value();
 
             VmaAllocatorCreateInfo allocator_info = {
-                .flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT,
+                .flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT | (memory_budget ? VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT : 0u),
                 .physicalDevice = gpu,
                 .device = device,
                 .instance = instance.instance
@@ -325,6 +865,7 @@ namespace Twilight
             this->instance = instance.instance;
             this->device = device.device;
             this->physical_device = gpu.physical_device;
+            this->pipeline_cache.init(this->device, this->physical_device, PIPELINE_CACHE_DIRECTORY, this->use_pipeline_cache);
             this->debug_messenger = instance.debug_messenger;
             this->graphics_queue = { 
                 .handle = device.get_queue(vkb::QueueType::graphics).value(), 
@@ -341,10 +882,16 @@ namespace Twilight
                     .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO
                 };
 
-                VkFenceCreateInfo fence_info = {
-                    .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-                    .flags = VK_FENCE_CREATE_SIGNALED_BIT
+                VkSemaphoreTypeCreateInfo timeline_info = {
+                    .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+                    .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+                    .initialValue = 0
+                };
+                VkSemaphoreCreateInfo timeline_semaphore_info = {
+                    .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+                    .pNext = &timeline_info
                 };
+                VK_CHECK(vkCreateSemaphore(this->device, &timeline_semaphore_info, nullptr, &this->frame_timeline));
                 
                 VkCommandPoolCreateInfo pool_info = {
                     .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
@@ -352,7 +899,7 @@ namespace Twilight
                     .queueFamilyIndex = this->graphics_queue.family
                 };
 
-                for(int i = 0; i < FRAME_FLIGHT_COUNT; i++)
+                for(int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
                 {
                     VK_CHECK(vkCreateCommandPool(this->device, &pool_info, nullptr, &this->frames_intl[i].pool));
 
@@ -366,12 +913,54 @@ namespace Twilight
                     VK_CHECK(vkAllocateCommandBuffers(this->device, &buffer_info, &this->frames[i].cmd));
                     VK_CHECK(vkCreateSemaphore(this->device, &semaphore_info, nullptr, &this->frames_intl[i].swapchain_semaphore));
                     VK_CHECK(vkCreateSemaphore(this->device, &semaphore_info, nullptr, &this->frames_intl[i].render_semaphore));
-                    VK_CHECK(vkCreateFence(this->device, &fence_info, nullptr, &this->frames_intl[i].render_fence));
+                    this->frames_intl[i].timeline_value = 0;
+                    this->frames_intl[i].input_pending = false;
                 }
+
+                // The presenting thread records a chunk too
+                this->record_pool.init();
+                this->record_chunk_count = this->record_pool.get_thread_count() + 1;
+
+                // Reset as a whole every frame so there's no need for per buffer resets
+                VkCommandPoolCreateInfo record_pool_info = {
+                    .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+                    .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+                    .queueFamilyIndex = this->graphics_queue.family
+                };
+
+                for(int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+                {
+                    this->frames_intl[i].record_pools.resize(this->record_chunk_count);
+                    this->frames[i].record_cmds.resize(this->record_chunk_count);
+                    for(uint32_t chunk = 0; chunk < this->record_chunk_count; chunk++)
+                    {
+                        VK_CHECK(vkCreateCommandPool(this->device, &record_pool_info, nullptr, &this->frames_intl[i].record_pools[chunk]));
+
+                        VkCommandBufferAllocateInfo buffer_info = {
+                            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                            .commandPool = this->frames_intl[i].record_pools[chunk],
+                            .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+                            .commandBufferCount = 1
+                        };
+                        VK_CHECK(vkAllocateCommandBuffers(this->device, &buffer_info, &this->frames[i].record_cmds[chunk]));
+                    }
+                }
+            }
+        }
+
+        static VkPresentModeKHR to_vk_present_mode(PresentMode mode)
+        {
+            switch(mode)
+            {
+                case PresentMode::FIFO_RELAXED: return VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+                case PresentMode::MAILBOX: return VK_PRESENT_MODE_MAILBOX_KHR;
+                case PresentMode::IMMEDIATE: return VK_PRESENT_MODE_IMMEDIATE_KHR;
+                default: return VK_PRESENT_MODE_FIFO_KHR;
             }
         }
 
-        void Renderer::create_swapchain(uint32_t width, uint32_t height)
+        // Passing the swapchain being replaced lets the driver hand its resources over instead of starting from scratch
+        void Renderer::create_swapchain(uint32_t width, uint32_t height, VkSwapchainKHR old_swapchain)
         {
             this->swapchain.format = VK_FORMAT_R8G8B8A8_SRGB;
             vkb::SwapchainBuilder swapchain_builder(this->physical_device, this->device, this->surface);
@@ -380,19 +969,45 @@ namespace Twilight
                 .colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR
             };
 
+            VkPresentModeKHR desired_present_mode = to_vk_present_mode(this->present_mode);
             vkb::Swapchain vkb_swapchain = swapchain_builder.set_desired_format(surface_format)
-                                                    .set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR)
+                                                    .set_desired_present_mode(desired_present_mode)
+                                                    .add_fallback_present_mode(VK_PRESENT_MODE_FIFO_KHR)
                                                     .set_desired_extent(width, height)
+                                                    .set_old_swapchain(old_swapchain)
                                                     .add_image_usage_flags(VK_IMAGE_USAGE_TRANSFER_DST_BIT)
                                                     .build()
                                                     .value();
 
+            this->active_present_mode = vkb_swapchain.present_mode;
+            if(this->active_present_mode != desired_present_mode)
+            {
+                std::cout << "Present mode " << string_VkPresentModeKHR(desired_present_mode) << " isn't supported, using FIFO" << std::endl;
+            }
+
             this->swapchain.extent = vkb_swapchain.extent;
             this->swapchain.handle = vkb_swapchain.swapchain;
             this->swapchain.images = vkb_swapchain.get_images().value();
             this->swapchain.views = vkb_swapchain.get_image_views().value();
         }
 
+        // Nothing waits for the device. The old swapchain, views and depth buffer are retired until every frame submitted with
+        // them has finished. Only ever called between frames, so frame_number is the last frame that could be using them.
+        // False while the window is minimized, there's nothing to create a swapchain for
+        bool Renderer::recreate_swapchain()
+        {
+            int width, height;
+            glfwGetFramebufferSize(this->window, &width, &height);
+            if(width == 0 || height == 0) return false;
+
+            this->retired_swapchains.push_back({ this->swapchain.handle, this->swapchain.views, this->depth_buffer, this->frame_number });
+            create_swapchain(width, height, this->swapchain.handle);
+            // A new present mode can come with a different image count
+            ImGui_ImplVulkan_SetMinImageCount(static_cast<uint32_t>(this->swapchain.images.size()));
+            this->depth_buffer = Vulkan::create_image(this->device, this->allocator, {this->swapchain.extent.width, this->swapchain.extent.height, 1}, VK_FORMAT_D32_SFLOAT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT);
+            return true;
+        }
+
         void Renderer::destroy_swapchain()
         {
             vkDestroySwapchainKHR(this->device, this->swapchain.handle, nullptr);
@@ -445,9 +1060,10 @@ namespace Twilight
                 .Queue = this->graphics_queue.handle,
                 .DescriptorPool = this->imgui_pool,
                 .MinImageCount = static_cast<uint32_t>(this->swapchain.images.size()),
-                .ImageCount = static_cast<uint32_t>(this->swapchain.images.size()),
+                // ImGui cycles its vertex and index buffers through ImageCount and never waits on them, so it has to cover every frame that can be in flight
+                .ImageCount = std::max<uint32_t>(static_cast<uint32_t>(this->swapchain.images.size()), MAX_FRAMES_IN_FLIGHT),
                 .MSAASamples = VK_SAMPLE_COUNT_1_BIT,
-                .PipelineCache = VK_NULL_HANDLE,
+                .PipelineCache = this->pipeline_cache.get_handle(),
                 .UseDynamicRendering = true
             };
 
@@ -461,253 +1077,1053 @@ namespace Twilight
             ImGui_ImplVulkan_CreateFontsTexture();
         }
 
-        void Renderer::deinit_vulkan()
-        {
+        void Renderer::deinit_vulkan()
+        {
+            this->record_pool.destroy();
+
+            for(int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+            {
+                vkDestroyCommandPool(this->device, this->frames_intl[i].pool, nullptr);
+                for(VkCommandPool record_pool : this->frames_intl[i].record_pools)
+                {
+                    vkDestroyCommandPool(this->device, record_pool, nullptr);
+                }
+                vkDestroySemaphore(this->device, this->frames_intl[i].render_semaphore, nullptr);
+                vkDestroySemaphore(this->device, this->frames_intl[i].swapchain_semaphore, nullptr);
+            }
+            vkDestroySemaphore(this->device, this->frame_timeline, nullptr);
+
+            vmaDestroyAllocator(this->allocator);
+            vkDestroyDevice(this->device, nullptr);
+            vkb::destroy_debug_utils_messenger(this->instance, this->debug_messenger);
+            vkDestroySurfaceKHR(this->instance, this->surface, nullptr);
+            vkDestroyInstance(this->instance, nullptr);
+        }
+
+        void Renderer::deinit_imgui()
+        {
+            ImGui_ImplVulkan_Shutdown();
+            ImGui_ImplGlfw_Shutdown();
+            ImGui::DestroyContext();
+            vkDestroyDescriptorPool(this->device, this->imgui_pool, nullptr);
+        }
+
+
+        // Hardcoded for  "phong" model with one diffuse texture right now
+        // Allow for different material types
+        uint32_t Renderer::load_material(std::vector<MaterialConstantBinding> constant_bindings, std::vector<MaterialTextureBinding> texture_bindings)
+        {
+
+            /*
+                allocate_descriptor()
+
+                allocate_resources()
+
+                update_descriptor()
+
+                add_material_to_vector_or_something()
+            */
+
+            if(texture_bindings.size() < 1 && texture_bindings[0].type != MaterialTextureType::BASE_COLOR)
+            {
+                std::cout << "TEST: first texture was not a diffuse" << std::endl;
+                return 0;
+            }
+
+            assert(texture_bindings[0].data != nullptr);
+
+            // An image that's already on the gpu is shared instead of uploaded again
+            uint64_t content_hash = texture_bindings[0].content_hash;
+            if(content_hash != 0)
+            {
+                std::lock_guard<std::mutex> lock(this->resource_mutex);
+                std::unordered_map<uint64_t, uint32_t>::iterator texture = this->texture_lookup.find(content_hash);
+                if(texture != this->texture_lookup.end())
+                {
+                    return acquire_material(&this->phong_pipeline, texture->second);
+                }
+            }
+
+            // Left in SHADER_READ_ONLY_OPTIMAL by the upload. Whatever mips the binding doesn't carry are generated
+            VkFormat format = texture_bindings[0].format == VK_FORMAT_UNDEFINED ? VK_FORMAT_R8G8B8A8_SRGB : texture_bindings[0].format;
+            Image diffuse_texture = create_image(texture_bindings[0].data, VkExtent3D{texture_bindings[0].width, texture_bindings[0].height, 1}, format, VK_IMAGE_USAGE_SAMPLED_BIT,
+                                                 true, texture_bindings[0].mip_levels);
+
+            std::lock_guard<std::mutex> lock(this->resource_mutex);
+            // Another thread may have uploaded the same image meanwhile. Its upload can still be pending so this one is retired
+            // rather than destroyed
+            std::unordered_map<uint64_t, uint32_t>::iterator texture = content_hash != 0 ? this->texture_lookup.find(content_hash) : this->texture_lookup.end();
+            if(texture != this->texture_lookup.end())
+            {
+                retire(diffuse_texture, UINT32_MAX, UINT32_MAX);
+                return acquire_material(&this->phong_pipeline, texture->second);
+            }
+
+            uint32_t texture_index = register_texture(diffuse_texture, content_hash);
+            if(texture_index == 0)
+            {
+                retire(diffuse_texture, UINT32_MAX, UINT32_MAX);
+            }
+            return acquire_material(&this->phong_pipeline, texture_index);
+        }
+
+
+        // TODO: Think about how to refactor this because not the best rn
+        void Renderer::draw(const std::shared_ptr<SceneNode> node)
+        {
+            node->last_drawn_frame = this->frame_number;
+            for(const Mesh& mesh : node->meshes)
+            {
+                if(mesh.index_count == 0) continue;
+                this->draw_list.push_back({mesh, node->world_matrix});
+            }
+
+            for(const std::shared_ptr<SceneNode> child : node->children)
+            {
+                draw(child);
+            }
+        }
+
+        void Renderer::present()
+        {
+            InternalFrameData* internal_data = &this->frames_intl[this->frame_count];
+            FrameData* frame = &this->frames[this->frame_count];
+
+            // Temporary
+            ImGui_ImplVulkan_NewFrame();
+            ImGui_ImplGlfw_NewFrame();
+            ImGui::NewFrame();
+            ImGui::ShowDemoWindow();
+
+            ImGui::Begin("Renderer Stats");
+            ImGui::Checkbox("GPU driven", &this->gpu_driven);
+            ImGui::Checkbox("Vertex pulling", &this->vertex_pulling);
+            ImGui::Checkbox("Cluster culling", &this->cluster_culling);
+            ImGui::Checkbox("Parallel recording", &this->parallel_recording);
+            const char* present_mode_names[] = { "FIFO", "FIFO relaxed", "Mailbox", "Immediate" };
+            int present_mode = (int)this->present_mode;
+            if(ImGui::Combo("Present mode", &present_mode, present_mode_names, 4))
+            {
+                set_present_mode((PresentMode)present_mode);
+            }
+            ImGui::Checkbox("Latency limiter", &this->latency_limiter);
+            int frames_in_flight = (int)this->frames_in_flight;
+            if(ImGui::SliderInt("Frames in flight", &frames_in_flight, 1, MAX_FRAMES_IN_FLIGHT))
+            {
+                set_frames_in_flight((uint32_t)frames_in_flight);
+            }
+            ImGui::Text("Frame wait: %.3f ms", this->stats.wait_ms);
+            ImGui::Text("Input latency: %.2f ms", this->stats.input_latency_ms);
+            ImGui::Text("Draw recording: %.3f ms (%u secondary buffers)", this->stats.record_ms, this->stats.secondary_count);
+            ImGui::Text("Draws: %u (%u instances)", this->stats.draw_count, this->stats.instance_count);
+            ImGui::Text("Clusters: %u", this->stats.cluster_count);
+            ImGui::Text("Pipeline binds: %u (skipped %u)", this->stats.pipeline_binds, this->stats.pipeline_binds_skipped);
+            ImGui::Text("Descriptor set binds: %u (skipped %u)", this->stats.descriptor_binds, this->stats.descriptor_binds_skipped);
+            ImGui::Text("Vertex buffer binds: %u (skipped %u)", this->stats.vertex_buffer_binds, this->stats.vertex_buffer_binds_skipped);
+            ImGui::Text("Index buffer binds: %u (skipped %u)", this->stats.index_buffer_binds, this->stats.index_buffer_binds_skipped);
+            UploadManager::Stats upload_stats = get_upload_stats();
+            ImGui::Text("Staging: %.1f / %.1f MB (high water %.1f MB)", upload_stats.staging_used / (1024.0 * 1024.0), upload_stats.staging_capacity / (1024.0 * 1024.0), 
+                        upload_stats.staging_high_water / (1024.0 * 1024.0));
+            ImGui::Text("Uploads: %.1f MB in %u batches, %u stalls, %u overflowed", upload_stats.uploaded_bytes / (1024.0 * 1024.0), upload_stats.batches_submitted, 
+                        upload_stats.stalls, upload_stats.overflow_uploads);
+            MemoryBudget memory = get_memory_budget();
+            ImGui::Text("Device memory: %.1f / %.1f MB", memory.usage / (1024.0 * 1024.0), memory.budget / (1024.0 * 1024.0));
+            ImGui::End();
+
+            if(this->swapchain_dirty && recreate_swapchain())
+            {
+                this->swapchain_dirty = false;
+            }
+
+            this->stats = {};
+            // Minimized, or the swapchain couldn't be rebuilt. Nothing is submitted so the frame never happened
+            if(this->swapchain_dirty || !frame_begin(frame, internal_data))
+            {
+                ImGui::EndFrame();
+                this->draw_list.clear();
+                // The next wait_frame has to run again, the frame it waited for was never used
+                this->frame_waited = false;
+
+                // Sleep until the window is restored instead of spinning through empty frames while minimized
+                int width, height;
+                glfwGetFramebufferSize(this->window, &width, &height);
+                while((width == 0 || height == 0) && !glfwWindowShouldClose(this->window))
+                {
+                    glfwWaitEvents();
+                    glfwGetFramebufferSize(this->window, &width, &height);
+                }
+                return;
+            }
+            this->stats.wait_ms = this->frame_wait_ms;
+            this->stats.input_latency_ms = this->input_latency_ms;
+
+            // Loader threads wait for the frame to be recorded and submitted. The transfer queue can be the graphics queue
+            std::lock_guard<std::mutex> lock(this->resource_mutex);
+            reclaim_retired(false);
+
+            // Submits whatever was uploaded since last frame and takes ownership of it on the graphics queue
+            frame->upload_wait = this->upload_manager.record_acquires(frame->cmd);
+
+            // Bind lights
+            /*
+                The descriptor set will already be made and the data will already be populated so all you need to do is bind the descriptor set when binding the pipeline.
+                When you add a light to the renderer it will update the buffers for you and all of that so no need to worry about that here... just bind the descriptor set at the right time
+            */
+
+            std::chrono::high_resolution_clock::time_point record_start = std::chrono::high_resolution_clock::now();
+
+            // Culling has to be recorded outside of the render pass. The CPU path is batched first so it's known whether the pass
+            // will be made of secondary command buffers
+            bool parallel = false;
+            if(this->gpu_driven)
+            {
+                record_gpu_cull(frame);
+            }
+            else
+            {
+                sort_cpu_draws(frame);
+                parallel = this->parallel_recording && this->record_chunk_count > 1 && this->cpu_batches.size() >= PARALLEL_RECORD_MIN_BATCHES;
+            }
+
+            begin_main_pass(frame, parallel);
+
+            if(this->gpu_driven)
+            {
+                record_gpu_draws(frame);
+            }
+            else
+            {
+                record_cpu_draws(frame, internal_data, parallel);
+            }
+
+            this->stats.record_ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - record_start).count();
+
+            // Horribly inefficient and a sin against computers but for now this is okay until something better is figured out
+            this->draw_list.clear();
+
+            vkCmdEndRendering(frame->cmd);
+
+            draw_gui();
+
+            frame_end(frame, internal_data);
+            this->frame_number++;
+        }
+
+        void Renderer::sort_cpu_draws(FrameData* frame)
+        {
+            // Sort by pipeline -> mesh -> depth so consecutive draws share as much state as possible.
+            // Materials are read from the instance data so they don't break up batches and get left out of the key
+            this->render_queue.clear();
+            for(uint32_t draw_idx = 0; draw_idx < this->draw_list.size(); draw_idx++)
+            {
+                const DrawData& draw_data = this->draw_list[draw_idx];
+                GraphicsPipeline* pipeline = resolve_pipeline(draw_data.mesh);
+
+                // first_index is unique per mesh and index type. Hashed down to 19 bits, a collision only splits an instanced draw.
+                // The top bit is the index type so 16 and 32 bit meshes are grouped and the index buffer is rebound at most once per pipeline
+                uint32_t mesh_key = (uint32_t)(((uint64_t)draw_data.mesh.first_index * 0x9E3779B97F4A7C15ull) >> 45);
+                mesh_key |= (draw_data.mesh.index_type == VK_INDEX_TYPE_UINT16 ? 1u : 0u) << 19;
+
+                this->render_queue.push(RenderQueue::make_key(pipeline->sort_id, 0, mesh_key, depth_key(draw_data.transform)), draw_idx);
+            }
+            this->render_queue.sort();
+
+            reserve_instances(frame, static_cast<uint32_t>(this->draw_list.size()));
+
+            // Runs of the same mesh + pipeline are collapsed into one instanced draw. Material is per instance so only the pipeline has to match
+            const std::vector<RenderQueue::Entry>& entries = this->render_queue.get_entries();
+            this->cpu_batches.clear();
+            for(uint32_t entry_idx = 0; entry_idx < entries.size();)
+            {
+                const Mesh& mesh = this->draw_list[entries[entry_idx].index].mesh;
+                GraphicsPipeline* pipeline = resolve_pipeline(mesh);
+                uint32_t first_entry = entry_idx++;
+                while(entry_idx < entries.size())
+                {
+                    const Mesh& instance_mesh = this->draw_list[entries[entry_idx].index].mesh;
+                    if(instance_mesh.first_index != mesh.first_index || instance_mesh.vertex_offset != mesh.vertex_offset ||
+                       instance_mesh.index_count != mesh.index_count || instance_mesh.index_type != mesh.index_type || resolve_pipeline(instance_mesh) != pipeline)
+                    {
+                        break;
+                    }
+                    entry_idx++;
+                }
+                this->cpu_batches.push_back({pipeline, first_entry, entry_idx - first_entry});
+            }
+        }
+
+        // Records a range of cpu_batches and writes their instances. Batches own disjoint instance ranges so chunks can run concurrently
+        void Renderer::record_cpu_batches(RecordState& state, FrameData* frame, uint32_t first_batch, uint32_t batch_count)
+        {
+            if(batch_count == 0) return;
+
+            InstanceData* instances = (InstanceData*)frame->instance_buffer.info.pMappedData;
+            const std::vector<RenderQueue::Entry>& entries = this->render_queue.get_entries();
+
+            bind_geometry(state);
+            for(uint32_t batch_idx = first_batch; batch_idx < first_batch + batch_count; batch_idx++)
+            {
+                const CpuBatch& batch = this->cpu_batches[batch_idx];
+                const Mesh& mesh = this->draw_list[entries[batch.first_entry].index].mesh;
+                bind_pipeline(state, batch.pipeline);
+                bind_index_buffer(state, mesh.index_type);
+                glm::mat4 dequantize = dequantize_matrix(mesh.quantization);
+
+                for(uint32_t entry_idx = batch.first_entry; entry_idx < batch.first_entry + batch.entry_count; entry_idx++)
+                {
+                    const DrawData& instance_data = this->draw_list[entries[entry_idx].index];
+                    // Same mesh so the same quantization. The normal matrix doesn't include it since normals aren't quantized by position
+                    instances[entry_idx] = {
+                        .model = instance_data.transform * dequantize,
+                        .norm_mat = glm::transpose(instance_data.transform),
+                        .material_index = instance_data.mesh.material_index,
+                        .vertex_format = static_cast<uint32_t>(instance_data.mesh.vertex_format)
+                    };
+                }
+
+                vkCmdDrawIndexed(state.cmd, mesh.index_count, batch.entry_count, mesh.first_index, mesh.vertex_offset, batch.first_entry);
+                state.stats.draw_count++;
+            }
+        }
+
+        static void accumulate_stats(RenderStats& total, const RenderStats& stats)
+        {
+            total.draw_count += stats.draw_count;
+            total.pipeline_binds += stats.pipeline_binds;
+            total.pipeline_binds_skipped += stats.pipeline_binds_skipped;
+            total.descriptor_binds += stats.descriptor_binds;
+            total.descriptor_binds_skipped += stats.descriptor_binds_skipped;
+            total.vertex_buffer_binds += stats.vertex_buffer_binds;
+            total.index_buffer_binds += stats.index_buffer_binds;
+        }
+
+        void Renderer::record_cpu_draws(FrameData* frame, InternalFrameData* internal_data, bool parallel)
+        {
+            uint32_t batch_count = static_cast<uint32_t>(this->cpu_batches.size());
+            if(!parallel)
+            {
+                RecordState state = { frame->cmd, nullptr, VK_INDEX_TYPE_MAX_ENUM, {} };
+                record_cpu_batches(state, frame, 0, batch_count);
+                accumulate_stats(this->stats, state.stats);
+            }
+            else
+            {
+                VkCommandBufferInheritanceRenderingInfo rendering_info = {
+                    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO,
+                    .colorAttachmentCount = 1,
+                    .pColorAttachmentFormats = &this->swapchain.format,
+                    .depthAttachmentFormat = this->depth_buffer.format,
+                    .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT
+                };
+                VkCommandBufferInheritanceInfo inheritance_info = {
+                    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+                    .pNext = &rendering_info
+                };
+                VkCommandBufferBeginInfo begin_info = {
+                    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+                    .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+                    .pInheritanceInfo = &inheritance_info
+                };
+
+                // Contiguous ranges so executing the chunks in order keeps the sort order
+                uint32_t chunk_count = std::min(this->record_chunk_count, batch_count);
+                std::vector<RecordState> states(chunk_count);
+                this->record_pool.parallel_for(chunk_count, [&](uint32_t chunk)
+                {
+                    // frame_begin waited for the slot's last submit so nothing from this pool is still executing
+                    VK_CHECK(vkResetCommandPool(this->device, internal_data->record_pools[chunk], 0));
+                    VkCommandBuffer cmd = frame->record_cmds[chunk];
+                    VK_CHECK(vkBeginCommandBuffer(cmd, &begin_info));
+
+                    states[chunk] = { cmd, nullptr, VK_INDEX_TYPE_MAX_ENUM, {} };
+                    uint32_t first_batch = (uint32_t)((uint64_t)batch_count * chunk / chunk_count);
+                    uint32_t last_batch = (uint32_t)((uint64_t)batch_count * (chunk + 1) / chunk_count);
+                    record_cpu_batches(states[chunk], frame, first_batch, last_batch - first_batch);
+
+                    VK_CHECK(vkEndCommandBuffer(cmd));
+                });
+
+                vkCmdExecuteCommands(frame->cmd, chunk_count, frame->record_cmds.data());
+                for(const RecordState& state : states)
+                {
+                    accumulate_stats(this->stats, state.stats);
+                }
+                this->stats.secondary_count = chunk_count;
+            }
+
+            uint32_t instance_count = static_cast<uint32_t>(this->draw_list.size());
+            this->stats.instance_count = instance_count;
+            if(this->stats.draw_count > 0)
+            {
+                this->stats.vertex_buffer_binds_skipped = this->stats.vertex_buffer_binds > 0 ? this->stats.draw_count - this->stats.vertex_buffer_binds : 0;
+                this->stats.index_buffer_binds_skipped = this->stats.draw_count - this->stats.index_buffer_binds;
+            }
+            if(instance_count > 0)
+            {
+                VK_CHECK(vmaFlushAllocation(this->allocator, frame->instance_buffer.allocation, 0, instance_count * sizeof(InstanceData)));
+            }
+        }
+
+        void Renderer::record_gpu_cull(FrameData* frame)
+        {
+            uint32_t object_count = static_cast<uint32_t>(this->draw_list.size());
+            bool clusters = this->cluster_culling;
+
+            // Counting pass to size each pipeline + index type's range of indirect commands.
+            // With cluster culling every meshlet can become its own command
+            uint32_t command_count = 0;
+            this->gpu_buckets.clear();
+            this->pipeline_buckets.assign(512, UINT32_MAX);
+            for(const DrawData& draw_data : this->draw_list)
+            {
+                GraphicsPipeline* pipeline = resolve_pipeline(draw_data.mesh);
+                uint32_t& bucket = this->pipeline_buckets[(pipeline->sort_id & 0xFF) * 2 + (draw_data.mesh.index_type == VK_INDEX_TYPE_UINT16 ? 1 : 0)];
+                if(bucket == UINT32_MAX)
+                {
+                    bucket = static_cast<uint32_t>(this->gpu_buckets.size());
+                    this->gpu_buckets.push_back({pipeline, draw_data.mesh.index_type, 0, 0});
+                }
+                uint32_t draw_count = clusters ? std::max(draw_data.mesh.meshlet_count, 1u) : 1;
+                this->gpu_buckets[bucket].max_draw_count += draw_count;
+                command_count += draw_count;
+            }
+
+            uint32_t bucket_count = static_cast<uint32_t>(this->gpu_buckets.size());
+            reserve_gpu_draws(frame, object_count, command_count, bucket_count);
+            if(object_count == 0) return;
+
+            BucketData* buckets = (BucketData*)frame->bucket_buffer.info.pMappedData;
+            uint32_t first_command = 0;
+            for(uint32_t bucket = 0; bucket < bucket_count; bucket++)
+            {
+                buckets[bucket] = {0, first_command};
+                this->gpu_buckets[bucket].first_command = first_command;
+                first_command += this->gpu_buckets[bucket].max_draw_count;
+            }
+
+            ObjectData* objects = (ObjectData*)frame->object_buffer.info.pMappedData;
+            for(uint32_t object = 0; object < object_count; object++)
+            {
+                const DrawData& draw_data = this->draw_list[object];
+                objects[object] = {
+                    .model = draw_data.transform,
+                    .bounds = draw_data.mesh.bounds,
+                    .quantization_min = glm::vec4(draw_data.mesh.quantization.min, 0.0f),
+                    .quantization_extent = glm::vec4(draw_data.mesh.quantization.extent, 0.0f),
+                    .first_index = draw_data.mesh.first_index,
+                    .index_count = draw_data.mesh.index_count,
+                    .vertex_offset = draw_data.mesh.vertex_offset,
+                    .bucket = this->pipeline_buckets[(resolve_pipeline(draw_data.mesh)->sort_id & 0xFF) * 2 + (draw_data.mesh.index_type == VK_INDEX_TYPE_UINT16 ? 1 : 0)],
+                    .material_index = draw_data.mesh.material_index,
+                    .vertex_format = static_cast<uint32_t>(draw_data.mesh.vertex_format)
+                };
+            }
+
+            uint32_t cluster_count = 0;
+            if(clusters)
+            {
+                ClusterData* cluster_data = (ClusterData*)frame->cluster_buffer.info.pMappedData;
+                for(uint32_t object = 0; object < object_count; object++)
+                {
+                    const Mesh& mesh = this->draw_list[object].mesh;
+                    if(mesh.meshlet_count == 0)
+                    {
+                        cluster_data[cluster_count++] = {object | CLUSTER_WRITES_INSTANCE, UINT32_MAX};
+                        continue;
+                    }
+
+                    for(uint32_t meshlet = 0; meshlet < mesh.meshlet_count; meshlet++)
+                    {
+                        cluster_data[cluster_count++] = {meshlet == 0 ? object | CLUSTER_WRITES_INSTANCE : object, mesh.first_meshlet + meshlet};
+                    }
+                }
+                VK_CHECK(vmaFlushAllocation(this->allocator, frame->cluster_buffer.allocation, 0, cluster_count * sizeof(ClusterData)));
+            }
+            this->stats.cluster_count = cluster_count;
+
+            VK_CHECK(vmaFlushAllocation(this->allocator, frame->bucket_buffer.allocation, 0, bucket_count * sizeof(BucketData)));
+            VK_CHECK(vmaFlushAllocation(this->allocator, frame->object_buffer.allocation, 0, object_count * sizeof(ObjectData)));
+
+            // Gribb/Hartmann plane extraction. Near plane uses the -w..w convention which is conservative for 0..1 depth
+            CullConstants constants = {};
+            glm::mat4 view_proj = this->global_ubo_data.projection * this->global_ubo_data.view;
+            glm::vec4 rows[4];
+            for(int row = 0; row < 4; row++)
+            {
+                rows[row] = glm::vec4(view_proj[0][row], view_proj[1][row], view_proj[2][row], view_proj[3][row]);
+            }
+            constants.planes[0] = rows[3] + rows[0];
+            constants.planes[1] = rows[3] - rows[0];
+            constants.planes[2] = rows[3] + rows[1];
+            constants.planes[3] = rows[3] - rows[1];
+            constants.planes[4] = rows[3] + rows[2];
+            constants.planes[5] = rows[3] - rows[2];
+            for(glm::vec4& plane : constants.planes)
+            {
+                plane /= glm::length(glm::vec3(plane));
+            }
+            constants.camera_position = glm::inverse(this->global_ubo_data.view)[3];
+            constants.object_count = clusters ? cluster_count : object_count;
+
+            const ComputePipeline& pipeline = clusters ? this->cluster_cull_pipeline : this->cull_pipeline;
+            vkCmdBindPipeline(frame->cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.handle);
+            vkCmdBindDescriptorSets(frame->cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.layout, 0, 1, &frame->cull_set, 0, nullptr);
+            vkCmdPushConstants(frame->cmd, pipeline.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullConstants), &constants);
+            vkCmdDispatch(frame->cmd, (constants.object_count + 63) / 64, 1, 1);
+
+            Vulkan::Cmd::memory_barrier(frame->cmd, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                                        VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT);
+        }
+
+        void Renderer::record_gpu_draws(FrameData* frame)
+        {
+            if(this->gpu_buckets.empty()) return;
+
+            // A handful of indirect draws, not worth splitting across threads
+            RecordState state = { frame->cmd, nullptr, VK_INDEX_TYPE_MAX_ENUM, {} };
+            bind_geometry(state);
+
+            for(uint32_t bucket = 0; bucket < this->gpu_buckets.size(); bucket++)
+            {
+                const GpuBucket& gpu_bucket = this->gpu_buckets[bucket];
+                bind_pipeline(state, gpu_bucket.pipeline);
+                bind_index_buffer(state, gpu_bucket.index_type);
+                vkCmdDrawIndexedIndirectCount(frame->cmd, frame->command_buffer.handle, gpu_bucket.first_command * sizeof(VkDrawIndexedIndirectCommand),
+                                              frame->bucket_buffer.handle, bucket * sizeof(BucketData), gpu_bucket.max_draw_count, sizeof(VkDrawIndexedIndirectCommand));
+                state.stats.draw_count++;
+            }
+            accumulate_stats(this->stats, state.stats);
+
+            // Instance count is what was submitted, the cull shader decides what actually gets drawn
+            this->stats.instance_count = static_cast<uint32_t>(this->draw_list.size());
+            this->stats.vertex_buffer_binds_skipped = this->stats.vertex_buffer_binds > 0 ? this->stats.draw_count - 1 : 0;
+            this->stats.index_buffer_binds_skipped = this->stats.draw_count - this->stats.index_buffer_binds;
+        }
+
+        Buffer Renderer::create_buffer(void* data, uint64_t size, VkBufferUsageFlags usage)
+        {
+            Buffer buffer = Vulkan::create_buffer(this->allocator, size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+            std::lock_guard<std::mutex> lock(this->resource_mutex);
+            this->upload_manager.upload_buffer(buffer, 0, data, size);
+            return buffer;
+        }
+
+        void Renderer::destroy_buffer(Buffer& buffer)
+        {
+            Vulkan::destroy_buffer(this->allocator, buffer);
+        }
+        
+        Image Renderer::create_image(void* data, VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mipmapped, uint32_t data_levels)
+        {
+            uint32_t mip_levels = mipmapped ? MipGenerator::get_level_count(size.width, size.height) : 1;
+            data_levels = std::clamp(data_levels, 1u, mip_levels);
+
+            // Formats that can't be linearly blitted get their chain built on the cpu instead. Only 8 bit RGBA is handled there
+            std::vector<uint8_t> chain;
+            if(data_levels < mip_levels && !can_blit_mips(format))
+            {
+                if(format == VK_FORMAT_R8G8B8A8_SRGB || format == VK_FORMAT_R8G8B8A8_UNORM)
+                {
+                    chain = MipGenerator::generate((const uint8_t*)data, size.width, size.height, format == VK_FORMAT_R8G8B8A8_SRGB);
+                    data = chain.data();
+                    data_levels = mip_levels;
+                }
+                else
+                {
+                    mip_levels = data_levels;
+                }
+            }
+
+            VkImageUsageFlags upload_usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | (data_levels < mip_levels ? VK_IMAGE_USAGE_TRANSFER_SRC_BIT : 0);
+            Image image = Vulkan::create_image(this->device, this->allocator, size, format, usage | upload_usage, mip_levels);
+
+            // FIXME: Potential bug if pixel channels != 4
+            uint64_t data_size = 0;
+            for(uint32_t level = 0; level < data_levels; level++)
+            {
+                data_size += Vulkan::get_image_level_size(format, size.width, size.height, level) * size.depth;
+            }
+            std::lock_guard<std::mutex> lock(this->resource_mutex);
+            this->upload_manager.upload_image(image, data, data_size, data_levels);
+            return image;
+        }
+
+        bool Renderer::can_blit_mips(VkFormat format) const
+        {
+            VkFormatProperties properties;
+            vkGetPhysicalDeviceFormatProperties(this->physical_device, format, &properties);
+            VkFormatFeatureFlags required = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+            return (properties.optimalTilingFeatures & required) == required;
+        }
+
+        void Renderer::destroy_image(Image& image)
+        {
+            Vulkan::destroy_image(this->device, this->allocator, image);
+        }
+
+        void Renderer::draw_gui()
+        {
+            ImGui::Render();
+
+            FrameData* frame = &this->frames[this->frame_count];
+            VkRenderingAttachmentInfo imgui_attachment = {
+                .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+                .imageView = this->swapchain.views[frame->swapchain_index],
+                .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                .loadOp = VK_ATTACHMENT_LOAD_OP_LOAD,
+                .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+                .clearValue = {
+                    .color = {0.0, 0.0, 0.0, 1.0}
+                }
+            };
+
+            VkRenderingInfo imgui_render_info = {
+                .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+                .renderArea = VkRect2D{ {0, 0}, {this->swapchain.extent.width, this->swapchain.extent.height} },
+                .layerCount = 1,
+                .colorAttachmentCount = 1,
+                .pColorAttachments = &imgui_attachment
+            }; 
+
+            vkCmdBeginRendering(frame->cmd, &imgui_render_info);
+            ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), frame->cmd);
+            vkCmdEndRendering(frame->cmd);
+        }
+
+        // Picks the variant of the material's pipeline that can read the mesh's vertex format.
+        // Vertex pulling decodes every format in the shader so everything goes through the one pipeline
+        GraphicsPipeline* Renderer::resolve_pipeline(const Mesh& mesh)
+        {
+            GraphicsPipeline* pipeline = this->materials[mesh.material_index].pipeline;
+            if(pipeline != &this->phong_pipeline)
+            {
+                return pipeline;
+            }
+
+            if(this->vertex_pulling)
+            {
+                return &this->phong_pulling_pipeline;
+            }
+
+            return mesh.vertex_format == VertexFormat::PACKED ? &this->phong_packed_pipeline : &this->phong_pipeline;
+        }
+
+        void Renderer::bind_pipeline(RecordState& state, GraphicsPipeline* pipeline)
+        {
+            FrameData* frame = &this->frames[this->frame_count];
+            if(state.bound_pipeline == pipeline)
+            {
+                // Global and bindless sets stay bound for the whole pipeline
+                state.stats.pipeline_binds_skipped++;
+                state.stats.descriptor_binds_skipped += 2;
+                return;
+            }
+
+            state.bound_pipeline = pipeline;
+            vkCmdBindPipeline(state.cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->handle);
 
-            for(int i = 0; i < FRAME_FLIGHT_COUNT; i++)
+            VkViewport viewport = {
+                .x = 0,
+                .y = 0,
+                .width = (float)this->swapchain.extent.width,
+                .height = (float)this->swapchain.extent.height,
+                .minDepth = 0.0f,
+                .maxDepth = 1.0f
+            };
+            VkRect2D scissor = {};
+            scissor.extent = this->swapchain.extent;
+            scissor.offset = VkOffset2D{0, 0};
+            vkCmdSetViewport(state.cmd, 0, 1, &viewport);
+            vkCmdSetScissor(state.cmd, 0, 1, &scissor);
+            state.stats.pipeline_binds++;
+
+            // New pipeline so rebind everything (layouts aren't guaranteed to be compatible between pipelines)
+            VkDescriptorSet sets[] = { frame->global_set, this->bindless_set };
+            vkCmdBindDescriptorSets(state.cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->layout, 0, 2, sets, 0, nullptr);
+            state.stats.descriptor_binds += 2;
+
+            if(pipeline == &this->phong_pulling_pipeline)
             {
-                vkDestroyCommandPool(this->device, this->frames_intl[i].pool, nullptr);
-                vkDestroySemaphore(this->device, this->frames_intl[i].render_semaphore, nullptr);
-                vkDestroySemaphore(this->device, this->frames_intl[i].swapchain_semaphore, nullptr);
-                vkDestroyFence(this->device, this->frames_intl[i].render_fence, nullptr);
+                VertexPullConstants constants = { .vertex_address = this->geometry_pool.get_vertex_address() };
+                vkCmdPushConstants(state.cmd, pipeline->layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(VertexPullConstants), &constants);
             }
-
-            vmaDestroyAllocator(this->allocator);
-            vkDestroyDevice(this->device, nullptr);
-            vkb::destroy_debug_utils_messenger(this->instance, this->debug_messenger);
-            vkDestroySurfaceKHR(this->instance, this->surface, nullptr);
-            vkDestroyInstance(this->instance, nullptr);
         }
 
-        void Renderer::deinit_imgui()
+        // Every mesh lives in the geometry pool so the vertex buffer only gets bound once per frame.
+        // With vertex pulling it isn't needed at all
+        void Renderer::bind_geometry(RecordState& state)
         {
-            ImGui_ImplVulkan_Shutdown();
-            ImGui_ImplGlfw_Shutdown();
-            ImGui::DestroyContext();
-            vkDestroyDescriptorPool(this->device, this->imgui_pool, nullptr);
+            if(!this->vertex_pulling)
+            {
+                VkDeviceSize offsets[] = {0};
+                vkCmdBindVertexBuffers(state.cmd, 0, 1, &this->geometry_pool.get_vertex_buffer().handle, offsets);
+                state.stats.vertex_buffer_binds = 1;
+            }
         }
 
+        // 16 and 32 bit indices share the pool's index buffer, only the type changes
+        void Renderer::bind_index_buffer(RecordState& state, VkIndexType index_type)
+        {
+            if(state.bound_index_type == index_type) return;
 
-        // Hardcoded for  "phong" model with one diffuse texture right now
-        // Allow for different material types
-        uint32_t Renderer::load_material(std::vector<MaterialConstantBinding> constant_bindings, std::vector<MaterialTextureBinding> texture_bindings)
+            vkCmdBindIndexBuffer(state.cmd, this->geometry_pool.get_index_buffer().handle, 0, index_type);
+            state.bound_index_type = index_type;
+            state.stats.index_buffer_binds++;
+        }
+
+        // Grows the frame's instance buffer if needed. Only call once frame_begin has waited for the slot
+        bool Renderer::reserve_instances(FrameData* frame, uint32_t instance_count)
         {
+            if(instance_count <= frame->instance_capacity) return false;
 
-            /*
-                allocate_descriptor()
+            uint32_t capacity = frame->instance_capacity > 0 ? frame->instance_capacity : INITIAL_INSTANCE_CAPACITY;
+            while(capacity < instance_count) capacity *= 2;
 
-                allocate_resources()
+            Vulkan::destroy_buffer(this->allocator, frame->instance_buffer);
+            frame->instance_buffer = Vulkan::create_buffer(this->allocator, capacity * sizeof(InstanceData), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+            frame->instance_capacity = capacity;
 
-                update_descriptor()
+            VkDescriptorBufferInfo buffer_info = {
+                .buffer = frame->instance_buffer.handle,
+                .offset = 0,
+                .range = VK_WHOLE_SIZE
+            };
 
-                add_material_to_vector_or_something()
-            */
+            // The vertex shader reads it and the cull shader writes it
+            VkWriteDescriptorSet write_sets[] = {
+                {
+                    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                    .dstSet = frame->global_set,
+                    .dstBinding = 1,
+                    .descriptorCount = 1,
+                    .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    .pBufferInfo = &buffer_info
+                },
+                {
+                    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                    .dstSet = frame->cull_set,
+                    .dstBinding = 3,
+                    .descriptorCount = 1,
+                    .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    .pBufferInfo = &buffer_info
+                }
+            };
 
-            VkDescriptorSet mat_set = material_set_allocator.allocate(this->device, this->phong_layout);
+            vkUpdateDescriptorSets(this->device, 2, write_sets, 0, nullptr);
+            return true;
+        }
 
-            if(texture_bindings.size() < 1 && texture_bindings[0].type != MaterialTextureType::BASE_COLOR)
+        // Same as reserve_instances but for the GPU driven path's buffers
+        void Renderer::reserve_gpu_draws(FrameData* frame, uint32_t object_count, uint32_t command_count, uint32_t bucket_count)
+        {
+            reserve_instances(frame, object_count);
+
+            if(object_count > frame->object_capacity)
             {
-                std::cout << "TEST: first texture was not a diffuse" << std::endl;
-                return 0;
-            }
+                uint32_t capacity = frame->object_capacity > 0 ? frame->object_capacity : INITIAL_INSTANCE_CAPACITY;
+                while(capacity < object_count) capacity *= 2;
 
-            assert(texture_bindings[0].data != nullptr);
+                Vulkan::destroy_buffer(this->allocator, frame->object_buffer);
+                frame->object_buffer = Vulkan::create_buffer(this->allocator, capacity * sizeof(ObjectData), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+                frame->object_capacity = capacity;
 
-            Image diffuse_texture = Vulkan::create_image(this->device, this->allocator, {this->transfer_cmd, this->transfer_queue.handle, this->transfer_fence}, texture_bindings[0].data, VkExtent3D{texture_bindings[0].width, texture_bindings[0].height, 1}, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_USAGE_SAMPLED_BIT);
+                VkDescriptorBufferInfo object_info = { .buffer = frame->object_buffer.handle, .offset = 0, .range = VK_WHOLE_SIZE };
 
-            Vulkan::transfer_begin(this->device, {this->transfer_cmd, this->transfer_queue.handle, this->transfer_fence});
+                VkWriteDescriptorSet write_set = {
+                    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                    .dstSet = frame->cull_set,
+                    .dstBinding = 0,
+                    .descriptorCount = 1,
+                    .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    .pBufferInfo = &object_info
+                };
 
-            Vulkan::Cmd::transition_image(this->transfer_cmd, diffuse_texture.handle, {VK_ACCESS_2_TRANSFER_WRITE_BIT, 
-                                         VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_2_TRANSFER_BIT, 
-                                         VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL}, { VK_IMAGE_ASPECT_COLOR_BIT, 
-                                         0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS });
+                vkUpdateDescriptorSets(this->device, 1, &write_set, 0, nullptr);
+            }
 
-            Vulkan::transfer_end(this->device, {this->transfer_cmd, this->transfer_queue.handle, this->transfer_fence});
+            // One cluster per command at most so the cluster buffer grows with the command buffer
+            if(command_count > frame->command_capacity)
+            {
+                uint32_t capacity = frame->command_capacity > 0 ? frame->command_capacity : INITIAL_INSTANCE_CAPACITY;
+                while(capacity < command_count) capacity *= 2;
+
+                Vulkan::destroy_buffer(this->allocator, frame->command_buffer);
+                Vulkan::destroy_buffer(this->allocator, frame->cluster_buffer);
+                frame->command_buffer = Vulkan::create_buffer(this->allocator, capacity * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+                frame->cluster_buffer = Vulkan::create_buffer(this->allocator, capacity * sizeof(ClusterData), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+                frame->command_capacity = capacity;
+
+                VkDescriptorBufferInfo command_info = { .buffer = frame->command_buffer.handle, .offset = 0, .range = VK_WHOLE_SIZE };
+                VkDescriptorBufferInfo cluster_info = { .buffer = frame->cluster_buffer.handle, .offset = 0, .range = VK_WHOLE_SIZE };
+
+                VkWriteDescriptorSet write_sets[] = {
+                    {
+                        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                        .dstSet = frame->cull_set,
+                        .dstBinding = 2,
+                        .descriptorCount = 1,
+                        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                        .pBufferInfo = &command_info
+                    },
+                    {
+                        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                        .dstSet = frame->cull_set,
+                        .dstBinding = 5,
+                        .descriptorCount = 1,
+                        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                        .pBufferInfo = &cluster_info
+                    }
+                };
 
-            VkDescriptorImageInfo img_info = {
-                .sampler = this->default_sampler,
-                .imageView = diffuse_texture.view,
-                .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-            };
+                vkUpdateDescriptorSets(this->device, 2, write_sets, 0, nullptr);
+            }
 
-            VkWriteDescriptorSet diffuse_write = {
-                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                .dstSet = mat_set,
-                .dstBinding = 0,
-                .descriptorCount = 1,
-                .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                .pImageInfo = &img_info
-            };
-            vkUpdateDescriptorSets(this->device, 1, &diffuse_write, 0, nullptr);
+            if(bucket_count > frame->bucket_capacity)
+            {
+                uint32_t capacity = frame->bucket_capacity > 0 ? frame->bucket_capacity : 16;
+                while(capacity < bucket_count) capacity *= 2;
+
+                Vulkan::destroy_buffer(this->allocator, frame->bucket_buffer);
+                frame->bucket_buffer = Vulkan::create_buffer(this->allocator, capacity * sizeof(BucketData), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+                frame->bucket_capacity = capacity;
 
-            // TODO: Come up with id system so multiple models can be loaded
-            this->materials.push_back({.pipeline = &this->phong_pipeline, .descriptor_set = mat_set, .buffer = {}, .texture = diffuse_texture});
+                VkDescriptorBufferInfo bucket_info = { .buffer = frame->bucket_buffer.handle, .offset = 0, .range = VK_WHOLE_SIZE };
+
+                VkWriteDescriptorSet write_set = {
+                    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                    .dstSet = frame->cull_set,
+                    .dstBinding = 1,
+                    .descriptorCount = 1,
+                    .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    .pBufferInfo = &bucket_info
+                };
 
-            // return index of material that was just added
-            return this->materials.size() - 1;
+                vkUpdateDescriptorSets(this->device, 1, &write_set, 0, nullptr);
+            }
         }
 
+        // Quantizes view space depth of the transform's origin to 16 bits so closer draws sort first within the same state
+        uint16_t Renderer::depth_key(const glm::mat4& transform) const
+        {
+            const float near_plane = 0.1f, far_plane = 100.0f;
+            glm::vec4 view_pos = this->global_ubo_data.view * transform[3];
+            float depth = glm::clamp((-view_pos.z - near_plane) / (far_plane - near_plane), 0.0f, 1.0f);
+            return (uint16_t)(depth * 65535.0f);
+        }
 
-        // TODO: Think about how to refactor this because not the best rn
-        void Renderer::draw(const std::shared_ptr<SceneNode> node)
+        const RenderStats& Renderer::get_stats() const
         {
-            for(const Mesh& mesh : node->meshes)
-            {
-                this->draw_list.push_back({mesh, node->world_matrix});
-            }
+            return this->stats;
+        }
 
-            for(const std::shared_ptr<SceneNode> child : node->children)
-            {
-                draw(child);
-            }
+        void Renderer::set_gpu_driven(bool enabled)
+        {
+            this->gpu_driven = enabled;
         }
 
-        void Renderer::present()
+        bool Renderer::is_gpu_driven() const
         {
-            InternalFrameData* internal_data = &this->frames_intl[this->frame_count];
-            FrameData* frame = &this->frames[this->frame_count];
+            return this->gpu_driven;
+        }
 
-            // Temporary
-            ImGui_ImplVulkan_NewFrame();
-            ImGui_ImplGlfw_NewFrame();
-            ImGui::NewFrame();
-            ImGui::ShowDemoWindow();
+        void Renderer::set_vertex_pulling(bool enabled)
+        {
+            this->vertex_pulling = enabled;
+        }
 
-            frame_begin(frame, internal_data);
+        bool Renderer::is_vertex_pulling() const
+        {
+            return this->vertex_pulling;
+        }
 
-            this->bound_pipeline = nullptr;
+        uint64_t Renderer::flush_uploads()
+        {
+            std::lock_guard<std::mutex> lock(this->resource_mutex);
+            return this->upload_manager.flush();
+        }
 
-            // Bind lights
-            /*
-                The descriptor set will already be made and the data will already be populated so all you need to do is bind the descriptor set when binding the pipeline.
-                When you add a light to the renderer it will update the buffers for you and all of that so no need to worry about that here... just bind the descriptor set at the right time
-            */
+        bool Renderer::is_upload_complete(uint64_t handle) const
+        {
+            std::lock_guard<std::mutex> lock(this->resource_mutex);
+            return this->upload_manager.is_complete(handle);
+        }
 
-            VkDeviceSize sizes[] = {0};
-            
-            // Draw everything
-            for(const DrawData& draw_data : draw_list)
+        void Renderer::wait_upload(uint64_t handle)
+        {
             {
-                bind_material(this->materials[draw_data.mesh.material_index]);
+                std::lock_guard<std::mutex> lock(this->resource_mutex);
+                this->upload_manager.submit(handle);
+            }
+            // Blocks outside the lock so the render thread and other loaders aren't held up behind the transfer
+            this->upload_manager.wait(handle);
+        }
 
-                // if decide to use descriptors for this eventually then just bind the descriptor set while drawing and obviously update shaders
-                PushConstants push_constants = 
-                {
-                    .model = draw_data.transform,
-                    .norm_mat = glm::transpose(draw_data.transform)
-                };
+        UploadManager::Stats Renderer::get_upload_stats() const
+        {
+            std::lock_guard<std::mutex> lock(this->resource_mutex);
+            return this->upload_manager.get_stats();
+        }
 
-                vkCmdPushConstants(frame->cmd, this->phong_pipeline.layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushConstants), &push_constants);
+        // Summed over the device local heaps. VMA is internally synchronized so this doesn't need the resource mutex
+        MemoryBudget Renderer::get_memory_budget() const
+        {
+            const VkPhysicalDeviceMemoryProperties* properties;
+            vmaGetMemoryProperties(this->allocator, &properties);
+            VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+            vmaGetHeapBudgets(this->allocator, budgets);
 
-                vkCmdBindVertexBuffers(frame->cmd, 0, 1, &draw_data.mesh.vertices.handle, sizes);
-                vkCmdBindIndexBuffer(frame->cmd, draw_data.mesh.indices.handle, 0, VK_INDEX_TYPE_UINT32);
-                vkCmdDrawIndexed(frame->cmd, draw_data.mesh.index_count, 1, 0, 0, 0);
+            MemoryBudget memory = {};
+            for(uint32_t heap = 0; heap < properties->memoryHeapCount; heap++)
+            {
+                if((properties->memoryHeaps[heap].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) == 0) continue;
+                memory.usage += budgets[heap].usage;
+                memory.budget += budgets[heap].budget;
             }
+            return memory;
+        }
 
-            // Horribly inefficient and a sin against computers but for now this is okay until something better is figured out
-            this->draw_list.clear();
-
-            vkCmdEndRendering(frame->cmd);
-
-            draw_gui();
+        uint64_t Renderer::get_frame_number() const
+        {
+            return this->frame_number;
+        }
 
-            frame_end(frame, internal_data);
+        // Slots past the new count just go unused, frame_begin's wait covers a slot being reused sooner than before
+        void Renderer::set_frames_in_flight(uint32_t count)
+        {
+            this->frames_in_flight = std::clamp(count, 1u, (uint32_t)MAX_FRAMES_IN_FLIGHT);
         }
 
-        Buffer Renderer::create_buffer(void* data, uint64_t size, VkBufferUsageFlags usage)
+        uint32_t Renderer::get_frames_in_flight() const
         {
-            return Vulkan::create_buffer(this->device, { this->transfer_cmd, this->transfer_queue.handle, this->transfer_fence }, this->allocator, data, size, usage);
+            return this->frames_in_flight;
         }
 
-        void Renderer::destroy_buffer(Buffer& buffer)
+        void Renderer::set_pipeline_cache(bool enabled)
         {
-            Vulkan::destroy_buffer(this->allocator, buffer);
+            this->use_pipeline_cache = enabled;
         }
-        
-        Image Renderer::create_image(void* data, VkExtent3D size, VkFormat format, VkImageUsageFlags usage)
+
+        void Renderer::set_present_mode(PresentMode mode)
         {
-            return Vulkan::create_image(this->device, this->allocator, {this->transfer_cmd, this->transfer_queue.handle, this->transfer_fence}, data, size, format, usage);
+            if(mode == this->present_mode) return;
+            this->present_mode = mode;
+            this->swapchain_dirty = true;
         }
 
-        void Renderer::destroy_image(Image& image)
+        PresentMode Renderer::get_present_mode() const
         {
-            Vulkan::destroy_image(this->device, this->allocator, image);
+            switch(this->active_present_mode)
+            {
+                case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return PresentMode::FIFO_RELAXED;
+                case VK_PRESENT_MODE_MAILBOX_KHR: return PresentMode::MAILBOX;
+                case VK_PRESENT_MODE_IMMEDIATE_KHR: return PresentMode::IMMEDIATE;
+                default: return PresentMode::FIFO;
+            }
         }
 
-        void Renderer::draw_gui()
+        // Waits for the frame frames_in_flight back and for the slot's last one. After frames_in_flight changes a slot can be
+        // reused sooner than that, so both are needed
+        void Renderer::wait_frame()
         {
-            ImGui::Render();
+            if(this->frame_waited) return;
 
-            FrameData* frame = &this->frames[this->frame_count];
-            VkRenderingAttachmentInfo imgui_attachment = {
-                .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
-                .imageView = this->swapchain.views[frame->swapchain_index],
-                .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-                .loadOp = VK_ATTACHMENT_LOAD_OP_LOAD,
-                .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-                .clearValue = {
-                    .color = {0.0, 0.0, 0.0, 1.0}
+            InternalFrameData* internal_data = &this->frames_intl[this->frame_count];
+            uint64_t next_value = this->frame_number + 1;
+            uint64_t wait_value = std::max(internal_data->timeline_value, next_value > this->frames_in_flight ? next_value - this->frames_in_flight : 0);
+            if(this->latency_limiter) wait_value = this->frame_number;
+
+            std::chrono::high_resolution_clock::time_point wait_start = std::chrono::high_resolution_clock::now();
+            if(wait_value > 0)
+            {
+                VkSemaphoreWaitInfo wait_info = {
+                    .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+                    .semaphoreCount = 1,
+                    .pSemaphores = &this->frame_timeline,
+                    .pValues = &wait_value
+                };
+                VK_CHECK(vkWaitSemaphores(this->device, &wait_info, UINT64_MAX));
+            }
+            std::chrono::high_resolution_clock::time_point now = std::chrono::high_resolution_clock::now();
+            this->frame_wait_ms = std::chrono::duration<float, std::milli>(now - wait_start).count();
+
+            // Latest finished frame that had its input marked
+            uint64_t completed = 0;
+            VK_CHECK(vkGetSemaphoreCounterValue(this->device, this->frame_timeline, &completed));
+            uint64_t latest = 0;
+            for(int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+            {
+                InternalFrameData& slot = this->frames_intl[i];
+                if(!slot.input_pending || slot.timeline_value > completed) continue;
+
+                slot.input_pending = false;
+                if(slot.timeline_value > latest)
+                {
+                    latest = slot.timeline_value;
+                    this->input_latency_ms = std::chrono::duration<float, std::milli>(now - slot.input_time).count();
                 }
-            };
+            }
 
-            VkRenderingInfo imgui_render_info = {
-                .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
-                .renderArea = VkRect2D{ {0, 0}, {this->swapchain.extent.width, this->swapchain.extent.height} },
-                .layerCount = 1,
-                .colorAttachmentCount = 1,
-                .pColorAttachments = &imgui_attachment
-            }; 
+            this->frame_waited = true;
+        }
 
-            vkCmdBeginRendering(frame->cmd, &imgui_render_info);
-            ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), frame->cmd);
-            vkCmdEndRendering(frame->cmd);
+        void Renderer::set_latency_limiter(bool enabled)
+        {
+            this->latency_limiter = enabled;
         }
 
-        void Renderer::bind_material(const Material& material)
+        void Renderer::mark_input()
         {
-            FrameData* frame = &this->frames[this->frame_count];
-            if(this->bound_pipeline != material.pipeline)
-            {
-                vkCmdBindPipeline(frame->cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, material.pipeline->handle);
+            this->input_time = std::chrono::high_resolution_clock::now();
+            this->input_marked = true;
+        }
 
-                VkViewport viewport = {
-                    .x = 0,
-                    .y = 0,
-                    .width = (float)this->swapchain.extent.width,
-                    .height = (float)this->swapchain.extent.height,
-                    .minDepth = 0.0f,
-                    .maxDepth = 1.0f
-                };
-                VkRect2D scissor = {};
-                scissor.extent = this->swapchain.extent;
-                scissor.offset = VkOffset2D{0, 0};
-                vkCmdSetViewport(frame->cmd, 0, 1, &viewport);
-                vkCmdSetScissor(frame->cmd, 0, 1, &scissor);
-                this->bound_pipeline = material.pipeline;
-            }
+        void Renderer::set_cluster_culling(bool enabled)
+        {
+            this->cluster_culling = enabled;
+        }
 
-            VkDescriptorSet sets[] = { this->global_set, material.descriptor_set };
-            vkCmdBindDescriptorSets(frame->cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, material.pipeline->layout, 0, 2, sets, 0, nullptr);
+        bool Renderer::is_cluster_culling() const
+        {
+            return this->cluster_culling;
         }
 
+        // Images belong to the texture slots, materials only reference them
         void Renderer::destroy_material(Material& material)
         {
             Vulkan::destroy_buffer(this->allocator, material.buffer);
-            Vulkan::destroy_image(this->device, this->allocator, material.texture);
-            
         }
 
 
-        void Renderer::frame_begin(FrameData* frame, InternalFrameData* internal_data)
+        // False if no swapchain image could be acquired, nothing has been recorded then
+        bool Renderer::frame_begin(FrameData* frame, InternalFrameData* internal_data)
         {
             // Start frame and get swapchain image
-            // Wait for fence to be signaled (if first loop fence is already signaled)
-            VK_CHECK(vkWaitForFences(this->device, 1, &internal_data->render_fence, true, UINT64_MAX));
-            // Here Fence is signaled
-            // Reset Fence to unsignaled
-            VK_CHECK(vkResetFences(this->device, 1, &internal_data->render_fence));
+            wait_frame();
+            this->frame_waited = false;
             // Acquire swapchain image. Swapchain_semaphore will be signaled once it has been acquired
-            VK_CHECK(vkAcquireNextImageKHR(this->device, this->swapchain.handle, UINT64_MAX, internal_data->swapchain_semaphore, nullptr, &frame->swapchain_index));
+            // Out of date means no image was acquired and the semaphore wasn't touched, so it can be retried on a new swapchain.
+            // Suboptimal still acquired one and has to be presented, the swapchain is rebuilt after
+            VkResult acquire_result = vkAcquireNextImageKHR(this->device, this->swapchain.handle, UINT64_MAX, internal_data->swapchain_semaphore, nullptr, &frame->swapchain_index);
+            if(acquire_result == VK_ERROR_OUT_OF_DATE_KHR)
+            {
+                if(!recreate_swapchain())
+                {
+                    this->swapchain_dirty = true;
+                    return false;
+                }
+                acquire_result = vkAcquireNextImageKHR(this->device, this->swapchain.handle, UINT64_MAX, internal_data->swapchain_semaphore, nullptr, &frame->swapchain_index);
+            }
+            if(acquire_result == VK_SUBOPTIMAL_KHR)
+            {
+                this->swapchain_dirty = true;
+            }
+            else if(acquire_result != VK_SUCCESS)
+            {
+                std::cout << "Failed to acquire a swapchain image (" << acquire_result << ")" << std::endl;
+                this->swapchain_dirty = true;
+                return false;
+            }
+
             VK_CHECK(vkResetCommandBuffer(frame->cmd, 0));
             VkCommandBufferBeginInfo cmd_info = {
                 .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
@@ -723,7 +2139,13 @@ namespace Twilight
             Vulkan::Cmd::transition_image(frame->cmd, this->depth_buffer.handle, {VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT, 
                                     VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT, 
                                     VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL}, {VK_IMAGE_ASPECT_DEPTH_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS});
-            
+            return true;
+        }
+
+        // Kept separate from frame_begin so compute work (culling) can be recorded before rendering starts.
+        // With secondary set the pass can only contain vkCmdExecuteCommands
+        void Renderer::begin_main_pass(FrameData* frame, bool secondary)
+        {
             {
                 VkRenderingAttachmentInfo color_attachment_info = {
                     .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
@@ -749,6 +2171,7 @@ namespace Twilight
 
                 VkRenderingInfo render_info = {
                     .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+                    .flags = secondary ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT : 0u,
                     .renderArea = VkRect2D{ {0, 0}, {this->swapchain.extent.width, this->swapchain.extent.height} },
                     .layerCount = 1,
                     .colorAttachmentCount = 1,
@@ -778,34 +2201,57 @@ namespace Twilight
                 .deviceMask = 0
             };
 
-            VkSemaphoreSubmitInfo wait_info = {
-                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
-                .semaphore = internal_data->swapchain_semaphore,
-                .value = 1,
-                .stageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR,
-                .deviceIndex = 0
+            VkSemaphoreSubmitInfo wait_infos[] = {
+                {
+                    .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+                    .semaphore = internal_data->swapchain_semaphore,
+                    .value = 1,
+                    .stageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR,
+                    .deviceIndex = 0
+                },
+                {
+                    // Uploads acquired this frame
+                    .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+                    .semaphore = this->upload_manager.get_semaphore(),
+                    .value = frame->upload_wait,
+                    .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                    .deviceIndex = 0
+                }
             };
 
-            VkSemaphoreSubmitInfo signal_info = {
-                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
-                .semaphore = internal_data->render_semaphore,
-                .value = 1,
-                .stageMask = VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT_KHR,
-                .deviceIndex = 0
+            // Presentation can only wait on a binary semaphore, the timeline is for the cpu and resource retirement
+            internal_data->timeline_value = this->frame_number + 1;
+            internal_data->input_pending = this->input_marked;
+            internal_data->input_time = this->input_time;
+            this->input_marked = false;
+            VkSemaphoreSubmitInfo signal_infos[] = {
+                {
+                    .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+                    .semaphore = internal_data->render_semaphore,
+                    .value = 1,
+                    .stageMask = VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT_KHR,
+                    .deviceIndex = 0
+                },
+                {
+                    .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+                    .semaphore = this->frame_timeline,
+                    .value = internal_data->timeline_value,
+                    .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                    .deviceIndex = 0
+                }
             };
 
             VkSubmitInfo2 submit_info = {
                 .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
-                .waitSemaphoreInfoCount = 1,
-                .pWaitSemaphoreInfos = &wait_info,
+                .waitSemaphoreInfoCount = frame->upload_wait > 0 ? 2u : 1u,
+                .pWaitSemaphoreInfos = wait_infos,
                 .commandBufferInfoCount = 1,
                 .pCommandBufferInfos = &cmd_submit_info,
-                .signalSemaphoreInfoCount = 1,
-                .pSignalSemaphoreInfos = &signal_info
+                .signalSemaphoreInfoCount = 2,
+                .pSignalSemaphoreInfos = signal_infos
             };
 
-            // Submits commands to queue and sets fence to signal when done
-            VK_CHECK(vkQueueSubmit2(this->graphics_queue.handle, 1, &submit_info, internal_data->render_fence));
+            VK_CHECK(vkQueueSubmit2(this->graphics_queue.handle, 1, &submit_info, VK_NULL_HANDLE));
 
             VkPresentInfoKHR present_info = {
                 .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
@@ -816,38 +2262,165 @@ namespace Twilight
                 .pImageIndices = &frame->swapchain_index
             };
 
-            if(vkQueuePresentKHR(this->graphics_queue.handle, &present_info) == VK_ERROR_OUT_OF_DATE_KHR)
+            // This frame was submitted against the current swapchain, so it's only replaced once frame_number covers it
+            VkResult present_result = vkQueuePresentKHR(this->graphics_queue.handle, &present_info);
+            if(present_result == VK_ERROR_OUT_OF_DATE_KHR || present_result == VK_SUBOPTIMAL_KHR)
             {
-                std::cout << "Swapchain out of date, recreating..." << std::endl;
-                destroy_swapchain();
-                int width, height;
-                glfwGetFramebufferSize(this->window, &width, &height);
-                create_swapchain(width, height);
-                wait();
-                destroy_image(this->depth_buffer);
-                this->depth_buffer = Vulkan::create_image(this->device, this->allocator, {this->swapchain.extent.width, this->swapchain.extent.height, 1}, VK_FORMAT_D32_SFLOAT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT);
-                std::cout << "Swapchain recreated" << std::endl;
+                this->swapchain_dirty = true;
+            }
+            else if(present_result != VK_SUCCESS)
+            {
+                std::cout << "Present failed (" << present_result << ")" << std::endl;
             }
 
-            this->frame_count += (this->frame_count + 1) % FRAME_FLIGHT_COUNT;
+            this->frame_count = (this->frame_count + 1) % this->frames_in_flight;
         }
 
         Mesh Renderer::create_mesh(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, uint32_t mat_id)
         {
+            if(vertices.empty() || indices.empty())
+            {
+                return upload_mesh(nullptr, 0, VertexFormat::STANDARD, {glm::vec3(0.0f), glm::vec3(1.0f)}, glm::vec4(0.0f), indices, mat_id);
+            }
+
+            // Bounding sphere around the center of the AABB. Not the tightest sphere but good enough for culling
+            glm::vec3 min = vertices[0].pos, max = vertices[0].pos;
+            for(const Vertex& vertex : vertices)
+            {
+                min = glm::min(min, vertex.pos);
+                max = glm::max(max, vertex.pos);
+            }
+            glm::vec3 center = (min + max) * 0.5f;
+            float radius = 0.0f;
+            for(const Vertex& vertex : vertices)
+            {
+                radius = glm::max(radius, glm::length(vertex.pos - center));
+            }
+
+            return upload_mesh(vertices.data(), static_cast<uint32_t>(vertices.size()), VertexFormat::STANDARD, {glm::vec3(0.0f), glm::vec3(1.0f)}, glm::vec4(center, radius), indices, mat_id);
+        }
+
+        Mesh Renderer::create_mesh(const std::vector<PackedVertex>& vertices, const VertexQuantization& quantization, const std::vector<unsigned int>& indices, uint32_t mat_id)
+        {
+            if(vertices.empty() || indices.empty())
+            {
+                return upload_mesh(nullptr, 0, VertexFormat::PACKED, quantization, glm::vec4(0.0f), indices, mat_id);
+            }
+
+            // The quantization box is the AABB so the sphere is centered on it. Radius uses the dequantized positions
+            glm::vec3 center = quantization.min + quantization.extent * 0.5f;
+            float radius = 0.0f;
+            for(const PackedVertex& vertex : vertices)
+            {
+                glm::vec3 pos = quantization.min + glm::vec3(vertex.pos[0], vertex.pos[1], vertex.pos[2]) / 65535.0f * quantization.extent;
+                radius = glm::max(radius, glm::length(pos - center));
+            }
+
+            return upload_mesh(vertices.data(), static_cast<uint32_t>(vertices.size()), VertexFormat::PACKED, quantization, glm::vec4(center, radius), indices, mat_id);
+        }
+
+        Mesh Renderer::upload_mesh(const void* vertex_data, uint32_t vertex_count, VertexFormat format, const VertexQuantization& quantization, const glm::vec4& bounds, 
+                                   const std::vector<unsigned int>& indices, uint32_t mat_id)
+        {
+            // Every index fits in 16 bits when there are at most 65536 vertices. Halves the index memory and fetch bandwidth
+            std::vector<uint16_t> indices16;
+            if(vertex_count > 0 && vertex_count <= 65536)
+            {
+                indices16.assign(indices.begin(), indices.end());
+                return create_mesh(vertex_data, vertex_count, format, quantization, bounds, indices16.data(), static_cast<uint32_t>(indices16.size()), VK_INDEX_TYPE_UINT16, mat_id);
+            }
+            return create_mesh(vertex_data, vertex_count, format, quantization, bounds, indices.data(), static_cast<uint32_t>(indices.size()), VK_INDEX_TYPE_UINT32, mat_id);
+        }
+
+        // Sub allocates the mesh out of the geometry pool. Vertex ranges are aligned to the format's stride so vertex_offset is in whole vertices
+        Mesh Renderer::create_mesh(const void* vertex_data, uint32_t vertex_count, VertexFormat format, const VertexQuantization& quantization, const glm::vec4& bounds,
+                                   const void* index_data, uint32_t index_count, VkIndexType index_type, uint32_t mat_id)
+        {
+            // Every mesh holds a reference to its material, even empty ones since destroy_mesh drops it either way
+            std::lock_guard<std::mutex> lock(this->resource_mutex);
+            add_material_ref(mat_id);
+
+            Mesh empty_mesh = { .first_index = 0, .index_count = 0, .vertex_offset = 0, .vertex_count = 0, .material_index = mat_id, .vertex_format = format, 
+                                .index_type = VK_INDEX_TYPE_UINT32, .bounds = glm::vec4(0.0f), .quantization = quantization, .first_meshlet = 0, .meshlet_count = 0, .upload = 0 };
+            if(vertex_count == 0 || index_count == 0)
+            {
+                return empty_mesh;
+            }
+
+            uint64_t stride = vertex_format_stride(format);
+            uint64_t vertex_size = vertex_count * stride;
+            uint64_t index_stride = index_type_size(index_type);
+            uint64_t index_size = index_count * index_stride;
+
+            uint64_t vertex_offset = this->geometry_pool.allocate_vertices(vertex_size, stride);
+            uint64_t index_offset = this->geometry_pool.allocate_indices(index_size, index_stride);
+            if(vertex_offset == OffsetAllocator::INVALID_OFFSET || index_offset == OffsetAllocator::INVALID_OFFSET)
+            {
+                std::cout << "Geometry pool is full, mesh with " << vertex_count << " vertices was not created" << std::endl;
+                this->geometry_pool.free_vertices(vertex_offset, vertex_size);
+                this->geometry_pool.free_indices(index_offset, index_size);
+                return empty_mesh;
+            }
+
+            this->upload_manager.upload_buffer(this->geometry_pool.get_vertex_buffer(), vertex_offset, vertex_data, vertex_size);
+            // Batches complete in order so the later of the two handles covers both
+            uint64_t upload = this->upload_manager.upload_buffer(this->geometry_pool.get_index_buffer(), index_offset, index_data, index_size);
+
             return {
-                .vertices = create_buffer((void*)vertices.data(), vertices.size() * sizeof(Vertex), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT),
-                .indices = create_buffer((void*)indices.data(), indices.size() * sizeof(unsigned int), VK_BUFFER_USAGE_INDEX_BUFFER_BIT),
-                .index_count = static_cast<uint32_t>(indices.size()),
-                .material_index = mat_id
+                .first_index = static_cast<uint32_t>(index_offset / index_stride),
+                .index_count = index_count,
+                .vertex_offset = static_cast<int32_t>(vertex_offset / stride),
+                .vertex_count = vertex_count,
+                .material_index = mat_id,
+                .vertex_format = format,
+                .index_type = index_type,
+                .bounds = bounds,
+                .quantization = quantization,
+                .first_meshlet = 0,
+                .meshlet_count = 0,
+                .upload = upload
             };
         }
 
         void Renderer::destroy_mesh(Mesh& mesh)
         {
-            destroy_buffer(mesh.vertices);
-            destroy_buffer(mesh.indices);
+            std::lock_guard<std::mutex> lock(this->resource_mutex);
+            // Frames in flight may still be drawing it, so the pool ranges can't be handed out again yet
+            if(mesh.index_count > 0 || mesh.meshlet_count > 0) retire_geometry(mesh);
+            drop_material_ref(mesh.material_index);
+            mesh.meshlet_count = 0;
             mesh.material_index = 0;
             mesh.index_count = 0;
+            mesh.vertex_count = 0;
+        }
+
+        void Renderer::upload_meshlets(Mesh& mesh, const std::vector<Meshlet>& meshlets)
+        {
+            upload_meshlets(mesh, meshlets.data(), static_cast<uint32_t>(meshlets.size()));
+        }
+
+        void Renderer::upload_meshlets(Mesh& mesh, const Meshlet* meshlets, uint32_t meshlet_count)
+        {
+            std::lock_guard<std::mutex> lock(this->resource_mutex);
+            if(mesh.meshlet_count > 0)
+            {
+                this->geometry_pool.free_meshlets((uint64_t)mesh.first_meshlet * sizeof(Meshlet), (uint64_t)mesh.meshlet_count * sizeof(Meshlet));
+                mesh.meshlet_count = 0;
+            }
+            if(meshlet_count == 0 || mesh.index_count == 0) return;
+
+            uint64_t size = (uint64_t)meshlet_count * sizeof(Meshlet);
+            uint64_t offset = this->geometry_pool.allocate_meshlets(size);
+            if(offset == OffsetAllocator::INVALID_OFFSET)
+            {
+                std::cout << "Meshlet pool is full, mesh will be culled as a whole" << std::endl;
+                return;
+            }
+
+            mesh.upload = this->upload_manager.upload_buffer(this->geometry_pool.get_meshlet_buffer(), offset, meshlets, size);
+
+            mesh.first_meshlet = static_cast<uint32_t>(offset / sizeof(Meshlet));
+            mesh.meshlet_count = meshlet_count;
         }
     }
 }
\ No newline at end of file
@@ -2,12 +2,22 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 #include <vector>
+#include <mutex>
+#include <unordered_map>
+#include <chrono>
 #include "DescriptorAllocator.h"
+#include "RenderQueue.h"
+#include "GeometryPool.h"
+#include "UploadManager.h"
+#include "PipelineCache.h"
+#include "../ThreadPool.h"
 #include "vma.h"
 #include "../twilight_types.h"
 #include "../Scene.h"
 
-#define FRAME_FLIGHT_COUNT 2
+// Frame data is allocated for the maximum, how many are actually used is set at runtime with set_frames_in_flight
+#define MAX_FRAMES_IN_FLIGHT 4
+#define DEFAULT_FRAMES_IN_FLIGHT 2
 
 namespace Twilight
 {
@@ -16,6 +26,40 @@ namespace Twilight
 
         void SetMaterial(Mesh& mesh, uint32_t material_id);
 
+        // FIFO is vsync and always supported. MAILBOX replaces queued images instead of waiting for them, IMMEDIATE doesn't wait
+        // for vblank at all and can tear, FIFO_RELAXED tears only when a frame misses its vblank
+        enum class PresentMode : uint8_t
+        {
+            FIFO,
+            FIFO_RELAXED,
+            MAILBOX,
+            IMMEDIATE
+        };
+
+        // Counters for the last recorded frame. A skipped bind is one the naive per-draw path would have issued
+        struct RenderStats
+        {
+            float record_ms;            // Cpu time spent building and recording draws
+            float wait_ms;              // Cpu time spent waiting on the frame timeline before the frame could be recorded
+            float input_latency_ms;     // From mark_input to the gpu finishing the frame built from it, for the latest frame seen finished.
+                                        // Completion is only checked in wait_frame, so this can be up to a frame over
+            uint32_t draw_count;
+            uint32_t instance_count;
+            uint32_t cluster_count;             // Clusters submitted to the cluster cull shader
+            uint32_t pipeline_binds, pipeline_binds_skipped;
+            uint32_t descriptor_binds, descriptor_binds_skipped;     // Counted per descriptor set
+            uint32_t vertex_buffer_binds, vertex_buffer_binds_skipped;
+            uint32_t index_buffer_binds, index_buffer_binds_skipped;
+            uint32_t secondary_count;           // Secondary command buffers the draws were recorded into, 0 if they went straight into the frame's
+        };
+
+        // Device local memory, as VMA tracks it
+        struct MemoryBudget
+        {
+            uint64_t usage;         // Includes other processes when VK_EXT_memory_budget is available
+            uint64_t budget;        // How much the driver says can be used before things start getting paged out
+        };
+
         class Renderer
         {
             private:
@@ -51,48 +95,188 @@ namespace Twilight
                 struct InternalFrameData
                 {
                     VkCommandPool pool;
-                    VkFence render_fence;
+                    std::vector<VkCommandPool> record_pools;    // One per recording chunk so chunks never share a pool between threads
+                    uint64_t timeline_value;    // Frame timeline value signalled by this slot's last submit, 0 before its first
+                    std::chrono::high_resolution_clock::time_point input_time;     // mark_input of the slot's last frame
+                    bool input_pending;         // Set until wait_frame sees that frame finish
                     VkSemaphore render_semaphore, swapchain_semaphore;
                 };
                 struct FrameData
                 {
                     VkCommandBuffer cmd;
+                    std::vector<VkCommandBuffer> record_cmds;   // Secondary buffer of each recording chunk, from the matching record pool
                     VkPipelineLayout layout;
                     uint32_t swapchain_index;
+                    VkDescriptorSet global_set;         // Global ubo + this frame's instance buffer
+                    Buffer instance_buffer;             // Per instance transforms indexed by gl_InstanceIndex
+                    uint32_t instance_capacity;
+
+                    // GPU driven path
+                    VkDescriptorSet cull_set;
+                    Buffer object_buffer;               // One ObjectData per draw, written by the cpu
+                    Buffer bucket_buffer;               // Draw count + first command per indirect draw
+                    Buffer command_buffer;              // VkDrawIndexedIndirectCommands written by the cull shader
+                    Buffer cluster_buffer;              // One ClusterData per meshlet (or whole mesh) for the cluster cull shader
+                    uint32_t object_capacity;
+                    uint32_t command_capacity;          // Also the cluster buffer's capacity
+                    uint32_t bucket_capacity;
+
+                    uint64_t upload_wait;               // Upload timeline value this frame's submit waits on, 0 for none
                 };
 
-                FrameData frames[FRAME_FLIGHT_COUNT];
-                InternalFrameData frames_intl[FRAME_FLIGHT_COUNT];
-                uint32_t frame_count = 0;
+                FrameData frames[MAX_FRAMES_IN_FLIGHT];
+                InternalFrameData frames_intl[MAX_FRAMES_IN_FLIGHT];
+                uint32_t frame_count = 0;       // Slot being recorded, cycles through frames_in_flight
+
+                // Every frame's submit signals frame_number + 1 here. Before recording, the cpu waits until no more than
+                // frames_in_flight - 1 earlier frames are still executing and the slot's own last submit has finished
+                VkSemaphore frame_timeline;
+                uint32_t frames_in_flight = DEFAULT_FRAMES_IN_FLIGHT;
+
+                // Set by wait_frame so present doesn't wait again. With the limiter on wait_frame waits for every submitted frame,
+                // not just the one frames_in_flight back, so input sampled after it never sits behind queued frames
+                bool frame_waited = false;
+                bool latency_limiter = false;
+                float frame_wait_ms = 0.0f;
+                float input_latency_ms = 0.0f;
+                std::chrono::high_resolution_clock::time_point input_time;
+                bool input_marked = false;
+
+                // What was asked for and what the surface ended up with
+                PresentMode present_mode = PresentMode::FIFO;
+                VkPresentModeKHR active_present_mode = VK_PRESENT_MODE_FIFO_KHR;
+                // Set by a present mode change or a suboptimal/out of date result, the swapchain is rebuilt at the start of the next present
+                bool swapchain_dirty = false;
 
                 DescriptorAllocator general_set_allocator;
-                DescriptorAllocator material_set_allocator;
-                /*std::vector<DescriptorAllocator> material_set_allocators;*/       // Have a separate allocator per material type (i.e. PBR has it's own allocator, PHONG has an allocator, and so on)
 
                 VkDescriptorPool imgui_pool;
 
 
                 // Material stuff
                 VkDescriptorSetLayout global_layout;
-                VkDescriptorSetLayout phong_layout;
-                //VkDescriptorSetLayout pbr_layout;
+                VkDescriptorSetLayout bindless_layout;
+
+                // Every texture lives in one big array and every material in one storage buffer so the
+                // material set only gets bound once per pipeline. Materials are indexed with the instance's material_index
+                VkDescriptorPool bindless_pool;
+                VkDescriptorSet bindless_set;
+                Buffer material_buffer;
+
+                // Bindless slots are refcounted by the materials sampling them. Images loaded with a content hash are looked up
+                // by it so identical images share one slot. Slot 0 is the default texture and is never freed
+                struct TextureSlot
+                {
+                    Image image;
+                    uint64_t content_hash;      // 0 if it isn't shared
+                    uint32_t ref_count;
+                };
+                std::vector<TextureSlot> texture_slots;
+                std::vector<uint32_t> free_texture_slots;
+                std::unordered_map<uint64_t, uint32_t> texture_lookup;
+
+                // Materials are refcounted by the meshes using them and by whoever loaded them. Keyed by pipeline sort id and
+                // texture slot so identical materials share an index. Material 0 is the default and is never freed
+                std::vector<uint32_t> material_refs;
+                std::vector<uint32_t> free_material_slots;
+                std::unordered_map<uint64_t, uint32_t> material_lookup;
+
+                // Released resources that frames still in flight may be reading, reclaimed once the frame timeline reaches the
+                // value of the frame that was being recorded when they were released.
+                // Slots are UINT32_MAX when there's none to give back, geometry has no counts when it holds no pool ranges
+                struct RetiredResource
+                {
+                    Image image;
+                    uint32_t texture_slot;
+                    uint32_t material_slot;
+                    Mesh geometry;
+                    uint64_t timeline_value;
+                };
+                std::vector<RetiredResource> retired_resources;
+
+                // Replaced swapchains along with their views and the depth buffer that matched them. Frames up to timeline_value
+                // may still be rendering to or presenting their images
+                struct RetiredSwapchain
+                {
+                    VkSwapchainKHR handle;
+                    std::vector<VkImageView> views;
+                    Image depth_buffer;
+                    uint64_t timeline_value;
+                };
+                std::vector<RetiredSwapchain> retired_swapchains;
+                uint64_t frame_number = 0;      // Frames submitted so far, also the last value signalled on frame_timeline
                 
                 GraphicsPipeline phong_pipeline;
+                // Same shaders as phong with the PACKED_VERTICES specialization constant set, for VertexFormat::PACKED meshes
+                GraphicsPipeline phong_packed_pipeline;
+                // Same as phong but with no vertex input, vertices are read through the geometry pool's device address
+                GraphicsPipeline phong_pulling_pipeline;
+                bool vertex_pulling = false;
                 //GraphicsPipeline pbr_pipeline;
                 //GraphicsPipeline transparent_pipeline;
 
-                GraphicsPipeline* bound_pipeline;
+                // Frustum culls draw_list on the gpu and writes indirect commands for the GPU driven path
+                VkDescriptorSetLayout cull_layout;
+                ComputePipeline cull_pipeline;
+                bool gpu_driven = false;
+
+                // Culls each meshlet against the frustum and its normal cone instead of whole objects. Needs gpu_driven
+                ComputePipeline cluster_cull_pipeline;
+                bool cluster_culling = false;
+
+                // One indirect count draw per pipeline
+                struct GpuBucket
+                {
+                    GraphicsPipeline* pipeline;
+                    VkIndexType index_type;
+                    uint32_t first_command;
+                    uint32_t max_draw_count;
+                };
+                std::vector<GpuBucket> gpu_buckets;
+                std::vector<uint32_t> pipeline_buckets;     // Indexed by sort_id * 2 + (index_type == UINT16)
+
+                // Bind tracking for one command buffer being recorded. Secondary buffers inherit no state so each chunk has its own
+                struct RecordState
+                {
+                    VkCommandBuffer cmd;
+                    GraphicsPipeline* bound_pipeline;
+                    VkIndexType bound_index_type;
+                    RenderStats stats;
+                };
+
+                // Runs of the same mesh and pipeline, each one an instanced draw. A batch's instances start at its first entry
+                struct CpuBatch
+                {
+                    GraphicsPipeline* pipeline;
+                    uint32_t first_entry;
+                    uint32_t entry_count;
+                };
+                std::vector<CpuBatch> cpu_batches;
+
+                // The CPU path's batches are split into contiguous chunks recorded into secondary command buffers on these
+                // threads (and the presenting one), then executed in order from the frame's buffer
+                ThreadPool record_pool;
+                uint32_t record_chunk_count = 0;
+                bool parallel_recording = true;
+
+                GeometryPool geometry_pool;
                 
                 Image depth_buffer;
 
-                VkDescriptorSet global_set;
                 Buffer global_ubo;
 
                 VkSampler default_sampler;
 
-                VkCommandPool transfer_pool;
-                VkCommandBuffer transfer_cmd;
-                VkFence transfer_fence;
+                // Every upload goes through here, batched on the transfer queue
+                UploadManager upload_manager;
+
+                // Every pipeline (ImGui's included) is created through this, and it's saved back to disk on deinit
+                PipelineCache pipeline_cache;
+                bool use_pipeline_cache = true;
+
+                // Held by every call that creates or destroys resources (upload manager, geometry pool, material list, bindless table)
+                // and by present from recording through the queue submits, so assets can be created from loader threads mid frame
+                mutable std::mutex resource_mutex;
                 
                 struct GlobalUbo
                 {
@@ -100,6 +284,8 @@ namespace Twilight
                     glm::mat4 view;
                 };
 
+                GlobalUbo global_ubo_data;
+
                 void init_vulkan();
                 void deinit_vulkan();
                 void init_imgui();
@@ -109,14 +295,45 @@ namespace Twilight
                 void deinit_material_layouts();
                 void init_material_pipelines();
                 void deinit_material_pipelines();
+                void init_compute_pipelines();
+                void deinit_compute_pipelines();
 
-                void bind_material(const Material& material);
+                void init_bindless();
+                void deinit_bindless();
+                uint32_t register_texture(const Image& image, uint64_t content_hash);
+                uint32_t add_material(const Material& material);
+                uint32_t acquire_material(GraphicsPipeline* pipeline, uint32_t texture_index);
+                void add_material_ref(uint32_t material_index);
+                void drop_material_ref(uint32_t material_index);
+                void drop_texture_ref(uint32_t texture_index);
+                void retire(const Image& image, uint32_t texture_slot, uint32_t material_slot);
+                void retire_geometry(const Mesh& mesh);
+                void free_geometry(const Mesh& mesh);
+                void reclaim_retired(bool all);
 
-                void create_swapchain(uint32_t width, uint32_t height);
+                void bind_pipeline(RecordState& state, GraphicsPipeline* pipeline);
+                void bind_geometry(RecordState& state);
+                void bind_index_buffer(RecordState& state, VkIndexType index_type);
+                GraphicsPipeline* resolve_pipeline(const Mesh& mesh);
+                bool can_blit_mips(VkFormat format) const;
+                bool reserve_instances(FrameData* frame, uint32_t instance_count);
+                void reserve_gpu_draws(FrameData* frame, uint32_t object_count, uint32_t command_count, uint32_t bucket_count);
+                uint16_t depth_key(const glm::mat4& transform) const;
+                Mesh upload_mesh(const void* vertex_data, uint32_t vertex_count, VertexFormat format, const VertexQuantization& quantization, const glm::vec4& bounds, 
+                                 const std::vector<unsigned int>& indices, uint32_t mat_id);
+
+                void create_swapchain(uint32_t width, uint32_t height, VkSwapchainKHR old_swapchain);
                 void destroy_swapchain();
+                bool recreate_swapchain();
                 void destroy_material(Material& material);
 
-                void frame_begin(FrameData* frame, InternalFrameData* internal_data);
+                bool frame_begin(FrameData* frame, InternalFrameData* internal_data);
+                void begin_main_pass(FrameData* frame, bool secondary);
+                void sort_cpu_draws(FrameData* frame);
+                void record_cpu_batches(RecordState& state, FrameData* frame, uint32_t first_batch, uint32_t batch_count);
+                void record_cpu_draws(FrameData* frame, InternalFrameData* internal_data, bool parallel);
+                void record_gpu_cull(FrameData* frame);
+                void record_gpu_draws(FrameData* frame);
                 void frame_end(FrameData* frame, InternalFrameData* internal_data);
 
                 void draw_gui();
@@ -129,6 +346,8 @@ namespace Twilight
                 };
 
                 std::vector<DrawData> draw_list;
+                RenderQueue render_queue;
+                RenderStats stats = {};
                 std::vector<Material> materials;
                 std::vector<Light> lights;
 
@@ -137,18 +356,34 @@ namespace Twilight
                 Renderer();
                 ~Renderer();
 
-                void init(GLFWwindow* window, uint32_t width, uint32_t height);
+                void init(GLFWwindow* window, uint32_t width, uint32_t height, PresentMode present_mode = PresentMode::FIFO);
+                // Call before init. Off builds every pipeline from SPIR-V, for comparing startup times against a warm cache
+                void set_pipeline_cache(bool enabled);
 
                 Buffer create_buffer(void* data, uint64_t size, VkBufferUsageFlags usage);
                 void destroy_buffer(Buffer& buffer);
                 
-                Image create_image(void* data, VkExtent3D size, VkFormat format, VkImageUsageFlags usage);
+                // mipmapped images get a full chain. data holds the first data_levels levels back to back, the rest are
+                // blitted on the gpu (or built on the cpu if the format can't be blitted)
+                Image create_image(void* data, VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mipmapped = false, uint32_t data_levels = 1);
                 void destroy_image(Image& image);
 
                 Mesh create_mesh(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, uint32_t mat_id);
+                Mesh create_mesh(const std::vector<PackedVertex>& vertices, const VertexQuantization& quantization, const std::vector<unsigned int>& indices, uint32_t mat_id);
+                // Geometry that's already in its final layout (a cooked mesh cache): indices in index_type and bounds precomputed.
+                // The data is only read while this runs
+                Mesh create_mesh(const void* vertex_data, uint32_t vertex_count, VertexFormat format, const VertexQuantization& quantization, const glm::vec4& bounds,
+                                 const void* index_data, uint32_t index_count, VkIndexType index_type, uint32_t mat_id);
                 void destroy_mesh(Mesh& mesh);
+                // Meshlet indices are relative to the mesh's indices. Replaces any meshlets the mesh already has
+                void upload_meshlets(Mesh& mesh, const std::vector<Meshlet>& meshlets);
+                void upload_meshlets(Mesh& mesh, const Meshlet* meshlets, uint32_t meshlet_count);
                 
+                // Returns a material with one reference held by the caller, shared with any identical material already loaded.
+                // Meshes hold their own reference from create_mesh until destroy_mesh
                 uint32_t load_material(std::vector<MaterialConstantBinding> constant_bindings, std::vector<MaterialTextureBinding> texture_bindings);
+                // Drops the caller's reference. The material and its texture are freed once nothing references them
+                void release_material(uint32_t material_id);
                 uint32_t add_light(const Light& light);
                 //void remove_light(uint32_t id);
                 void draw(const std::shared_ptr<SceneNode> node);
@@ -156,6 +391,46 @@ namespace Twilight
                 void present();
                 void wait();
                 void deinit();
+
+                const RenderStats& get_stats() const;
+
+                // Switches between recording one draw per batch on the cpu and gpu culling + vkCmdDrawIndexedIndirectCount
+                void set_gpu_driven(bool enabled);
+                bool is_gpu_driven() const;
+
+                // Switches between fixed function vertex input and fetching vertices in the shader through a buffer device address
+                void set_vertex_pulling(bool enabled);
+                bool is_vertex_pulling() const;
+
+                // Switches the GPU driven path between culling whole objects and culling meshlets
+                void set_cluster_culling(bool enabled);
+                bool is_cluster_culling() const;
+
+                // Uploads are batched and only submitted when flushed (at the latest at the start of the next frame).
+                // Handles come from Mesh::upload or flush_uploads. Buffers, images, meshes, meshlets and materials can be
+                // created from any thread
+                uint64_t flush_uploads();
+                bool is_upload_complete(uint64_t handle) const;
+                void wait_upload(uint64_t handle);
+                UploadManager::Stats get_upload_stats() const;
+
+                MemoryBudget get_memory_budget() const;
+                // Frames presented so far. draw stamps it on every node it visits as SceneNode::last_drawn_frame
+                uint64_t get_frame_number() const;
+                // Clamped to [1, MAX_FRAMES_IN_FLIGHT]. Takes effect from the next present
+                void set_frames_in_flight(uint32_t count);
+                uint32_t get_frames_in_flight() const;
+
+                // Falls back to FIFO if the surface doesn't support the mode. get_present_mode returns the one actually in use
+                void set_present_mode(PresentMode mode);
+                PresentMode get_present_mode() const;
+
+                // Blocks until the next frame can be recorded. Call it right before sampling input and simulating so the frame is
+                // built from the freshest input, present calls it itself otherwise
+                void wait_frame();
+                void set_latency_limiter(bool enabled);
+                // Timestamps the input the coming frame is built from, see RenderStats::input_latency_ms
+                void mark_input();
         };
     }
 }
\ No newline at end of file
@@ -0,0 +1,85 @@
+#include "RingAllocator.h"
+
+RingAllocator::RingAllocator()
+:capacity(0), head(0), used(0), pending(0)
+{
+
+}
+
+RingAllocator::~RingAllocator()
+{
+
+}
+
+void RingAllocator::init(uint64_t capacity)
+{
+    this->capacity = capacity;
+    this->head = 0;
+    this->used = 0;
+    this->pending = 0;
+    this->regions.clear();
+}
+
+// Allocations never straddle the end of the arena. If the range doesn't fit before the end, the rest of the arena
+// is skipped and counted as part of the allocation so it's released with it
+uint64_t RingAllocator::allocate(uint64_t size, uint64_t alignment)
+{
+    if(size == 0 || size > capacity) return INVALID_OFFSET;
+
+    uint64_t offset = (head + alignment - 1) / alignment * alignment;
+    if(offset + size > capacity)
+    {
+        offset = 0;
+    }
+
+    uint64_t consumed = offset >= head ? offset - head + size : capacity - head + size;
+    if(used + consumed > capacity) return INVALID_OFFSET;
+
+    used += consumed;
+    pending += consumed;
+    head = offset + size;
+    return offset;
+}
+
+void RingAllocator::commit(uint64_t value)
+{
+    if(pending == 0) return;
+
+    regions.push_back({pending, value});
+    pending = 0;
+}
+
+void RingAllocator::release(uint64_t completed_value)
+{
+    while(!regions.empty() && regions.front().value <= completed_value)
+    {
+        used -= regions.front().size;
+        regions.pop_front();
+    }
+
+    // Nothing live, start from the beginning again so the next allocations don't have to wrap
+    if(used == 0)
+    {
+        head = 0;
+    }
+}
+
+uint64_t RingAllocator::get_oldest_value() const
+{
+    return regions.empty() ? 0 : regions.front().value;
+}
+
+uint64_t RingAllocator::get_capacity() const
+{
+    return capacity;
+}
+
+uint64_t RingAllocator::get_used() const
+{
+    return used;
+}
+
+uint64_t RingAllocator::get_pending() const
+{
+    return pending;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <deque>
+#include <cstdint>
+
+// Hands out ranges of a fixed size arena in order, wrapping back to the start. Everything allocated between two
+// calls to commit is tagged with one value (a timeline semaphore value) and released together once that value completes
+class RingAllocator
+{
+    private:
+        struct Region
+        {
+            uint64_t size;      // Including any padding skipped for alignment or wrapping
+            uint64_t value;
+        };
+
+        std::deque<Region> regions;
+        uint64_t capacity;
+        uint64_t head;
+        uint64_t used;
+        uint64_t pending;       // Allocated since the last commit
+
+    public:
+        static constexpr uint64_t INVALID_OFFSET = UINT64_MAX;
+
+        RingAllocator();
+        ~RingAllocator();
+
+        void init(uint64_t capacity);
+
+        // Returns INVALID_OFFSET if there isn't a contiguous range free until older regions are released
+        uint64_t allocate(uint64_t size, uint64_t alignment = 1);
+        void commit(uint64_t value);
+        // Releases every committed region with a value <= completed_value
+        void release(uint64_t completed_value);
+
+        // Value of the oldest committed region, what has to complete before any more space frees up. 0 if there is none
+        uint64_t get_oldest_value() const;
+        uint64_t get_capacity() const;
+        uint64_t get_used() const;
+        uint64_t get_pending() const;
+};
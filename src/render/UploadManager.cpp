@@ -0,0 +1,452 @@
+#include "UploadManager.h"
+#include "render_backend.h"
+#include "render_util.h"
+#include <cstring>
+#include <algorithm>
+
+UploadManager::UploadManager()
+:device(VK_NULL_HANDLE), allocator(VK_NULL_HANDLE), queue(VK_NULL_HANDLE), transfer_family(0), graphics_family(0), timeline(VK_NULL_HANDLE), batches{},
+ current_batch(0), next_value(1), last_submitted(0), last_acquired(0), staging{}, stats{}
+{
+
+}
+
+UploadManager::~UploadManager()
+{
+
+}
+
+void UploadManager::init(VkDevice device, VmaAllocator allocator, VkQueue transfer_queue, uint32_t transfer_family, uint32_t graphics_family, uint64_t staging_size)
+{
+    this->device = device;
+    this->allocator = allocator;
+    this->queue = transfer_queue;
+    this->transfer_family = transfer_family;
+    this->graphics_family = graphics_family;
+
+    this->staging = Twilight::Render::Vulkan::create_buffer(allocator, staging_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+    this->staging_ring.init(staging_size);
+    this->stats = {};
+    this->stats.staging_capacity = staging_size;
+
+    VkSemaphoreTypeCreateInfo type_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+        .initialValue = 0
+    };
+
+    VkSemaphoreCreateInfo semaphore_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &type_info
+    };
+
+    VK_CHECK(vkCreateSemaphore(device, &semaphore_info, nullptr, &this->timeline));
+
+    VkCommandPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+        .queueFamilyIndex = transfer_family
+    };
+
+    for(Batch& batch : this->batches)
+    {
+        VK_CHECK(vkCreateCommandPool(device, &pool_info, nullptr, &batch.pool));
+
+        VkCommandBufferAllocateInfo alloc_info = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = batch.pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1
+        };
+
+        VK_CHECK(vkAllocateCommandBuffers(device, &alloc_info, &batch.cmd));
+        batch.value = 0;
+        batch.open = false;
+    }
+}
+
+void UploadManager::destroy()
+{
+    for(Batch& batch : this->batches)
+    {
+        if(!batch.open) retire(batch);
+        for(Twilight::Render::Buffer& buffer : batch.overflow)
+        {
+            Twilight::Render::Vulkan::destroy_buffer(this->allocator, buffer);
+        }
+        batch.overflow.clear();
+        vkDestroyCommandPool(this->device, batch.pool, nullptr);
+    }
+
+    Twilight::Render::Vulkan::destroy_buffer(this->allocator, this->staging);
+
+    vkDestroySemaphore(this->device, this->timeline, nullptr);
+}
+
+// Recycles the current batch if it isn't already recording. Only waits if the batch from BATCH_COUNT submits ago is still running
+UploadManager::Batch& UploadManager::open_batch()
+{
+    Batch& batch = this->batches[this->current_batch];
+    if(batch.open) return batch;
+
+    if(!is_complete(batch.value)) this->stats.stalls++;
+    retire(batch);
+    this->staging_ring.release(get_completed());
+
+    VK_CHECK(vkResetCommandPool(this->device, batch.pool, 0));
+
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+    };
+
+    VK_CHECK(vkBeginCommandBuffer(batch.cmd, &begin_info));
+
+    batch.value = this->next_value++;
+    batch.open = true;
+    return batch;
+}
+
+void UploadManager::retire(Batch& batch)
+{
+    if(batch.value == 0) return;
+
+    wait(batch.value);
+    for(Twilight::Render::Buffer& buffer : batch.overflow)
+    {
+        Twilight::Render::Vulkan::destroy_buffer(this->allocator, buffer);
+    }
+    batch.overflow.clear();
+    batch.value = 0;
+}
+
+// Finds room for size bytes of staging in the ring. When it's full, whatever the open batch staged is submitted
+// and the oldest batch still holding staging is waited on
+UploadManager::Batch& UploadManager::stage(uint64_t size, void** out_data, VkBuffer* out_buffer, uint64_t* out_offset)
+{
+    Batch* batch = &open_batch();
+    this->stats.uploaded_bytes += size;
+
+    if(size > this->staging_ring.get_capacity())
+    {
+        Twilight::Render::Buffer buffer = Twilight::Render::Vulkan::create_buffer(this->allocator, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+        batch->overflow.push_back(buffer);
+        this->stats.overflow_uploads++;
+        this->stats.overflow_bytes += size;
+        *out_data = buffer.info.pMappedData;
+        *out_buffer = buffer.handle;
+        *out_offset = 0;
+        return *batch;
+    }
+
+    // 16 covers the texel size alignment buffer to image copies need
+    uint64_t offset = this->staging_ring.allocate(size, 16);
+    if(offset == RingAllocator::INVALID_OFFSET)
+    {
+        this->staging_ring.release(get_completed());
+        offset = this->staging_ring.allocate(size, 16);
+    }
+
+    while(offset == RingAllocator::INVALID_OFFSET)
+    {
+        if(this->staging_ring.get_pending() > 0)
+        {
+            flush();
+            batch = &open_batch();
+        }
+
+        this->stats.stalls++;
+        wait(this->staging_ring.get_oldest_value());
+        this->staging_ring.release(get_completed());
+        offset = this->staging_ring.allocate(size, 16);
+    }
+
+    this->stats.staging_high_water = std::max(this->stats.staging_high_water, this->staging_ring.get_used());
+    *out_data = (uint8_t*)this->staging.info.pMappedData + offset;
+    *out_buffer = this->staging.handle;
+    *out_offset = offset;
+    return *batch;
+}
+
+UploadManager::Handle UploadManager::upload_buffer(const Twilight::Render::Buffer& dst, uint64_t dst_offset, const void* data, uint64_t size)
+{
+    if(size == 0) return 0;
+
+    void* staging_data;
+    VkBuffer staging_buffer;
+    uint64_t staging_offset;
+    Batch& batch = stage(size, &staging_data, &staging_buffer, &staging_offset);
+    memcpy(staging_data, data, size);
+
+    VkBufferCopy copy_info = {
+        .srcOffset = staging_offset,
+        .dstOffset = dst_offset,
+        .size = size
+    };
+    vkCmdCopyBuffer(batch.cmd, staging_buffer, dst.handle, 1, &copy_info);
+
+    // Same family means the semaphore wait is all the graphics queue needs
+    if(this->transfer_family != this->graphics_family)
+    {
+        VkBufferMemoryBarrier2 release = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+            .srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT,
+            .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+            .dstStageMask = VK_PIPELINE_STAGE_2_NONE,
+            .dstAccessMask = VK_ACCESS_2_NONE,
+            .srcQueueFamilyIndex = this->transfer_family,
+            .dstQueueFamilyIndex = this->graphics_family,
+            .buffer = dst.handle,
+            .offset = dst_offset,
+            .size = size
+        };
+
+        VkDependencyInfo dep_info = {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .bufferMemoryBarrierCount = 1,
+            .pBufferMemoryBarriers = &release
+        };
+        vkCmdPipelineBarrier2(batch.cmd, &dep_info);
+
+        VkBufferMemoryBarrier2 acquire = release;
+        acquire.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+        acquire.srcAccessMask = VK_ACCESS_2_NONE;
+        acquire.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+        acquire.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT;
+        this->buffer_acquires.push_back(acquire);
+    }
+
+    return batch.value;
+}
+
+UploadManager::Handle UploadManager::upload_image(const Twilight::Render::Image& dst, const void* data, uint64_t size, uint32_t data_levels)
+{
+    if(size == 0) return 0;
+
+    void* staging_data;
+    VkBuffer staging_buffer;
+    uint64_t staging_offset;
+    Batch& batch = stage(size, &staging_data, &staging_buffer, &staging_offset);
+    memcpy(staging_data, data, size);
+
+    Twilight::Render::Vulkan::Cmd::transition_image(batch.cmd, dst.handle, {VK_ACCESS_2_NONE, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_2_COPY_BIT,
+                                                    VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL}, { VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS });
+
+    std::vector<VkBufferImageCopy> copies(data_levels);
+    uint64_t level_offset = staging_offset;
+    for(uint32_t level = 0; level < data_levels; level++)
+    {
+        copies[level] = {
+            .bufferOffset = level_offset,
+            .imageSubresource = {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .mipLevel = level,
+                .baseArrayLayer = 0,
+                .layerCount = 1
+            },
+            .imageExtent = {std::max(dst.width >> level, 1u), std::max(dst.height >> level, 1u), dst.depth}
+        };
+        level_offset += Twilight::Render::Vulkan::get_image_level_size(dst.format, dst.width, dst.height, level);
+    }
+    vkCmdCopyBufferToImage(batch.cmd, staging_buffer, dst.handle, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, data_levels, copies.data());
+
+    // Images that still need mips stay in TRANSFER_DST_OPTIMAL for the blits, the graphics queue transitions them when it's done
+    bool generate_mips = data_levels < dst.mip_levels;
+    if(generate_mips)
+    {
+        this->mip_generations.push_back({dst.handle, dst.width, dst.height, data_levels, dst.mip_levels});
+    }
+
+    // The layout transition is part of the release and has to be repeated exactly by the acquire
+    bool transfer_ownership = this->transfer_family != this->graphics_family;
+    if(!transfer_ownership && generate_mips) return batch.value;
+
+    VkImageMemoryBarrier2 release = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+        .srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT,
+        .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+        .dstStageMask = VK_PIPELINE_STAGE_2_NONE,
+        .dstAccessMask = VK_ACCESS_2_NONE,
+        .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .newLayout = generate_mips ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        .srcQueueFamilyIndex = transfer_ownership ? this->transfer_family : VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = transfer_ownership ? this->graphics_family : VK_QUEUE_FAMILY_IGNORED,
+        .image = dst.handle,
+        .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS }
+    };
+
+    VkDependencyInfo dep_info = {
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .imageMemoryBarrierCount = 1,
+        .pImageMemoryBarriers = &release
+    };
+    vkCmdPipelineBarrier2(batch.cmd, &dep_info);
+
+    if(transfer_ownership)
+    {
+        VkImageMemoryBarrier2 acquire = release;
+        acquire.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+        acquire.srcAccessMask = VK_ACCESS_2_NONE;
+        acquire.dstStageMask = generate_mips ? VK_PIPELINE_STAGE_2_BLIT_BIT : VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+        acquire.dstAccessMask = generate_mips ? VK_ACCESS_2_TRANSFER_READ_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT : VK_ACCESS_2_MEMORY_READ_BIT;
+        this->image_acquires.push_back(acquire);
+    }
+
+    return batch.value;
+}
+
+// Blits each level from the one above it, same as the sketch in vulkan_backend.cpp but recorded on the graphics queue
+void UploadManager::record_mip_generation(VkCommandBuffer cmd, const MipGeneration& generation)
+{
+    Twilight::Render::Vulkan::Cmd::transition_image(cmd, generation.image, {VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, 
+                                                    VK_PIPELINE_STAGE_2_BLIT_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL}, 
+                                                    { VK_IMAGE_ASPECT_COLOR_BIT, 0, generation.first_level, 0, 1 });
+
+    for(uint32_t level = generation.first_level; level < generation.level_count; level++)
+    {
+        VkImageBlit blit = {
+            .srcSubresource = {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .mipLevel = level - 1,
+                .baseArrayLayer = 0,
+                .layerCount = 1
+            },
+            .srcOffsets = {{0, 0, 0}, {(int32_t)std::max(generation.width >> (level - 1), 1u), (int32_t)std::max(generation.height >> (level - 1), 1u), 1}},
+            .dstSubresource = {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .mipLevel = level,
+                .baseArrayLayer = 0,
+                .layerCount = 1
+            },
+            .dstOffsets = {{0, 0, 0}, {(int32_t)std::max(generation.width >> level, 1u), (int32_t)std::max(generation.height >> level, 1u), 1}}
+        };
+
+        vkCmdBlitImage(cmd, generation.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, generation.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+
+        // Source for the next level
+        Twilight::Render::Vulkan::Cmd::transition_image(cmd, generation.image, {VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, 
+                                                        VK_PIPELINE_STAGE_2_BLIT_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL}, 
+                                                        { VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1 });
+    }
+
+    Twilight::Render::Vulkan::Cmd::transition_image(cmd, generation.image, {VK_ACCESS_2_TRANSFER_READ_BIT, VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, 
+                                                    VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL}, 
+                                                    { VK_IMAGE_ASPECT_COLOR_BIT, 0, generation.level_count, 0, 1 });
+}
+
+UploadManager::Handle UploadManager::flush()
+{
+    Batch& batch = this->batches[this->current_batch];
+    if(!batch.open) return this->last_submitted;
+
+    VK_CHECK(vkEndCommandBuffer(batch.cmd));
+
+    VkCommandBufferSubmitInfo cmd_submit_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+        .commandBuffer = batch.cmd,
+        .deviceMask = 0
+    };
+
+    VkSemaphoreSubmitInfo signal_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+        .semaphore = this->timeline,
+        .value = batch.value,
+        .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+        .deviceIndex = 0
+    };
+
+    VkSubmitInfo2 submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+        .commandBufferInfoCount = 1,
+        .pCommandBufferInfos = &cmd_submit_info,
+        .signalSemaphoreInfoCount = 1,
+        .pSignalSemaphoreInfos = &signal_info
+    };
+
+    VK_CHECK(vkQueueSubmit2(this->queue, 1, &submit_info, VK_NULL_HANDLE));
+
+    // Everything staged by this batch is free once its value completes
+    this->staging_ring.commit(batch.value);
+    this->stats.batches_submitted++;
+    batch.open = false;
+    this->last_submitted = batch.value;
+    this->current_batch = (this->current_batch + 1) % BATCH_COUNT;
+    return this->last_submitted;
+}
+
+bool UploadManager::is_complete(Handle handle) const
+{
+    if(handle == 0) return true;
+    if(handle > this->last_submitted) return false;
+
+    return get_completed() >= handle;
+}
+
+UploadManager::Handle UploadManager::get_completed() const
+{
+    uint64_t value = 0;
+    VK_CHECK(vkGetSemaphoreCounterValue(this->device, this->timeline, &value));
+    return value;
+}
+
+void UploadManager::submit(Handle handle)
+{
+    if(handle > this->last_submitted) flush();
+}
+
+void UploadManager::wait(Handle handle) const
+{
+    if(handle == 0) return;
+
+    VkSemaphoreWaitInfo wait_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .semaphoreCount = 1,
+        .pSemaphores = &this->timeline,
+        .pValues = &handle
+    };
+
+    VK_CHECK(vkWaitSemaphores(this->device, &wait_info, UINT64_MAX));
+}
+
+UploadManager::Handle UploadManager::record_acquires(VkCommandBuffer cmd)
+{
+    flush();
+    this->staging_ring.release(get_completed());
+
+    if(this->last_submitted == this->last_acquired) return 0;
+
+    if(!this->buffer_acquires.empty() || !this->image_acquires.empty())
+    {
+        VkDependencyInfo dep_info = {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .bufferMemoryBarrierCount = static_cast<uint32_t>(this->buffer_acquires.size()),
+            .pBufferMemoryBarriers = this->buffer_acquires.data(),
+            .imageMemoryBarrierCount = static_cast<uint32_t>(this->image_acquires.size()),
+            .pImageMemoryBarriers = this->image_acquires.data()
+        };
+        vkCmdPipelineBarrier2(cmd, &dep_info);
+
+        this->buffer_acquires.clear();
+        this->image_acquires.clear();
+    }
+
+    for(const MipGeneration& generation : this->mip_generations)
+    {
+        record_mip_generation(cmd, generation);
+    }
+    this->mip_generations.clear();
+
+    this->last_acquired = this->last_submitted;
+    return this->last_acquired;
+}
+
+VkSemaphore UploadManager::get_semaphore() const
+{
+    return this->timeline;
+}
+
+const UploadManager::Stats& UploadManager::get_stats() const
+{
+    this->stats.staging_used = this->staging_ring.get_used();
+    return this->stats;
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <vector>
+#include "RingAllocator.h"
+#include "../twilight_types.h"
+
+// Records buffer and image uploads on the transfer queue in batches instead of submitting and waiting on every copy.
+// Each batch signals the next value of one timeline semaphore, an upload's handle is the value its batch signals.
+// Data is staged in one persistently mapped ring that is reclaimed as those values complete.
+// When the transfer queue is from a different family the resources are released by the batch and have to be
+// acquired on the graphics queue with record_acquires before they are used. Mips are blitted there too since
+// transfer queues can't blit
+class UploadManager
+{
+    public:
+        typedef uint64_t Handle;        // 0 is always complete
+
+        struct Stats
+        {
+            uint64_t staging_capacity;
+            uint64_t staging_used;          // Still waiting on the gpu (or the open batch)
+            uint64_t staging_high_water;
+            uint64_t uploaded_bytes;
+            uint32_t batches_submitted;
+            uint32_t stalls;                // Times an upload had to wait on the gpu for staging space or a free batch
+            uint32_t overflow_uploads;      // Bigger than the whole ring, staged in a buffer of their own
+            uint64_t overflow_bytes;
+        };
+
+    private:
+        static constexpr uint32_t BATCH_COUNT = 4;
+
+        struct Batch
+        {
+            VkCommandPool pool;
+            VkCommandBuffer cmd;
+            std::vector<Twilight::Render::Buffer> overflow;     // Dedicated staging for uploads bigger than the ring, freed on retire
+            Handle value;
+            bool open;
+        };
+
+        VkDevice device;
+        VmaAllocator allocator;
+        VkQueue queue;
+        uint32_t transfer_family;
+        uint32_t graphics_family;
+        VkSemaphore timeline;
+
+        Batch batches[BATCH_COUNT];
+        uint32_t current_batch;
+        Handle next_value;
+        Handle last_submitted;
+        Handle last_acquired;           // Highest value the graphics queue has been told to wait on
+
+        Twilight::Render::Buffer staging;
+        RingAllocator staging_ring;
+        mutable Stats stats;
+
+        // Acquire halves of the ownership transfers for submitted batches, recorded on the graphics queue
+        std::vector<VkBufferMemoryBarrier2> buffer_acquires;
+        std::vector<VkImageMemoryBarrier2> image_acquires;
+
+        struct MipGeneration
+        {
+            VkImage image;
+            uint32_t width, height;
+            uint32_t first_level;       // First level without data, generated from the one before it
+            uint32_t level_count;
+        };
+        std::vector<MipGeneration> mip_generations;
+
+        Batch& open_batch();
+        Batch& stage(uint64_t size, void** out_data, VkBuffer* out_buffer, uint64_t* out_offset);
+        void retire(Batch& batch);
+        Handle get_completed() const;
+        void record_mip_generation(VkCommandBuffer cmd, const MipGeneration& generation);
+
+    public:
+        UploadManager();
+        ~UploadManager();
+
+        void init(VkDevice device, VmaAllocator allocator, VkQueue transfer_queue, uint32_t transfer_family, uint32_t graphics_family, uint64_t staging_size);
+        void destroy();
+
+        // Data is copied out before these return so it can be freed straight away. Nothing is submitted until flush
+        Handle upload_buffer(const Twilight::Render::Buffer& dst, uint64_t dst_offset, const void* data, uint64_t size);
+        // Writes the first data_levels mips (packed back to back in data) and leaves the image in SHADER_READ_ONLY_OPTIMAL.
+        // Any levels past those are blitted from the last one on the graphics queue, which needs TRANSFER_SRC usage as well as TRANSFER_DST
+        Handle upload_image(const Twilight::Render::Image& dst, const void* data, uint64_t size, uint32_t data_levels = 1);
+
+        // Submits the open batch. Returns the value that batch signals
+        Handle flush();
+        bool is_complete(Handle handle) const;
+        // Flushes if handle is still in the open batch, waiting on it before that would never return
+        void submit(Handle handle);
+        // Blocks until a submitted handle's batch has finished. Only waits on the semaphore, so it can run without whatever
+        // lock guards the rest of the manager
+        void wait(Handle handle) const;
+
+        // Flushes, records the acquire barriers and mip blits for everything submitted since the last call and returns the
+        // timeline value the graphics submit has to wait on, 0 if there's nothing new
+        Handle record_acquires(VkCommandBuffer cmd);
+        VkSemaphore get_semaphore() const;
+        const Stats& get_stats() const;
+};
@@ -1,6 +1,7 @@
 #include "render_backend.h"
 #include "render_util.h"
 #include <fstream>
+#include <algorithm>
 
 namespace Twilight
 {
@@ -24,28 +25,6 @@ namespace Twilight
                 return buffer;
             }
 
-            Buffer create_buffer(VkDevice device, const TransferInfo& info, VmaAllocator allocator, void* data, uint64_t size, VkBufferUsageFlags usage)
-            {
-                Buffer staging_buffer = create_buffer(allocator, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
-                void* staging_ptr = staging_buffer.info.pMappedData;
-                memcpy(staging_ptr, data, size);
-
-                Buffer gpu_buffer = create_buffer(allocator, size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
-
-                transfer_begin(device, info);
-                VkBufferCopy copy_info = {
-                    .srcOffset = 0,
-                    .dstOffset = 0,
-                    .size = size,
-                };
-                vkCmdCopyBuffer(info.cmd, staging_buffer.handle, gpu_buffer.handle, 1, &copy_info);
-                transfer_end(device, info);
-
-                vmaDestroyBuffer(allocator, staging_buffer.handle, staging_buffer.allocation);
-
-                return gpu_buffer;
-            }
-
             void destroy_buffer(VmaAllocator allocator, Buffer& buffer)
             {
                 if(buffer.handle == VK_NULL_HANDLE) return;
@@ -56,14 +35,14 @@ namespace Twilight
                 buffer.info = {};
             }
 
-            Image create_image(VkDevice device, VmaAllocator allocator, VkExtent3D size, VkFormat format, VkImageUsageFlags usage)
+            Image create_image(VkDevice device, VmaAllocator allocator, VkExtent3D size, VkFormat format, VkImageUsageFlags usage, uint32_t mip_levels)
             {
                 VkImageCreateInfo image_info = {
                     .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
                     .imageType = VK_IMAGE_TYPE_2D,
                     .format = format,
                     .extent = size,
-                    .mipLevels = 1,
+                    .mipLevels = mip_levels,
                     .arrayLayers = 1,
                     .samples = VK_SAMPLE_COUNT_1_BIT,
                     .tiling = VK_IMAGE_TILING_OPTIMAL,
@@ -75,7 +54,7 @@ namespace Twilight
                     .requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
                 };
 
-                Image image = { .format = format, .width = size.width, .height = size.height, .depth = size.depth };
+                Image image = { .format = format, .width = size.width, .height = size.height, .depth = size.depth, .mip_levels = mip_levels };
 
                 VK_CHECK(vmaCreateImage(allocator, &image_info, &alloc_info, &image.handle, &image.allocation, &image.info));
 
@@ -100,99 +79,24 @@ namespace Twilight
                 return image;
             }
 
-            Image create_image(VkDevice device, VmaAllocator allocator, const TransferInfo& info, void* data, VkExtent3D size, VkFormat format, VkImageUsageFlags usage)
+            uint64_t get_image_level_size(VkFormat format, uint32_t width, uint32_t height, uint32_t level)
             {
-                // FIXME: Potential bug if pixel channels != 4
-                uint64_t data_size = size.width * size.height * size.depth * 4;
-                Buffer staging_buffer = create_buffer(allocator, data_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
-                void* buffer_ptr = staging_buffer.info.pMappedData;
-                memcpy(buffer_ptr, data, data_size);
-
-                Image image = create_image(device, allocator, size, format, usage | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
-
-                transfer_begin(device, info);
-
+                uint32_t level_width = std::max(width >> level, 1u), level_height = std::max(height >> level, 1u);
+                switch(format)
                 {
-                    ImageTransitionInfo transition_info = {
-                        .src_access = VK_ACCESS_2_NONE,
-                        .src_stage = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
-                        .dst_access = VK_ACCESS_2_TRANSFER_WRITE_BIT,
-                        .dst_stage = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
-                        .old_layout = VK_IMAGE_LAYOUT_UNDEFINED,
-                        .new_layout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                    };
-
-                    Cmd::transition_image(info.cmd, image.handle, transition_info, { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
+                    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+                    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+                    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+                    case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+                        return (uint64_t)((level_width + 3) / 4) * ((level_height + 3) / 4) * 8;
+                    case VK_FORMAT_BC5_UNORM_BLOCK:
+                    case VK_FORMAT_BC5_SNORM_BLOCK:
+                    case VK_FORMAT_BC7_UNORM_BLOCK:
+                    case VK_FORMAT_BC7_SRGB_BLOCK:
+                        return (uint64_t)((level_width + 3) / 4) * ((level_height + 3) / 4) * 16;
+                    default:
+                        return (uint64_t)level_width * level_height * 4;
                 }
-
-                {
-                    VkBufferImageCopy copy_info = {
-                        .imageExtent = size
-                    };
-
-                    VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
-
-                    copy_info.imageSubresource = {
-                        .aspectMask = aspect,
-                        .mipLevel = 0,
-                        .baseArrayLayer = 0,
-                        .layerCount = 1
-                    };
-
-                    vkCmdCopyBufferToImage(info.cmd, staging_buffer.handle, image.handle, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy_info);
-                }
-
-                {
-                    ImageTransitionInfo transition_info = {
-                        .src_access = VK_ACCESS_2_TRANSFER_WRITE_BIT,
-                        .src_stage = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
-                        .dst_access = VK_ACCESS_2_NONE,
-                        .dst_stage = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
-                        .old_layout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                        .new_layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-                    };
-
-                    Cmd::transition_image(info.cmd, image.handle, transition_info, { VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS });
-                }
-
-                transfer_end(device, info);
-
-                vmaDestroyBuffer(allocator, staging_buffer.handle, staging_buffer.allocation);
-
-                return image;
-            }
-
-            void transfer_begin(VkDevice device, const TransferInfo& info)
-            {
-                VK_CHECK(vkResetFences(device, 1, &info.fence));
-                VK_CHECK(vkResetCommandBuffer(info.cmd, 0));
-
-                VkCommandBufferBeginInfo begin_info = {
-                    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-                    .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
-                };
-
-                VK_CHECK(vkBeginCommandBuffer(info.cmd, &begin_info));
-            }
-
-            void transfer_end(VkDevice device, const TransferInfo& info)
-            {
-                VK_CHECK(vkEndCommandBuffer(info.cmd));
-
-                VkCommandBufferSubmitInfo buffer_submit_info = {
-                    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
-                    .commandBuffer = info.cmd,
-                    .deviceMask = 0
-                };
-
-                VkSubmitInfo2 submit_info = {
-                    .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
-                    .commandBufferInfoCount = 1,
-                    .pCommandBufferInfos = &buffer_submit_info
-                };
-
-                VK_CHECK(vkQueueSubmit2(info.queue, 1, &submit_info, info.fence));
-                VK_CHECK(vkWaitForFences(device, 1, &info.fence, true, UINT64_MAX));
             }
 
             void destroy_image(VkDevice device, VmaAllocator allocator, Image& image)
@@ -237,6 +141,26 @@ namespace Twilight
             return true;
         }
 
+        // The pipeline does not take ownership of the layout and will not destroy it
+        ComputePipeline create_compute_pipeline(VkDevice device, VkPipelineLayout layout, VkShaderModule shader, VkPipelineCache cache)
+        {
+            VkComputePipelineCreateInfo pipeline_info = {
+                .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+                .stage = {
+                    .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                    .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+                    .module = shader,
+                    .pName = "main"
+                },
+                .layout = layout
+            };
+
+            VkPipeline pipeline;
+            VK_CHECK(vkCreateComputePipelines(device, cache, 1, &pipeline_info, nullptr, &pipeline));
+
+            return {pipeline, layout};
+        }
+
             namespace Cmd
             {
                 void transition_image(VkCommandBuffer cmd, VkImage image, const ImageTransitionInfo& info, VkImageSubresourceRange sub_image)
@@ -261,6 +185,25 @@ namespace Twilight
                 
                     vkCmdPipelineBarrier2(cmd, &dep_info);
                 }
+
+                void memory_barrier(VkCommandBuffer cmd, VkPipelineStageFlags2 src_stage, VkAccessFlags2 src_access, VkPipelineStageFlags2 dst_stage, VkAccessFlags2 dst_access)
+                {
+                    VkMemoryBarrier2 barrier = {
+                        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+                        .srcStageMask = src_stage,
+                        .srcAccessMask = src_access,
+                        .dstStageMask = dst_stage,
+                        .dstAccessMask = dst_access
+                    };
+
+                    VkDependencyInfo dep_info = {
+                        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+                        .memoryBarrierCount = 1,
+                        .pMemoryBarriers = &barrier
+                    };
+
+                    vkCmdPipelineBarrier2(cmd, &dep_info);
+                }
             }
         }
     }
@@ -7,13 +7,6 @@ namespace Twilight
     {
         namespace Vulkan
         {
-            struct TransferInfo
-            {
-                VkCommandBuffer cmd;
-                VkQueue queue;
-                VkFence fence;
-            };
-
             struct ImageTransitionInfo
             {
                 VkAccessFlags2 src_access;
@@ -24,22 +17,21 @@ namespace Twilight
                 VkImageLayout new_layout;
             };
             bool load_shader_module(const char* path, VkDevice device, VkShaderModule* out_module);
+            ComputePipeline create_compute_pipeline(VkDevice device, VkPipelineLayout layout, VkShaderModule shader, VkPipelineCache cache);
 
             Buffer create_buffer(VmaAllocator allocator, uint64_t size, VkBufferUsageFlags usage, VmaMemoryUsage alloc_usage);
-
-            /* TODO: Make this more efficient with the staging buffer */
-            Buffer create_buffer(VkDevice device, const TransferInfo& info, VmaAllocator allocator, void* data, uint64_t size, VkBufferUsageFlags usage);
+            // Uploads go through UploadManager, these only create the resource
             void destroy_buffer(VmaAllocator allocator, Buffer& buffer);
 
-            Image create_image(VkDevice device, VmaAllocator allocator, VkExtent3D size, VkFormat format, VkImageUsageFlags usage);
-            Image create_image(VkDevice device, VmaAllocator allocator, const TransferInfo& info, void* data, VkExtent3D size, VkFormat format, VkImageUsageFlags usage);
+            Image create_image(VkDevice device, VmaAllocator allocator, VkExtent3D size, VkFormat format, VkImageUsageFlags usage, uint32_t mip_levels = 1);
+            // Bytes in one tightly packed mip level. BC1/BC5/BC7 are counted in 4x4 blocks, everything else as 4 byte texels
+            uint64_t get_image_level_size(VkFormat format, uint32_t width, uint32_t height, uint32_t level);
             void destroy_image(VkDevice device, VmaAllocator allocator, Image& image);
-            void transfer_begin(VkDevice device, const TransferInfo& info);
-            void transfer_end(VkDevice device, const TransferInfo& info);
 
             namespace Cmd
             {
                 void transition_image(VkCommandBuffer cmd, VkImage image, const ImageTransitionInfo& info, VkImageSubresourceRange sub_image);
+                void memory_barrier(VkCommandBuffer cmd, VkPipelineStageFlags2 src_stage, VkAccessFlags2 src_access, VkPipelineStageFlags2 dst_stage, VkAccessFlags2 dst_access);
             }
         }
     }
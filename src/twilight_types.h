@@ -10,6 +10,13 @@ namespace Twilight
     namespace Render
     {
         struct GraphicsPipeline
+        {
+            VkPipeline handle;
+            VkPipelineLayout layout;
+            uint32_t sort_id;       // Small id used by the render queue to group draws by pipeline
+        };
+
+        struct ComputePipeline
         {
             VkPipeline handle;
             VkPipelineLayout layout;
@@ -30,12 +37,13 @@ namespace Twilight
             VmaAllocationInfo info;
             VkFormat format;
             uint32_t width, height, depth;
+            uint32_t mip_levels;
         };
 
         struct Material
         {
             GraphicsPipeline* pipeline;
-            VkDescriptorSet descriptor_set;
+            uint32_t texture_index;         // Slot in the renderer's bindless texture table
             Buffer buffer;
             Image texture;
         };
@@ -64,6 +72,9 @@ namespace Twilight
             void* data;
             uint32_t width, height;
             MaterialTextureType type;
+            uint32_t mip_levels;        // Levels stored back to back in data. 1 to have the renderer generate the rest
+            VkFormat format;            // VK_FORMAT_UNDEFINED for RGBA8. Block compressed data has to carry all its mips
+            uint64_t content_hash;      // Identifies the image data so identical images share one upload, 0 to never share
         };
 
         struct Vertex
@@ -73,12 +84,58 @@ namespace Twilight
             glm::vec2 tex;
         };
 
+        // 16 byte vertex. Positions are 16 bit unorm relative to the mesh's AABB (see VertexQuantization),
+        // the normal is octahedral encoded into two 16 bit snorms and the uvs are half floats
+        struct PackedVertex
+        {
+            uint16_t pos[4];        // w is padding
+            uint32_t norm;
+            uint32_t tex;
+        };
+
+        // Maps a PackedVertex position back to object space: pos = min + unorm_pos * extent.
+        // Folded into the model matrix when drawing so the shaders never see it
+        struct VertexQuantization
+        {
+            glm::vec3 min;
+            glm::vec3 extent;
+        };
+
+        // Layout of a mesh's vertices in the geometry pool. Fixed function vertex input uses a pipeline per format,
+        // the vertex pulling shader decodes every format itself
+        enum class VertexFormat : uint32_t
+        {
+            STANDARD = 0,           // Vertex (32 bytes)
+            PACKED = 1              // PackedVertex (16 bytes)
+        };
+
+        // Cluster of at most 64 vertices / 124 triangles for cluster culling. Matches MeshletData in cluster_cull.comp (std430).
+        // The triangles are a contiguous range of the mesh's indices
+        struct Meshlet
+        {
+            glm::vec4 sphere;           // Object space bounding sphere (xyz = center, w = radius)
+            glm::vec4 cone;             // xyz = axis, w = cutoff. Backfacing if dot(normalize(apex - camera), axis) >= cutoff
+            glm::vec3 cone_apex;
+            uint32_t first_index;       // Relative to the mesh's first_index
+            uint32_t index_count;
+            uint32_t padding[3];
+        };
+
+        // Geometry lives in the renderer's geometry pool. These are the ranges passed straight to vkCmdDrawIndexed
         struct Mesh
         {
-            Buffer vertices;
-            Buffer indices;
+            uint32_t first_index;
             uint32_t index_count;
+            int32_t vertex_offset;
+            uint32_t vertex_count;
             uint32_t material_index;
+            VertexFormat vertex_format;
+            VkIndexType index_type;     // UINT16 when the vertex count allows it. first_index is in units of this type
+            glm::vec4 bounds;           // Object space bounding sphere (xyz = center, w = radius)
+            VertexQuantization quantization;        // Identity ({0, 1}) for unpacked formats
+            uint32_t first_meshlet;     // Into the geometry pool's meshlet buffer. meshlet_count is 0 if the mesh has no meshlets
+            uint32_t meshlet_count;
+            uint64_t upload;            // Renderer upload handle, the geometry is on the gpu once it completes
         };
         
 